@@ -0,0 +1,244 @@
+// =============================================================================
+// CILPE - Partial Evaluator for Common Intermediate Language
+// =============================================================================
+// File:
+//     AnnotatingTasks.cs
+//
+// Description:
+//     Priority worklist of annotating visitor
+//
+// Author:
+//     Yuri Klimov (yuri.klimov@cilpe.net)
+// =============================================================================
+
+using System;
+
+namespace CILPE.BTA
+{
+    using System.Collections;
+    using CILPE.CFG;
+
+
+    /* Tasks of annotating visitor ordered by reverse postorder of source
+     * nodes, so loop headers and merge points are annotated before the
+     * nodes that follow them. Tasks for the same source node are taken
+     * in LIFO order, like in the task stack.
+     */
+    internal class AnnotatingTasks : VisitorTaskCollection
+    {
+        #region Private classes
+
+        private class Task
+        {
+            internal readonly int Rank;
+
+            internal readonly int Number;
+
+            internal readonly Node Node;
+
+            internal readonly object Data;
+
+            internal Task (int rank, int number, Node node, object data)
+            {
+                this.Rank = rank;
+                this.Number = number;
+                this.Node = node;
+                this.Data = data;
+            }
+
+            internal bool Before (Task task)
+            {
+                return this.Rank < task.Rank || (this.Rank == task.Rank && this.Number > task.Number);
+            }
+        }
+
+
+        #endregion
+
+        #region Private static members
+
+        private static readonly string ReversePostorderOption = "ReversePostorder";
+
+        private static void computeReversePostorder (MethodBodyBlock mbb)
+        {
+            ArrayList postorder = new ArrayList();
+            Hashtable visited = new Hashtable();
+            Stack nodes = new Stack();
+            Stack indices = new Stack();
+
+            visited[mbb] = true;
+            nodes.Push(mbb);
+            indices.Push(0);
+            while (nodes.Count > 0)
+            {
+                Node node = nodes.Peek() as Node;
+                int index = (int) indices.Pop();
+
+                ArrayList next = new ArrayList();
+                for (int i = 0; i < node.NextArray.Count; i++)
+                    next.Add(node.NextArray[i]);
+                if (node is ProtectedBlock)
+                    foreach (EHBlock handler in node as ProtectedBlock)
+                        next.Add(handler);
+
+                while (index < next.Count && (next[index] == null || visited.ContainsKey(next[index])))
+                    index++;
+
+                if (index < next.Count)
+                {
+                    Node child = next[index] as Node;
+                    indices.Push(index + 1);
+                    visited[child] = true;
+                    nodes.Push(child);
+                    indices.Push(0);
+                }
+                else
+                {
+                    nodes.Pop();
+                    postorder.Add(node);
+                }
+            }
+
+            for (int i = 0; i < postorder.Count; i++)
+                (postorder[i] as Node).Options[AnnotatingTasks.ReversePostorderOption] = postorder.Count - 1 - i;
+        }
+
+        private static int getRank (Node downNode)
+        {
+            if (downNode == null)
+                return 0;
+
+            object rank = downNode.Options[AnnotatingTasks.ReversePostorderOption];
+            if (rank == null)
+                lock (Annotation.SourceOptionsLock)
+                {
+                    rank = downNode.Options[AnnotatingTasks.ReversePostorderOption];
+                    if (rank == null)
+                    {
+                        Node mbb = downNode;
+                        while (mbb != null && ! (mbb is MethodBodyBlock))
+                            mbb = mbb.Parent;
+                        if (mbb != null)
+                            AnnotatingTasks.computeReversePostorder(mbb as MethodBodyBlock);
+
+                        rank = downNode.Options[AnnotatingTasks.ReversePostorderOption];
+                        if (rank == null)
+                            downNode.Options[AnnotatingTasks.ReversePostorderOption] = rank = 0;
+                    }
+                }
+
+            return (int) rank;
+        }
+
+        #endregion
+
+        #region Private members
+
+        private readonly UpAndDownNodes upDownNodes;
+
+        private readonly ArrayList heap;
+
+        /* Removed node -> number of the first task that is still valid */
+        private readonly Hashtable removed;
+
+        private int count;
+
+        private void swap (int i, int j)
+        {
+            object task = this.heap[i];
+            this.heap[i] = this.heap[j];
+            this.heap[j] = task;
+        }
+
+        private void siftUp (int i)
+        {
+            while (i > 0 && (this.heap[i] as Task).Before(this.heap[(i - 1) / 2] as Task))
+            {
+                this.swap(i, (i - 1) / 2);
+                i = (i - 1) / 2;
+            }
+        }
+
+        private void siftDown (int i)
+        {
+            while (true)
+            {
+                int first = i;
+                int left = 2 * i + 1, right = left + 1;
+                if (left < this.heap.Count && (this.heap[left] as Task).Before(this.heap[first] as Task))
+                    first = left;
+                if (right < this.heap.Count && (this.heap[right] as Task).Before(this.heap[first] as Task))
+                    first = right;
+
+                if (first == i)
+                    break;
+
+                this.swap(i, first);
+                i = first;
+            }
+        }
+
+        private void removeTop ()
+        {
+            int last = this.heap.Count - 1;
+            this.heap[0] = this.heap[last];
+            this.heap.RemoveAt(last);
+            if (this.heap.Count > 0)
+                this.siftDown(0);
+        }
+
+        private bool isRemoved (Task task)
+        {
+            object number = this.removed[task.Node];
+            return number != null && task.Number < (int) number;
+        }
+
+        /* Drops removed tasks from the top of the heap */
+        private void purge ()
+        {
+            while (this.heap.Count > 0 && this.isRemoved(this.heap[0] as Task))
+                this.removeTop();
+        }
+
+        #endregion
+
+        internal AnnotatingTasks (UpAndDownNodes upDownNodes)
+        {
+            this.upDownNodes = upDownNodes;
+            this.heap = new ArrayList();
+            this.removed = new Hashtable();
+            this.count = 0;
+        }
+
+        public override void Add (Node upNode, object data)
+        {
+            int rank = AnnotatingTasks.getRank(this.upDownNodes[upNode]);
+            this.heap.Add(new Task(rank, this.count++, upNode, data));
+            this.siftUp(this.heap.Count - 1);
+        }
+
+        public override void Get (out Node upNode, out object data)
+        {
+            this.purge();
+            Task task = this.heap[0] as Task;
+            this.removeTop();
+
+            upNode = task.Node;
+            data = task.Data;
+        }
+
+        public override bool IsEmpty
+        {
+            get
+            {
+                this.purge();
+                return this.heap.Count == 0;
+            }
+        }
+
+        public override void Remove (Node upNode)
+        {
+            this.removed[upNode] = this.count;
+        }
+    }
+}
@@ -0,0 +1,974 @@
+// =============================================================================
+// CILPE - Partial Evaluator for Common Intermediate Language
+// =============================================================================
+// File:
+//     AnnotationCache.cs
+//
+// Description:
+//     Annotations of entry point groups kept on disk between runs
+//
+// Author:
+//     Yuri Klimov (yuri.klimov@cilpe.net)
+// =============================================================================
+
+using System;
+
+namespace CILPE.BTA
+{
+    using System.IO;
+    using System.Text;
+    using System.Reflection;
+    using System.Collections;
+    using System.Security.Cryptography;
+    using CILPE.CFG;
+    using CILPE.DataModel;
+
+
+    /* Annotations are kept for groups of entry points that reach no common
+     * source method. A group is keyed by the hash of the bodies of source
+     * methods it reaches, of declarations of source types and of the white
+     * list, so its annotation is reused only if nothing it depends on has
+     * changed. Single methods are not keyed, because variants of a method
+     * are merged and lifted depending on all its callers in the group.
+     * Annotated bodies are stored as nodes that refer to their source nodes
+     * by position, BT values are stored once for the whole group, so values
+     * shared by callers and callees stay shared after restoring.
+     */
+    internal class AnnotationCache
+    {
+        #region Private classes
+
+        /* Annotation of the group can not be stored or restored */
+        private class CacheException : Exception
+        {
+        }
+
+
+        #endregion
+
+        #region Private static members
+
+        private const int VERSION = 1;
+
+        private const byte CLONE_NODE = 0;
+
+        private const byte STACK_LIFT = 1;
+
+        private const byte VARIABLE_LIFT = 2;
+
+        private const BindingFlags ALL_MEMBERS = BindingFlags.Public | BindingFlags.NonPublic | BindingFlags.Instance | BindingFlags.Static | BindingFlags.DeclaredOnly;
+
+        private static string hash (string text)
+        {
+            MD5 md5 = new MD5CryptoServiceProvider();
+            return BitConverter.ToString(md5.ComputeHash(Encoding.UTF8.GetBytes(text)));
+        }
+
+        private static string getTypeName (Type type)
+        {
+            return type.AssemblyQualifiedName;
+        }
+
+        private static string getMethodName (MethodBase method)
+        {
+            return AnnotationCache.getTypeName(method.DeclaringType) + "::" + method.ToString();
+        }
+
+        private static int getMinIndex (MethodBodyBlock mbb)
+        {
+            int minIndex = Int32.MaxValue;
+            foreach (Variable var in mbb.Variables)
+                if (var.Index < minIndex)
+                    minIndex = var.Index;
+
+            return minIndex;
+        }
+
+        /* Returns nodes of the body in order of reaching them,
+         * handlers of protected blocks are reached from the blocks
+         */
+        private static ArrayList getNodes (MethodBodyBlock mbb)
+        {
+            ArrayList nodes = new ArrayList();
+            Hashtable visited = new Hashtable();
+
+            nodes.Add(mbb);
+            visited[mbb] = true;
+            for (int i = 0; i < nodes.Count; i++)
+            {
+                Node node = nodes[i] as Node;
+
+                ArrayList next = new ArrayList();
+                for (int j = 0; j < node.NextArray.Count; j++)
+                    next.Add(node.NextArray[j]);
+                if (node is ProtectedBlock)
+                    foreach (EHBlock handler in node as ProtectedBlock)
+                        next.Add(handler);
+
+                foreach (Node n in next)
+                    if (n != null && ! visited.ContainsKey(n))
+                    {
+                        visited[n] = true;
+                        nodes.Add(n);
+                    }
+            }
+
+            return nodes;
+        }
+
+        private static Hashtable getIndices (ArrayList nodes)
+        {
+            Hashtable indices = new Hashtable();
+            for (int i = 0; i < nodes.Count; i++)
+                indices[nodes[i]] = i;
+
+            return indices;
+        }
+
+        /* Members that the node refers to, printed with full names */
+        private static string getMembersText (Node node)
+        {
+            if (node is CallMethod)
+                return AnnotationCache.getMethodName((node as CallMethod).Method);
+            else if (node is NewObject)
+                return AnnotationCache.getMethodName((node as NewObject).Constructor);
+            else if (node is CreateDelegate)
+                return AnnotationCache.getMethodName((node as CreateDelegate).DelegateCtor) + " " +
+                    AnnotationCache.getMethodName((node as CreateDelegate).Method);
+            else if (node is ManageField)
+            {
+                FieldInfo fldInfo = (node as ManageField).Field;
+                return AnnotationCache.getTypeName(fldInfo.DeclaringType) + "::" + fldInfo.Name;
+            }
+            else if (node is ITypedNode)
+                return AnnotationCache.getTypeName((node as ITypedNode).Type);
+            else
+                return "";
+        }
+
+        /* Text of the node that does not depend on numbering of variables,
+         * branch targets are printed through options of basic blocks,
+         * so nodes having them are printed by their kind
+         */
+        private static string getNodeText (Node node, int minIndex)
+        {
+            if (node is ManageVar)
+                return node.GetType().Name + " " + ((node as ManageVar).Var.Index - minIndex);
+            else if (node is FinallyBlock)
+                return node.GetType().Name + ((node as FinallyBlock).IsFault ? " [fault]" : "");
+            else if (node is Block || node is Branch || node is Switch || node is Leave)
+                return node.GetType().Name + " " + AnnotationCache.getMembersText(node);
+            else
+                return node.ToString() + " " + AnnotationCache.getMembersText(node);
+        }
+
+        /* Text of the source method body, null if the body
+         * has blocks that are not reached from the method entry
+         */
+        private static string getBodyText (MethodBase method, MethodBodyBlock mbb)
+        {
+            StringBuilder text = new StringBuilder(AnnotationCache.getMethodName(method));
+            text.Append('\n');
+
+            int minIndex = AnnotationCache.getMinIndex(mbb);
+            SortedList vars = new SortedList();
+            foreach (Variable var in mbb.Variables)
+                vars[var.Index] = var;
+            foreach (Variable var in vars.Values)
+                text.Append(var.Index - minIndex).Append(' ').Append(var.Kind).Append(' ').Append(AnnotationCache.getTypeName(var.Type)).Append('\n');
+            foreach (Variable var in mbb.Variables.ParameterMapper)
+                text.Append(var.Index - minIndex).Append(' ');
+            text.Append('\n');
+
+            ArrayList nodes = AnnotationCache.getNodes(mbb);
+            Hashtable indices = AnnotationCache.getIndices(nodes);
+            foreach (Node node in nodes)
+            {
+                if (node is UserFilteredBlock)
+                    return null;
+
+                text.Append(AnnotationCache.getNodeText(node, minIndex));
+                for (int i = 0; i < node.NextArray.Count; i++)
+                    text.Append(' ').Append(node.NextArray[i] == null ? -1 : (int) indices[node.NextArray[i]]);
+                if (node is ProtectedBlock)
+                    foreach (EHBlock handler in node as ProtectedBlock)
+                        text.Append(" h").Append((int) indices[handler]);
+                text.Append('\n');
+            }
+
+            return text.ToString();
+        }
+
+        private static string getMemberText (MemberInfo member)
+        {
+            string text = member.ToString();
+            foreach (object attr in member.GetCustomAttributes(false))
+                text += " [" + AnnotationCache.getTypeName(attr.GetType()) + "]";
+
+            return text;
+        }
+
+        /* Text of declarations of the types, BTA depends on fields,
+         * virtual methods and attributes of source methods
+         */
+        private static string getTypesText (Assembly assembly)
+        {
+            SortedList types = new SortedList();
+            foreach (Type type in assembly.GetTypes())
+                types[AnnotationCache.getTypeName(type)] = type;
+
+            StringBuilder text = new StringBuilder();
+            foreach (Type type in types.Values)
+            {
+                text.Append(AnnotationCache.getTypeName(type)).Append(' ').Append(type.Attributes);
+                if (type.BaseType != null)
+                    text.Append(" : ").Append(AnnotationCache.getTypeName(type.BaseType));
+                text.Append('\n');
+
+                SortedList members = new SortedList();
+                foreach (Type iface in type.GetInterfaces())
+                    members["I " + AnnotationCache.getTypeName(iface)] = true;
+                foreach (FieldInfo fldInfo in type.GetFields(AnnotationCache.ALL_MEMBERS))
+                    members["F " + fldInfo.Name + " " + AnnotationCache.getTypeName(fldInfo.FieldType) + " " + fldInfo.Attributes] = true;
+                foreach (MethodBase method in type.GetMethods(AnnotationCache.ALL_MEMBERS))
+                    members["M " + AnnotationCache.getMemberText(method) + " " + method.Attributes] = true;
+                foreach (MethodBase method in type.GetConstructors(AnnotationCache.ALL_MEMBERS))
+                    members["C " + AnnotationCache.getMemberText(method) + " " + method.Attributes] = true;
+
+                foreach (string member in members.Keys)
+                    text.Append(member).Append('\n');
+            }
+
+            return text.ToString();
+        }
+
+        private static byte encodeBTType (BTType btType)
+        {
+            if (btType == BTType.Static)
+                return 1;
+            else if (btType == BTType.Dynamic)
+                return 2;
+            else
+                return 3;
+        }
+
+        private static BTType decodeBTType (byte code)
+        {
+            switch (code)
+            {
+                case 1:
+                    return BTType.Static;
+                case 2:
+                    return BTType.Dynamic;
+                case 3:
+                    return BTType.eXclusive;
+                default:
+                    throw new CacheException();
+            }
+        }
+
+        private static int readCount (BinaryReader reader)
+        {
+            int count = reader.ReadInt32();
+            if (count < 0)
+                throw new CacheException();
+
+            return count;
+        }
+
+        private static int readIndex (BinaryReader reader, int count)
+        {
+            int index = reader.ReadInt32();
+            if (index < 0 || index >= count)
+                throw new CacheException();
+
+            return index;
+        }
+
+        /* Reads the index that is -1 for an absent item */
+        private static int readOptionalIndex (BinaryReader reader, int count)
+        {
+            int index = reader.ReadInt32();
+            if (index < -1 || index >= count)
+                throw new CacheException();
+
+            return index;
+        }
+
+        #endregion
+
+        #region Private members
+
+        private readonly AnnotatedAssemblyHolder holder;
+
+        private readonly string fileName;
+
+        /* Group key -> stored annotation of the group */
+        private readonly Hashtable records;
+
+        /* Group key -> annotation of the group to be saved */
+        private readonly Hashtable newRecords;
+
+        private readonly string commonText;
+
+        /* Source method -> text of its body */
+        private readonly Hashtable bodyTexts;
+
+        /* Name -> source method, null if the name is ambiguous */
+        private readonly Hashtable sourceMethods;
+
+        /* Name -> type found by name */
+        private readonly Hashtable types;
+
+        /* Source method body -> its nodes in order of reaching them */
+        private readonly Hashtable sourceNodes;
+
+        private void load ()
+        {
+            if (! File.Exists(this.fileName))
+                return;
+
+            BinaryReader reader = null;
+            try
+            {
+                reader = new BinaryReader(File.OpenRead(this.fileName));
+                if (reader.ReadInt32() != AnnotationCache.VERSION)
+                    return;
+
+                int count = reader.ReadInt32();
+                for (int i = 0; i < count; i++)
+                {
+                    string key = reader.ReadString();
+                    int length = reader.ReadInt32();
+                    byte[] bytes = reader.ReadBytes(length);
+                    if (bytes.Length != length)
+                        break;
+                    this.records[key] = bytes;
+                }
+            }
+            catch (IOException)
+            {
+                this.records.Clear();
+            }
+            finally
+            {
+                if (reader != null)
+                    reader.Close();
+            }
+        }
+
+        private string getBodyText (MethodBase method)
+        {
+            if (! this.bodyTexts.ContainsKey(method))
+                this.bodyTexts[method] = AnnotationCache.getBodyText(method, this.holder.SourceHolder[method]);
+
+            return this.bodyTexts[method] as string;
+        }
+
+        private ArrayList getSourceNodes (MethodBodyBlock mbbDown)
+        {
+            ArrayList nodes = this.sourceNodes[mbbDown] as ArrayList;
+            if (nodes == null)
+                this.sourceNodes[mbbDown] = nodes = AnnotationCache.getNodes(mbbDown);
+
+            return nodes;
+        }
+
+        private Type getType (string name)
+        {
+            Type type = this.types[name] as Type;
+            if (type == null)
+            {
+                type = Type.GetType(name, false);
+
+                /* Source assembly and assemblies loaded with it
+                 * are not found by Type.GetType
+                 */
+                int i = name.IndexOf(", ");
+                if (type == null && i >= 0)
+                    foreach (Assembly assembly in AppDomain.CurrentDomain.GetAssemblies())
+                        if (assembly.FullName == name.Substring(i + 2))
+                            type = assembly.GetType(name.Substring(0, i), false);
+
+                if (type == null)
+                    throw new CacheException();
+                this.types[name] = type;
+            }
+
+            return type;
+        }
+
+        private MethodBase getSourceMethod (string name)
+        {
+            MethodBase method = this.sourceMethods[name] as MethodBase;
+            if (method == null)
+                throw new CacheException();
+
+            return method;
+        }
+
+        private void addValue (ReferenceBTValue val, ArrayList values, ObjectHashtable indices)
+        {
+            if (val == null)
+                throw new CacheException();
+
+            val = val.FromStack();
+            if (! indices.Contains(val))
+            {
+                indices[val] = values.Count;
+                values.Add(val);
+            }
+        }
+
+        private void addMethod (AnnotatedMethod method, Hashtable reached, ArrayList methods, Hashtable indices)
+        {
+            if (! indices.ContainsKey(method))
+            {
+                if (! reached.ContainsKey(method.SourceMethod))
+                    throw new CacheException();
+
+                indices[method] = methods.Count;
+                methods.Add(method);
+            }
+        }
+
+        /* Adds annotated methods and BT values that the node refers to */
+        private void collectNode (Node upNode, Hashtable reached, ArrayList methods, Hashtable methodIndices, ArrayList values, ObjectHashtable valueIndices)
+        {
+            if (upNode is Block && ! (upNode is MethodBodyBlock))
+                throw new CacheException();
+
+            Hashtable hash = upNode.Options["AnnotatedMethodHashtable"] as Hashtable;
+            if (hash != null)
+                foreach (AnnotatedMethod method in hash.Values)
+                    this.addMethod(method, reached, methods, methodIndices);
+
+            AnnotatedMethod btMethod = upNode.Options[Annotation.MethodBTTypeOption] as AnnotatedMethod;
+            if (btMethod != null)
+                this.addMethod(btMethod, reached, methods, methodIndices);
+
+            foreach (string option in new string[] { "NewBTValue", "ReturnValue" })
+            {
+                ReferenceBTValue val = upNode.Options[option] as ReferenceBTValue;
+                if (val != null)
+                    this.addValue(val, values, valueIndices);
+            }
+        }
+
+        private void writeValue (BinaryWriter writer, ReferenceBTValue val, ObjectHashtable indices)
+        {
+            Type[] types = val.Types;
+            writer.Write(types.Length);
+            foreach (Type type in types)
+                writer.Write(AnnotationCache.getTypeName(type));
+
+            ICollection keys = val.FieldKeys;
+            writer.Write(keys.Count);
+            foreach (object key in keys)
+            {
+                if (key is string)
+                    writer.Write((byte) 0);
+                else if (key is FieldInfo)
+                {
+                    writer.Write((byte) 1);
+                    writer.Write(AnnotationCache.getTypeName((key as FieldInfo).DeclaringType));
+                    writer.Write((key as FieldInfo).Name);
+                }
+                else
+                    throw new CacheException();
+                writer.Write(indices[val.GetFieldValue(key).FromStack()]);
+            }
+        }
+
+        private void writeNode (BinaryWriter writer, Node upNode, UpAndDownNodes upDownNodes, Hashtable downIndices, Hashtable upIndices, int minIndex, Hashtable methodIndices, ObjectHashtable valueIndices)
+        {
+            if (upNode is Lift && (upNode as Lift).Task is StackLiftTask)
+            {
+                writer.Write(AnnotationCache.STACK_LIFT);
+                writer.Write(((upNode as Lift).Task as StackLiftTask).Depth);
+            }
+            else if (upNode is Lift && (upNode as Lift).Task is VariableLiftTask)
+            {
+                writer.Write(AnnotationCache.VARIABLE_LIFT);
+                writer.Write(((upNode as Lift).Task as VariableLiftTask).Variable.Index - minIndex);
+            }
+            else
+            {
+                Node downNode = upDownNodes[upNode];
+                if (downNode == null || ! downIndices.ContainsKey(downNode))
+                    throw new CacheException();
+                writer.Write(AnnotationCache.CLONE_NODE);
+                writer.Write((int) downIndices[downNode]);
+            }
+
+            writer.Write(upNode.NextArray.Count);
+            for (int i = 0; i < upNode.NextArray.Count; i++)
+                writer.Write(upNode.NextArray[i] == null ? -1 : (int) upIndices[upNode.NextArray[i]]);
+
+            object btType = upNode.Options[Annotation.BTTypeOption];
+            writer.Write(btType is BTType ? AnnotationCache.encodeBTType((BTType) btType) : (byte) 0);
+
+            Hashtable hash = upNode.Options["AnnotatedMethodHashtable"] as Hashtable;
+            writer.Write(hash == null ? -1 : hash.Count);
+            if (hash != null)
+                foreach (object key in hash.Keys)
+                {
+                    if (key is Type)
+                    {
+                        writer.Write((byte) 1);
+                        writer.Write(AnnotationCache.getTypeName(key as Type));
+                    }
+                    else if (key as string == "AnnotatedMethod")
+                        writer.Write((byte) 0);
+                    else
+                        throw new CacheException();
+                    writer.Write((int) methodIndices[hash[key]]);
+                }
+
+            AnnotatedMethod btMethod = upNode.Options[Annotation.MethodBTTypeOption] as AnnotatedMethod;
+            writer.Write(btMethod == null ? -1 : (int) methodIndices[btMethod]);
+
+            Type[] receiverTypes = Annotation.GetReceiverTypes(upNode);
+            writer.Write(receiverTypes == null ? -1 : receiverTypes.Length);
+            if (receiverTypes != null)
+                foreach (Type type in receiverTypes)
+                    writer.Write(AnnotationCache.getTypeName(type));
+
+            foreach (string option in new string[] { "NewBTValue", "ReturnValue" })
+            {
+                ReferenceBTValue val = upNode.Options[option] as ReferenceBTValue;
+                writer.Write(val == null ? -1 : valueIndices[val.FromStack()]);
+            }
+
+            object count = upNode.Options[Annotation.AnnotationCountOption];
+            writer.Write(count == null ? -1 : (int) count);
+        }
+
+        /* Writes annotated methods of source methods reached from the group,
+         * their bodies and BT values they refer to
+         */
+        private byte[] write (ArrayList entries, ICollection reachedMethods)
+        {
+            Hashtable reached = new Hashtable();
+            foreach (MethodBase method in reachedMethods)
+                reached[method] = true;
+
+            ArrayList methods = new ArrayList();
+            Hashtable methodIndices = new Hashtable();
+            foreach (MethodBase sMethod in reachedMethods)
+                foreach (AnnotatedMethod method in this.holder.GetVariants(sMethod))
+                    this.addMethod(method, reached, methods, methodIndices);
+            foreach (MethodBase entry in entries)
+                this.addMethod(this.holder.GetAnnotatedMethod(entry), reached, methods, methodIndices);
+
+            /* Bodies are enumerated before methods they refer to are added */
+            ArrayList bodies = new ArrayList();
+            ArrayList values = new ArrayList();
+            ObjectHashtable valueIndices = new ObjectHashtable();
+            for (int i = 0; i < methods.Count; i++)
+            {
+                AnnotatedMethod method = methods[i] as AnnotatedMethod;
+                for (int j = 0; j < method.ParamVals.Count; j++)
+                    this.addValue(method.ParamVals[j].Val as ReferenceBTValue, values, valueIndices);
+                if (method.ReturnValue != null)
+                    this.addValue(method.ReturnValue, values, valueIndices);
+
+                if (this.holder.ContainsMethodBody(method))
+                {
+                    if (method.ControllingVisitor == null)
+                        throw new CacheException();
+
+                    ArrayList nodes = AnnotationCache.getNodes(this.holder[method]);
+                    foreach (Node upNode in nodes)
+                        this.collectNode(upNode, reached, methods, methodIndices, values, valueIndices);
+                    bodies.Add(nodes);
+                }
+                else
+                    bodies.Add(null);
+            }
+
+            /* Values of fields are added after values they belong to */
+            for (int i = 0; i < values.Count; i++)
+            {
+                ReferenceBTValue val = values[i] as ReferenceBTValue;
+                foreach (object key in val.FieldKeys)
+                    this.addValue(val.GetFieldValue(key), values, valueIndices);
+            }
+
+            MemoryStream stream = new MemoryStream();
+            BinaryWriter writer = new BinaryWriter(stream);
+
+            writer.Write(values.Count);
+            foreach (ReferenceBTValue val in values)
+                writer.Write(AnnotationCache.encodeBTType(val.BTType));
+            foreach (ReferenceBTValue val in values)
+                this.writeValue(writer, val, valueIndices);
+
+            writer.Write(methods.Count);
+            for (int i = 0; i < methods.Count; i++)
+            {
+                AnnotatedMethod method = methods[i] as AnnotatedMethod;
+                writer.Write(AnnotationCache.getMethodName(method.SourceMethod));
+                writer.Write(bodies[i] != null);
+                writer.Write(method.ParamVals.Count);
+                for (int j = 0; j < method.ParamVals.Count; j++)
+                    writer.Write(valueIndices[(method.ParamVals[j].Val as ReferenceBTValue).FromStack()]);
+                writer.Write(method.ReturnValue == null ? -1 : valueIndices[method.ReturnValue.FromStack()]);
+            }
+
+            for (int i = 0; i < methods.Count; i++)
+            {
+                ArrayList nodes = bodies[i] as ArrayList;
+                if (nodes == null)
+                    continue;
+
+                AnnotatedMethod method = methods[i] as AnnotatedMethod;
+                Hashtable downIndices = AnnotationCache.getIndices(this.getSourceNodes(this.holder.SourceHolder[method.SourceMethod]));
+                Hashtable upIndices = AnnotationCache.getIndices(nodes);
+                int minIndex = AnnotationCache.getMinIndex(this.holder[method]);
+
+                writer.Write(nodes.Count);
+                foreach (Node upNode in nodes)
+                    this.writeNode(writer, upNode, method.ControllingVisitor.UpDownNodes, downIndices, upIndices, minIndex, methodIndices, valueIndices);
+            }
+
+            writer.Write(entries.Count);
+            foreach (MethodBase entry in entries)
+            {
+                writer.Write(AnnotationCache.getMethodName(entry));
+                writer.Write((int) methodIndices[this.holder.GetAnnotatedMethod(entry)]);
+            }
+
+            writer.Close();
+            return stream.ToArray();
+        }
+
+        private void readValue (BinaryReader reader, ReferenceBTValue val, ReferenceBTValue[] values)
+        {
+            int count = AnnotationCache.readCount(reader);
+            for (int i = 0; i < count; i++)
+                val.AddType(this.getType(reader.ReadString()));
+
+            count = AnnotationCache.readCount(reader);
+            for (int i = 0; i < count; i++)
+            {
+                object key;
+                switch (reader.ReadByte())
+                {
+                    case 0:
+                        key = "ArrayElements";
+                        break;
+                    case 1:
+                        Type type = this.getType(reader.ReadString());
+                        key = type.GetField(reader.ReadString(), AnnotationCache.ALL_MEMBERS);
+                        if (key == null)
+                            throw new CacheException();
+                        break;
+                    default:
+                        throw new CacheException();
+                }
+                val.SetFieldValue(key, values[AnnotationCache.readIndex(reader, values.Length)]);
+            }
+        }
+
+        private AnnotatedMethod readMethod (BinaryReader reader, ReferenceBTValue[] values, out bool hasBody)
+        {
+            MethodBase sMethod = this.getSourceMethod(reader.ReadString());
+            hasBody = reader.ReadBoolean();
+
+            int count = AnnotationCache.readCount(reader);
+            if (count != ParameterValues.GetParametersNumber(sMethod))
+                throw new CacheException();
+
+            EvaluationStack stack = new EvaluationStack();
+            for (int i = 0; i < count; i++)
+                stack.Push(values[AnnotationCache.readIndex(reader, values.Length)]);
+            ParameterValues paramVals = stack.Perform_CallMethod(sMethod, false);
+
+            int ret = AnnotationCache.readOptionalIndex(reader, values.Length);
+            if ((ret == -1) != (Annotation.GetReturnType(sMethod) == typeof(void)))
+                throw new CacheException();
+
+            return new AnnotatedMethod(paramVals, ret == -1 ? null : values[ret]);
+        }
+
+        private Node readNode (BinaryReader reader, ArrayList downNodes, Hashtable vars, int minIndex)
+        {
+            switch (reader.ReadByte())
+            {
+                case AnnotationCache.CLONE_NODE:
+                    return (downNodes[AnnotationCache.readIndex(reader, downNodes.Count)] as Node).Clone();
+                case AnnotationCache.STACK_LIFT:
+                    return new Lift(new StackLiftTask(reader.ReadInt32()));
+                case AnnotationCache.VARIABLE_LIFT:
+                    Variable var = vars[minIndex + reader.ReadInt32()] as Variable;
+                    if (var == null)
+                        throw new CacheException();
+                    return new Lift(new VariableLiftTask(var));
+                default:
+                    throw new CacheException();
+            }
+        }
+
+        private void readOptions (BinaryReader reader, Node upNode, AnnotatedMethod[] methods, ReferenceBTValue[] values)
+        {
+            byte btType = reader.ReadByte();
+            if (btType != 0)
+                Annotation.SetNodeBTType(upNode, AnnotationCache.decodeBTType(btType));
+
+            int count = reader.ReadInt32();
+            if (count >= 0)
+            {
+                Hashtable hash = Annotation.GetAnnotatedMethodHashtable(upNode);
+                for (int i = 0; i < count; i++)
+                {
+                    object key;
+                    switch (reader.ReadByte())
+                    {
+                        case 0:
+                            key = "AnnotatedMethod";
+                            break;
+                        case 1:
+                            key = this.getType(reader.ReadString());
+                            break;
+                        default:
+                            throw new CacheException();
+                    }
+                    hash[key] = methods[AnnotationCache.readIndex(reader, methods.Length)];
+                }
+            }
+
+            int btMethod = AnnotationCache.readOptionalIndex(reader, methods.Length);
+            if (btMethod != -1)
+                upNode.Options[Annotation.MethodBTTypeOption] = methods[btMethod];
+
+            count = reader.ReadInt32();
+            if (count >= 0)
+            {
+                Hashtable hash = new Hashtable();
+                for (int i = 0; i < count; i++)
+                    hash[this.getType(reader.ReadString())] = true;
+                upNode.Options["ReceiverTypes"] = hash;
+            }
+
+            foreach (string option in new string[] { "NewBTValue", "ReturnValue" })
+            {
+                int val = AnnotationCache.readOptionalIndex(reader, values.Length);
+                if (val != -1)
+                    upNode.Options[option] = values[val];
+            }
+
+            int annotationCount = reader.ReadInt32();
+            if (annotationCount != -1)
+                upNode.Options[Annotation.AnnotationCountOption] = annotationCount;
+        }
+
+        private MethodBodyBlock readBody (BinaryReader reader, AnnotatedMethod method, AnnotatedMethod[] methods, ReferenceBTValue[] values)
+        {
+            ArrayList downNodes = this.getSourceNodes(this.holder.SourceHolder[method.SourceMethod]);
+            MethodBodyBlock mbbUp = (downNodes[0] as Node).Clone() as MethodBodyBlock;
+            Hashtable vars = new Hashtable();
+            foreach (Variable var in mbbUp.Variables)
+                vars[var.Index] = var;
+            int minIndex = AnnotationCache.getMinIndex(mbbUp);
+
+            int count = AnnotationCache.readCount(reader);
+            if (count == 0 || reader.ReadByte() != AnnotationCache.CLONE_NODE || reader.ReadInt32() != 0)
+                throw new CacheException();
+
+            Node[] nodes = new Node[count];
+            int[][] next = new int[count][];
+            nodes[0] = mbbUp;
+            for (int i = 0; i < count; i++)
+            {
+                if (i > 0)
+                    nodes[i] = this.readNode(reader, downNodes, vars, minIndex);
+
+                next[i] = new int[AnnotationCache.readCount(reader)];
+                if (next[i].Length != nodes[i].NextArray.Count)
+                    throw new CacheException();
+                for (int j = 0; j < next[i].Length; j++)
+                    next[i][j] = AnnotationCache.readOptionalIndex(reader, count);
+
+                this.readOptions(reader, nodes[i], methods, values);
+            }
+
+            /* Nodes are linked in order of reaching them,
+             * so each node gets its parent before its successors
+             */
+            for (int i = 0; i < count; i++)
+                for (int j = 0; j < next[i].Length; j++)
+                    if (next[i][j] != -1)
+                        nodes[i].NextArray[j] = nodes[next[i][j]];
+
+            return mbbUp;
+        }
+
+        /* Reads annotation of the group, nothing is added
+         * to the holder until the whole annotation is read
+         */
+        private void read (byte[] bytes, ArrayList entries)
+        {
+            BinaryReader reader = new BinaryReader(new MemoryStream(bytes));
+
+            ReferenceBTValue[] values = new ReferenceBTValue[AnnotationCache.readCount(reader)];
+            for (int i = 0; i < values.Length; i++)
+                values[i] = new ReferenceBTValue(AnnotationCache.decodeBTType(reader.ReadByte()));
+            for (int i = 0; i < values.Length; i++)
+                this.readValue(reader, values[i], values);
+
+            AnnotatedMethod[] methods = new AnnotatedMethod[AnnotationCache.readCount(reader)];
+            bool[] hasBody = new bool[methods.Length];
+            for (int i = 0; i < methods.Length; i++)
+                methods[i] = this.readMethod(reader, values, out hasBody[i]);
+
+            MethodBodyBlock[] bodies = new MethodBodyBlock[methods.Length];
+            for (int i = 0; i < methods.Length; i++)
+                if (hasBody[i])
+                    bodies[i] = this.readBody(reader, methods[i], methods, values);
+
+            if (AnnotationCache.readCount(reader) != entries.Count)
+                throw new CacheException();
+            Hashtable aMethods = new Hashtable();
+            for (int i = 0; i < entries.Count; i++)
+            {
+                MethodBase entry = this.getSourceMethod(reader.ReadString());
+                if (! entries.Contains(entry))
+                    throw new CacheException();
+                aMethods[entry] = methods[AnnotationCache.readIndex(reader, methods.Length)];
+            }
+
+            for (int i = 0; i < methods.Length; i++)
+                if (hasBody[i])
+                    this.holder.AddRestoredMethod(methods[i], bodies[i]);
+            foreach (MethodBase entry in aMethods.Keys)
+                this.holder.SetAnnotatedMethod(entry, aMethods[entry] as AnnotatedMethod);
+        }
+
+        #endregion
+
+        internal AnnotationCache (AnnotatedAssemblyHolder holder, string fileName)
+        {
+            this.holder = holder;
+            this.fileName = fileName;
+            this.records = new Hashtable();
+            this.newRecords = new Hashtable();
+            this.bodyTexts = new Hashtable();
+            this.sourceMethods = new Hashtable();
+            this.types = new Hashtable();
+            this.sourceNodes = new Hashtable();
+
+            foreach (MethodBase method in holder.SourceHolder.getMethods())
+            {
+                string name = AnnotationCache.getMethodName(method);
+                this.sourceMethods[name] = this.sourceMethods.ContainsKey(name) ? null : method;
+            }
+
+            SortedList whiteList = new SortedList();
+            foreach (MethodBase method in holder.WhiteList.GetMethods())
+                whiteList[AnnotationCache.getMethodName(method)] = true;
+
+            StringBuilder text = new StringBuilder();
+            text.Append(AnnotationCache.VERSION).Append(' ').Append(typeof(AnnotationCache).Assembly.FullName).Append('\n');
+            text.Append(AnnotationCache.getTypesText(holder.SourceHolder.Assembly));
+            foreach (string name in whiteList.Keys)
+                text.Append("W ").Append(name).Append('\n');
+            this.commonText = text.ToString();
+
+            this.load();
+        }
+
+        /* Key of the group reaching the source methods,
+         * null if the group can not be kept in the cache
+         */
+        internal string GetKey (ICollection methods)
+        {
+            SortedList texts = new SortedList();
+            foreach (MethodBase method in methods)
+            {
+                string text = this.getBodyText(method);
+                if (text == null)
+                    return null;
+                texts[AnnotationCache.getMethodName(method)] = text;
+            }
+
+            StringBuilder key = new StringBuilder(this.commonText);
+            foreach (string text in texts.Values)
+                key.Append(text);
+
+            return AnnotationCache.hash(key.ToString());
+        }
+
+        /* Restores annotation of the group stored under the key,
+         * returns false if the group has to be annotated
+         */
+        internal bool Restore (string key, ArrayList entries)
+        {
+            byte[] bytes = this.records[key] as byte[];
+            if (bytes == null)
+                return false;
+
+            try
+            {
+                this.read(bytes, entries);
+            }
+            catch (CacheException)
+            {
+                return false;
+            }
+            catch (IOException)
+            {
+                return false;
+            }
+
+            this.newRecords[key] = bytes;
+            return true;
+        }
+
+        /* Stores annotation of the group that has been annotated,
+         * the group is not stored if its annotation can not be written
+         */
+        internal void Store (string key, ArrayList entries, ICollection reachedMethods)
+        {
+            try
+            {
+                this.newRecords[key] = this.write(entries, reachedMethods);
+            }
+            catch (CacheException)
+            {
+            }
+        }
+
+        /* Saves groups restored or stored in this run, the cache is only
+         * an optimization, so the run goes on if it can not be saved
+         */
+        internal void Save ()
+        {
+            BinaryWriter writer = null;
+            try
+            {
+                writer = new BinaryWriter(File.Create(this.fileName));
+                writer.Write(AnnotationCache.VERSION);
+                writer.Write(this.newRecords.Count);
+                foreach (string key in this.newRecords.Keys)
+                {
+                    byte[] bytes = this.newRecords[key] as byte[];
+                    writer.Write(key);
+                    writer.Write(bytes.Length);
+                    writer.Write(bytes);
+                }
+            }
+            catch (IOException)
+            {
+            }
+            catch (UnauthorizedAccessException)
+            {
+            }
+            finally
+            {
+                if (writer != null)
+                    writer.Close();
+            }
+        }
+    }
+}
@@ -46,6 +46,7 @@ namespace CILPE.BTA
 {
     using System.Reflection;
     using System.Collections;
+    using System.Threading;
     using CILPE.Exceptions;
     using CILPE.ReflectionEx;
     using CILPE.CFG;
@@ -187,7 +188,7 @@ namespace CILPE.BTA
 
         private static readonly int NUMBER_FOR_LIFT = 200;
 
-        private static bool equalPrimitiveBTValueStates (State state1, State state2)
+        private static bool equalPrimitiveBTValueStates (State state1, State state2, LiveVariables live)
         {
             if (state1.Stack.Count != state2.Stack.Count)
                 throw new InternalException();
@@ -197,13 +198,13 @@ namespace CILPE.BTA
                     return false;
 
             foreach (Variable v in state1.Pool.GetVariables())
-                if (! BTValue.Equals(state1.Pool[v].Val as PrimitiveBTValue, state2.Pool[v].Val as PrimitiveBTValue))
+                if (live[v] && ! BTValue.Equals(state1.Pool[v].Val as PrimitiveBTValue, state2.Pool[v].Val as PrimitiveBTValue))
                     return false;
 
             return true;
         }
 
-        private static bool equalStates (State state1, State state2)
+        private static bool equalStates (State state1, State state2, LiveVariables live)
         {
             if (state1.Stack.Count != state2.Stack.Count)
                 throw new InternalException();
@@ -213,32 +214,34 @@ namespace CILPE.BTA
                     return false;
 
             foreach (Variable v in state1.Pool.GetVariables())
-                if (! BTValue.Equals(state1.Pool[v].Val as BTValue, state2.Pool[v].Val as BTValue))
+                if (live[v] && ! BTValue.Equals(state1.Pool[v].Val as BTValue, state2.Pool[v].Val as BTValue))
                     return false;
 
             return true;
         }
 
-        private static Creators pseudoMergeStates (State state1, State state2)
+        private static Creators pseudoMergeStates (State state1, State state2, LiveVariables live)
         {
             Creators crtrs = new Creators();
             for (int i = 0; i < state1.Stack.Count; i++)
                 crtrs.AddCreators(BTValue.PseudoMerge(state1.Stack[i] as BTValue, state2.Stack[i] as BTValue));
 
             foreach (Variable v in state1.Pool.GetVariables())
-                crtrs.AddCreators(BTValue.PseudoMerge(state1.Pool[v].Val as BTValue, state2.Pool[v].Val as BTValue));
+                if (live[v])
+                    crtrs.AddCreators(BTValue.PseudoMerge(state1.Pool[v].Val as BTValue, state2.Pool[v].Val as BTValue));
 
             return crtrs;
         }
 
-        private static Creators mergeStates (State state1, State state2)
+        private static Creators mergeStates (State state1, State state2, LiveVariables live)
         {
             Creators crtrs = new Creators();
             for (int i = 0; i < state1.Stack.Count; i++)
                 crtrs.AddCreators(BTValue.Merge(state1.Stack[i] as BTValue, state2.Stack[i] as BTValue));
 
             foreach (Variable v in state1.Pool.GetVariables())
-                crtrs.AddCreators(BTValue.Merge(state1.Pool[v].Val as BTValue, state2.Pool[v].Val as BTValue));
+                if (live[v])
+                    crtrs.AddCreators(BTValue.Merge(state1.Pool[v].Val as BTValue, state2.Pool[v].Val as BTValue));
 
             return crtrs;
         }
@@ -328,14 +331,15 @@ namespace CILPE.BTA
             get
             {
                 Hashtable upNodes = this.getUpNodes(downNode);
+                LiveVariables live = LiveVariables.GetLiveVariables(downNode);
 
                 int count = 0;
                 foreach (State key in upNodes.Keys)
                 {
-                    if (UpAndDownNodes.equalPrimitiveBTValueStates(state, key))
+                    if (UpAndDownNodes.equalPrimitiveBTValueStates(state, key, live))
                     {
                         count++;
-                        if (UpAndDownNodes.equalStates(state, key))
+                        if (UpAndDownNodes.equalStates(state, key, live))
                             return upNodes[key] as Node;
                     }
                 }
@@ -347,7 +351,7 @@ namespace CILPE.BTA
 
                     foreach (State key in upNodes.Keys)
                     {
-                        int keyCreators = UpAndDownNodes.pseudoMergeStates(state, key).Count;
+                        int keyCreators = UpAndDownNodes.pseudoMergeStates(state, key, live).Count;
                         if (keyState == null || keyStateCreators > keyCreators)
                         {
                             keyState = key;
@@ -357,7 +361,7 @@ namespace CILPE.BTA
 
                     if (keyState != null && (keyStateCreators == 0 || count > UpAndDownNodes.NUMBER_FOR_LIFT))
                     {
-                        Creators crtrs = UpAndDownNodes.mergeStates(state, keyState);
+                        Creators crtrs = UpAndDownNodes.mergeStates(state, keyState, live);
                         if (! crtrs.IsEmpty)
                             throw new AnnotatingVisitor.LiftException(crtrs);
 
@@ -504,6 +508,14 @@ namespace CILPE.BTA
             this.users = 0;
         }
 
+        internal UpAndDownNodes UpDownNodes
+        {
+            get
+            {
+                return this.upDownNodes;
+            }
+        }
+
         internal void CleanGraph ()
         {
             foreach (Node upNode in this.mbbUp.CollectGarbage())
@@ -718,7 +730,7 @@ namespace CILPE.BTA
     }
 
 
-    internal class AnnotatingVisitor : StackVisitorEX
+    internal class AnnotatingVisitor : VisitorEX
     {
         #region Internal classes
 
@@ -766,7 +778,7 @@ namespace CILPE.BTA
         {
             if (! hash.Contains(val))
             {
-                hash[val] = true;
+                hash[val] = 0;
                 if (val is ReferenceBTValue)
                     foreach (BTValue v in (val as ReferenceBTValue).GetAllNotNullFieldBTValues())
                         AnnotatingVisitor.getAllBTValue(v, hash);
@@ -777,7 +789,7 @@ namespace CILPE.BTA
         {
             if (! hash.Contains(val) && depth > 0)
             {
-                hash[val] = true;
+                hash[val] = 0;
                 if (val is ReferenceBTValue)
                     foreach (BTValue v in (val as ReferenceBTValue).GetAllFieldBTValues())
                         AnnotatingVisitor.getAllFieldBTValue(v, depth-1, hash);
@@ -805,6 +817,8 @@ namespace CILPE.BTA
 
         private readonly ReferenceBTValue ret;
 
+        private readonly ObjectHashtable btValues;
+
         private void addTask (Node upNode, int brIndex, Node downNext, State state)
         {
             Node upNext = this.upDownNodes[downNext, state];
@@ -822,9 +836,9 @@ namespace CILPE.BTA
 
         private void addCreator (BTValue val, ReferenceCreator crtr)
         {
-            ObjectHashtable hash = new ObjectHashtable();
-            AnnotatingVisitor.getAllBTValue(val, hash);
-            foreach (BTValue v in hash.Keys)
+            this.btValues.Clear();
+            AnnotatingVisitor.getAllBTValue(val, this.btValues);
+            foreach (BTValue v in this.btValues.Keys)
                 v.Creators[this].AddCreator(crtr);
         }
 
@@ -862,13 +876,13 @@ namespace CILPE.BTA
             }
             else if (this.holder.WhiteList.Contains(sMethod))
             {
-                ObjectHashtable hash = new ObjectHashtable();
+                this.btValues.Clear();
                 for (int i = 0; i < aMethod.ParamVals.Count; i++)
-                    getAllFieldBTValue(aMethod.ParamVals[i].Val as ReferenceBTValue, 5, hash);
+                    getAllFieldBTValue(aMethod.ParamVals[i].Val as ReferenceBTValue, 5, this.btValues);
                 if (aMethod.ReturnValue != null)
-                    getAllFieldBTValue(aMethod.ReturnValue, 5, hash);
+                    getAllFieldBTValue(aMethod.ReturnValue, 5, this.btValues);
 
-                foreach (ReferenceBTValue val in hash.Keys)
+                foreach (ReferenceBTValue val in this.btValues.Keys)
                     if (val.BTType == BTType.Dynamic)
                         goto P;
 
@@ -911,7 +925,11 @@ namespace CILPE.BTA
                 flag = ! this.holder.SourceHolder.ContainsMethodBody(paramVals.Method);
 
             if (flag)
+            {
+                if (isVirtCall)
+                    Annotation.AddReceiverTypes(upNode, paramVals.Method, (paramVals[0].Val as ReferenceBTValue).Types);
                 Annotation.SetNodeBTType(upNode, this.checkAnnotatedMethodForInvoke(new AnnotatedMethod(paramVals, ret)));
+            }
             else
             {
                 if (isVirtCall)
@@ -944,6 +962,9 @@ namespace CILPE.BTA
         protected override void DispatchNode (Node upNode, object o)
         {
             this.RemoveTask(upNode);
+            Interlocked.Increment(ref this.holder.AnnotationCount);
+            object count = upNode.Options[Annotation.AnnotationCountOption];
+            upNode.Options[Annotation.AnnotationCountOption] = count == null ? 1 : (int) count + 1;
             try
             {
                 State state = o as State;
@@ -958,6 +979,7 @@ namespace CILPE.BTA
             }
             catch (LiftException e)
             {
+                Interlocked.Increment(ref this.holder.LiftCount);
                 for (int i = 0; i < upNode.NextArray.Count; i++)
                     upNode.NextArray[i] = null;
                 this.AddTask(upNode, this.upDownNodes.GetState(upNode));
@@ -1337,12 +1359,13 @@ namespace CILPE.BTA
 
         #endregion
 
-        internal AnnotatingVisitor (AnnotatedAssemblyHolder holder, AnnotatedMethod method, ControllingVisitor cVisitor, UpAndDownNodes upDownNodes) : base(holder.GraphProcessor, 0)
+        internal AnnotatingVisitor (AnnotatedAssemblyHolder holder, AnnotatedMethod method, ControllingVisitor cVisitor, UpAndDownNodes upDownNodes) : base(holder.GraphProcessor, 0, new AnnotatingTasks(upDownNodes))
         {
             this.holder = holder;
             this.cVisitor = cVisitor;
             this.upDownNodes = upDownNodes;
             this.ret = method.ReturnValue;
+            this.btValues = new ObjectHashtable();
         }
     }
 
@@ -1351,6 +1374,11 @@ namespace CILPE.BTA
     {
         #region Internal static members
 
+        /* Options of source nodes are written under this lock, because
+         * source methods may be annotated in several threads
+         */
+        internal static readonly object SourceOptionsLock = new object();
+
         internal static Type GetReturnType (MethodBase method)
         {
             if (method is MethodInfo)
@@ -1387,6 +1415,17 @@ namespace CILPE.BTA
             ControllingVisitor.AddAnnotatedMethodUser(method);
         }
 
+        internal static void AddReceiverTypes (Node upNode, MethodBase method, Type[] types)
+        {
+            Hashtable hash = upNode.Options["ReceiverTypes"] as Hashtable;
+            if (hash == null)
+                upNode.Options["ReceiverTypes"] = hash = new Hashtable();
+
+            foreach (Type type in types)
+                if (method.DeclaringType.IsAssignableFrom(type) && type != PrimitiveBTValue.PrimitiveType())
+                    hash[type] = true;
+        }
+
         internal static MethodBodyBlock AnnotateMethod (AnnotatedAssemblyHolder holder, AnnotatedMethod method)
         {
             MethodBodyBlock mbbDown = holder.SourceHolder[method.SourceMethod];
@@ -1412,6 +1451,14 @@ namespace CILPE.BTA
 
         #endregion
 
+        public static string AnnotationCountOption
+        {
+            get
+            {
+                return "AnnotationCount";
+            }
+        }
+
         public static string MethodBTTypeOption
         {
             get
@@ -1455,6 +1502,21 @@ namespace CILPE.BTA
             return Annotation.GetAnnotatedMethodHashtable(upNode)[type] as AnnotatedMethod;
         }
 
+        /* Exact types of the receiver found by BTA for the virtual call
+         * that is not specialized, null if the call is not virtual
+         */
+        public static Type[] GetReceiverTypes (Node upNode)
+        {
+            Hashtable hash = upNode.Options["ReceiverTypes"] as Hashtable;
+            if (hash == null)
+                return null;
+
+            Type[] types = new Type[hash.Count];
+            hash.Keys.CopyTo(types, 0);
+
+            return types;
+        }
+
         public static BTType[] GetObjectFieldBTTypes (NewObject upNode)
         {
             ReferenceBTValue obj = AnnotatingVisitor.GetNewBTValue(upNode);
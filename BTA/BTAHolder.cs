@@ -18,6 +18,7 @@ namespace CILPE.BTA
 {
     using System.Reflection;
     using System.Collections;
+    using System.Threading;
     using CILPE.ReflectionEx;
     using CILPE.CFG;
     using CILPE.DataModel;
@@ -118,48 +119,384 @@ namespace CILPE.BTA
 
         private static readonly int NUMBER_FOR_LIFT = 200;
 
+        /* Graph processor of the annotation worker running in current thread */
+        [ThreadStatic]
+        private static GraphProcessor workerProcessor;
+
+        #endregion
+
+        #region Private classes
+
+        /* Annotates a group of entry points with its own graph processor */
+        private class AnnotationWorker
+        {
+            private readonly AnnotatedAssemblyHolder holder;
+
+            private readonly ArrayList entries;
+
+            internal Exception Error;
+
+            internal AnnotationWorker (AnnotatedAssemblyHolder holder, ArrayList entries)
+            {
+                this.holder = holder;
+                this.entries = entries;
+                this.Error = null;
+            }
+
+            internal void Run ()
+            {
+                try
+                {
+                    AnnotatedAssemblyHolder.workerProcessor = new GraphProcessor();
+                    this.holder.annotateEntries(this.entries);
+                }
+                catch (Exception e)
+                {
+                    this.Error = e;
+                }
+                finally
+                {
+                    AnnotatedAssemblyHolder.workerProcessor = null;
+                }
+            }
+        }
+
+
         #endregion
 
         #region Private members
 
+        private readonly GraphProcessor graphProcessor;
+
         private readonly Hashtable aMethods;
 
-        #endregion
+        private readonly Hashtable variants;
 
-        #region Internal members
+        private ArrayList getVariants (MethodBase sMethod)
+        {
+            ArrayList list = this.variants[sMethod] as ArrayList;
+            if (list == null)
+                this.variants[sMethod] = list = new ArrayList();
 
-        internal readonly GraphProcessor GraphProcessor;
+            return list;
+        }
 
-        internal readonly WhiteList WhiteList;
+        private void annotateEntries (ArrayList entries)
+        {
+            foreach (MethodBase method in entries)
+                ControllingVisitor.AddAnnotatedMethodUser(this.AnnotateMethod(this.GetAnnotatedMethod(method)));
 
-        internal AnnotatedMethod AnnotateMethod (AnnotatedMethod method)
+            this.GraphProcessor.Process();
+        }
+
+        /* Source methods that a virtual call of the method may reach,
+         * null if they can not be found exactly. Overrides of a class method
+         * are looked up by the handle of their base definition.
+         */
+        private ArrayList getTargets (MethodBase callee, ArrayList types, Hashtable overrides)
+        {
+            ArrayList targets = new ArrayList();
+            Type declaringType = callee.DeclaringType;
+
+            if (declaringType.IsInterface)
+            {
+                foreach (Type type in types)
+                    if (! type.IsInterface && declaringType.IsAssignableFrom(type))
+                    {
+                        InterfaceMapping map;
+                        try
+                        {
+                            map = type.GetInterfaceMap(declaringType);
+                        }
+                        catch (ArgumentException)
+                        {
+                            return null;
+                        }
+
+                        MethodInfo target = null;
+                        for (int i = 0; i < map.InterfaceMethods.Length; i++)
+                            if (map.InterfaceMethods[i].MethodHandle.Equals(callee.MethodHandle))
+                                target = map.TargetMethods[i];
+                        if (target == null)
+                            return null;
+
+                        target = MethodBase.GetMethodFromHandle(target.MethodHandle) as MethodInfo;
+                        if (this.SourceHolder.ContainsMethodBody(target) && ! targets.Contains(target))
+                            targets.Add(target);
+                    }
+            }
+            else if (callee is MethodInfo)
+            {
+                ArrayList methods = overrides[(callee as MethodInfo).GetBaseDefinition().MethodHandle.Value] as ArrayList;
+                if (methods != null)
+                    targets.AddRange(methods);
+            }
+            else
+                return null;
+
+            return targets;
+        }
+
+        /* Source methods that may be called from the method body,
+         * null if targets of some virtual call can not be found exactly
+         */
+        private ArrayList getCallees (MethodBase method, ArrayList types, Hashtable overrides)
         {
-            int count = 0;
-            foreach (AnnotatedMethod key in this.getMethods())
+            ArrayList callees = new ArrayList();
+            ArrayList nodes = new ArrayList();
+            Hashtable visited = new Hashtable();
+
+            nodes.Add(this.SourceHolder[method]);
+            visited[nodes[0]] = true;
+            for (int i = 0; i < nodes.Count; i++)
             {
-                if (method.SourceMethod == key.SourceMethod)
+                Node node = nodes[i] as Node;
+
+                MethodBase callee = null;
+                bool isVirtual = false;
+                if (node is CallMethod)
+                {
+                    callee = (node as CallMethod).Method;
+                    isVirtual = (node as CallMethod).IsVirtCall;
+                }
+                else if (node is NewObject)
+                    callee = (node as NewObject).Constructor;
+                else if (node is CreateDelegate)
                 {
-                    count++;
-                    if (AnnotatedMethod.EqualMethods(method, key))
-                        return key;
+                    callee = (node as CreateDelegate).Method;
+                    isVirtual = (node as CreateDelegate).IsVirtual;
                 }
+
+                if (callee != null && isVirtual && callee.IsVirtual)
+                {
+                    ArrayList targets = this.getTargets(callee, types, overrides);
+                    if (targets == null)
+                        return null;
+                    callees.AddRange(targets);
+                }
+                else if (callee != null && this.SourceHolder.ContainsMethodBody(callee))
+                    callees.Add(callee);
+
+                ArrayList next = new ArrayList();
+                for (int j = 0; j < node.NextArray.Count; j++)
+                    next.Add(node.NextArray[j]);
+                if (node is ProtectedBlock)
+                    foreach (EHBlock handler in node as ProtectedBlock)
+                        next.Add(handler);
+
+                foreach (Node n in next)
+                    if (n != null && ! visited.ContainsKey(n))
+                    {
+                        visited[n] = true;
+                        nodes.Add(n);
+                    }
             }
 
+            return callees;
+        }
+
+        /* Splits entry points into groups that reach no common source method,
+         * groups keep the order of entry points. All entry points form one
+         * group if targets of some virtual call can not be found exactly,
+         * the group is considered to reach all source methods then.
+         * Source methods reached from each group are added to groupReached.
+         */
+        private ArrayList groupEntries (ArrayList entries, ArrayList groupReached)
+        {
+            ArrayList types = new ArrayList();
+            Hashtable overrides = new Hashtable();
+            foreach (MethodBase method in this.SourceHolder.getMethods())
+            {
+                if (! types.Contains(method.DeclaringType))
+                    types.Add(method.DeclaringType);
+
+                if (method.IsVirtual && method is MethodInfo)
+                {
+                    IntPtr baseMethod = (method as MethodInfo).GetBaseDefinition().MethodHandle.Value;
+                    ArrayList methods = overrides[baseMethod] as ArrayList;
+                    if (methods == null)
+                        overrides[baseMethod] = methods = new ArrayList();
+                    methods.Add(method);
+                }
+            }
+
+            /* Source method -> index of the first entry point that reaches it */
+            Hashtable owners = new Hashtable();
+            int[] groupOf = new int[entries.Count];
+            ArrayList[] reachedOf = new ArrayList[entries.Count];
+            for (int i = 0; i < entries.Count; i++)
+            {
+                groupOf[i] = i;
+
+                ArrayList reached = new ArrayList();
+                Hashtable visited = new Hashtable();
+                reached.Add(entries[i]);
+                visited[entries[i]] = true;
+                for (int j = 0; j < reached.Count; j++)
+                {
+                    ArrayList callees = this.getCallees(reached[j] as MethodBase, types, overrides);
+                    if (callees == null)
+                    {
+                        ArrayList single = new ArrayList();
+                        single.Add(entries);
+                        groupReached.Add(this.SourceHolder.getMethods());
+                        return single;
+                    }
+
+                    foreach (MethodBase callee in callees)
+                        if (! visited.ContainsKey(callee))
+                        {
+                            visited[callee] = true;
+                            reached.Add(callee);
+                        }
+                }
+
+                reachedOf[i] = reached;
+                foreach (MethodBase method in reached)
+                {
+                    object owner = owners[method];
+                    if (owner == null)
+                        owners[method] = i;
+                    else
+                    {
+                        int g1 = groupOf[(int) owner], g2 = groupOf[i];
+                        if (g1 != g2)
+                            for (int k = 0; k <= i; k++)
+                                if (groupOf[k] == g2)
+                                    groupOf[k] = g1;
+                    }
+                }
+            }
+
+            ArrayList groups = new ArrayList();
+            Hashtable groupByIndex = new Hashtable();
+            Hashtable reachedByIndex = new Hashtable();
+            for (int i = 0; i < entries.Count; i++)
+            {
+                ArrayList group = groupByIndex[groupOf[i]] as ArrayList;
+                Hashtable groupMethods = reachedByIndex[groupOf[i]] as Hashtable;
+                if (group == null)
+                {
+                    groupByIndex[groupOf[i]] = group = new ArrayList();
+                    reachedByIndex[groupOf[i]] = groupMethods = new Hashtable();
+                    groups.Add(group);
+                    groupReached.Add(groupMethods.Keys);
+                }
+                group.Add(entries[i]);
+                foreach (MethodBase method in reachedOf[i])
+                    groupMethods[method] = true;
+            }
+
+            return groups;
+        }
+
+        private void annotateConcurrently (ArrayList groups)
+        {
+            AnnotationWorker[] workers = new AnnotationWorker[groups.Count];
+            Thread[] threads = new Thread[groups.Count];
+
+            for (int i = 0; i < groups.Count; i++)
+            {
+                workers[i] = new AnnotationWorker(this, groups[i] as ArrayList);
+                threads[i] = new Thread(new ThreadStart(workers[i].Run));
+                threads[i].Start();
+            }
+
+            for (int i = 0; i < groups.Count; i++)
+                threads[i].Join();
+
+            foreach (AnnotationWorker worker in workers)
+                if (worker.Error != null)
+                    throw worker.Error;
+        }
+
+        /* Restores groups of entry points from the annotation cache,
+         * annotates other groups and stores them to the cache
+         */
+        private void annotateWithCache (ArrayList entries)
+        {
+            AnnotationCache cache = new AnnotationCache(this, AnnotatedAssemblyHolder.AnnotationCacheFile);
+            ArrayList groupReached = new ArrayList();
+            ArrayList groups = this.groupEntries(entries, groupReached);
+
+            string[] keys = new string[groups.Count];
+            ArrayList annotated = new ArrayList();
+            ArrayList rest = new ArrayList();
+            for (int i = 0; i < groups.Count; i++)
+            {
+                keys[i] = cache.GetKey(groupReached[i] as ICollection);
+                if (keys[i] == null || ! cache.Restore(keys[i], groups[i] as ArrayList))
+                {
+                    annotated.Add(i);
+                    rest.Add(groups[i]);
+                }
+            }
+
+            if (AnnotatedAssemblyHolder.ConcurrentAnnotation && rest.Count > 1)
+                this.annotateConcurrently(rest);
+            else if (rest.Count > 0)
+            {
+                ArrayList restEntries = new ArrayList();
+                foreach (ArrayList group in rest)
+                    restEntries.AddRange(group);
+                this.annotateEntries(restEntries);
+            }
+
+            foreach (int i in annotated)
+                if (keys[i] != null)
+                    cache.Store(keys[i], groups[i] as ArrayList, groupReached[i] as ICollection);
+            cache.Save();
+        }
+
+        #endregion
+
+        #region Internal members
+
+        internal GraphProcessor GraphProcessor
+        {
+            get
+            {
+                GraphProcessor processor = AnnotatedAssemblyHolder.workerProcessor;
+                return processor != null ? processor : this.graphProcessor;
+            }
+        }
+
+        internal readonly WhiteList WhiteList;
+
+        internal int AnnotationCount;
+
+        internal int LiftCount;
+
+        internal int ReusedCount;
+
+        internal AnnotatedMethod AnnotateMethod (AnnotatedMethod method)
+        {
+            /* Variants are enumerated in a copy, because other threads
+             * may add variants of the same source method
+             */
+            ArrayList variants;
+            lock (this.variants)
+                variants = this.getVariants(method.SourceMethod).Clone() as ArrayList;
+
+            foreach (AnnotatedMethod key in variants)
+                if (AnnotatedMethod.EqualMethods(method, key))
+                    return key;
+
+            int count = variants.Count;
             if (count > AnnotatedAssemblyHolder.NUMBER_FOR_MERGE)
             {
                 AnnotatedMethod keyMethod = null;
                 int keyMethodCreators = 0;
 
-                foreach (AnnotatedMethod key in this.getMethods())
-                    if (method.SourceMethod == key.SourceMethod)
+                foreach (AnnotatedMethod key in variants)
+                {
+                    int keyCreators = AnnotatedMethod.PseudoMergeMethods(method, key).Count;
+                    if (keyMethod == null || keyMethodCreators > keyCreators)
                     {
-                        int keyCreators = AnnotatedMethod.PseudoMergeMethods(method, key).Count;
-                        if (keyMethod == null || keyMethodCreators > keyCreators)
-                        {
-                            keyMethod = key;
-                            keyMethodCreators = keyCreators;
-                        }
+                        keyMethod = key;
+                        keyMethodCreators = keyCreators;
                     }
+                }
 
                 if (keyMethod != null && (keyMethodCreators == 0 || count > AnnotatedAssemblyHolder.NUMBER_FOR_LIFT))
                 {
@@ -172,13 +509,46 @@ namespace CILPE.BTA
             }
 
             MethodBodyBlock mbbUp = Annotation.AnnotateMethod(this, method);
-            this.addMethodBody(method, mbbUp);
+            lock (this.variants)
+            {
+                this.addMethodBody(method, mbbUp);
+                ArrayList list = this.getVariants(method.SourceMethod);
+                if (! list.Contains(method))
+                    list.Add(method);
+            }
             return method;
         }
 
         internal void RemoveMethod (AnnotatedMethod method)
         {
-            this.removeMethodBody(method);
+            lock (this.variants)
+            {
+                this.removeMethodBody(method);
+                this.getVariants(method.SourceMethod).Remove(method);
+            }
+        }
+
+        internal ArrayList GetVariants (MethodBase sMethod)
+        {
+            lock (this.variants)
+                return this.getVariants(sMethod).Clone() as ArrayList;
+        }
+
+        /* Adds the variant restored from the annotation cache */
+        internal void AddRestoredMethod (AnnotatedMethod method, MethodBodyBlock mbbUp)
+        {
+            lock (this.variants)
+            {
+                this.addMethodBody(method, mbbUp);
+                this.getVariants(method.SourceMethod).Add(method);
+            }
+            this.ReusedCount++;
+        }
+
+        internal void SetAnnotatedMethod (MethodBase sMethod, AnnotatedMethod aMethod)
+        {
+            lock (this.aMethods)
+                this.aMethods[sMethod] = aMethod;
         }
 
         #endregion
@@ -186,33 +556,83 @@ namespace CILPE.BTA
         public AnnotatedAssemblyHolder (AssemblyHolder sourceHolder, WhiteList whiteList) : base(sourceHolder)
         {
             this.aMethods = new Hashtable();
-            this.GraphProcessor = new GraphProcessor();
+            this.variants = new Hashtable();
+            this.graphProcessor = new GraphProcessor();
             this.WhiteList = whiteList;
+            this.AnnotationCount = 0;
+            this.LiftCount = 0;
+            this.ReusedCount = 0;
 
+            ArrayList entries = new ArrayList();
             foreach (MethodBase method in this.SourceHolder.getMethods())
                 if (method.IsDefined(typeof(SpecializeAttribute), false))
-                    ControllingVisitor.AddAnnotatedMethodUser(this.AnnotateMethod(this.GetAnnotatedMethod(method)));
+                    entries.Add(method);
+
+            if (AnnotatedAssemblyHolder.AnnotationCacheFile != null)
+                this.annotateWithCache(entries);
+            else if (AnnotatedAssemblyHolder.ConcurrentAnnotation && entries.Count > 1)
+                this.annotateConcurrently(this.groupEntries(entries, new ArrayList()));
+            else
+                this.annotateEntries(entries);
+        }
 
-            this.GraphProcessor.Process();
+        /* Entry points that reach no common source method
+         * are annotated in separate threads
+         */
+        public static bool ConcurrentAnnotation = false;
+
+        /* File keeping annotations of entry point groups between runs,
+         * null if annotations are not kept
+         */
+        public static string AnnotationCacheFile = null;
+
+        /* Number of nodes annotated by BTA, including re-annotations */
+        public int AnnotationsNumber
+        {
+            get
+            {
+                return this.AnnotationCount;
+            }
         }
 
-        public AnnotatedMethod GetAnnotatedMethod (MethodBase sMethod)
+        /* Number of annotations restarted because of lifting */
+        public int LiftsNumber
         {
-            AnnotatedMethod aMethod = this.aMethods[sMethod] as AnnotatedMethod;
-            if (aMethod == null)
+            get
             {
-                ParameterInfo[] parms = sMethod.GetParameters();
-                EvaluationStack stack = new EvaluationStack();
-                if (! sMethod.IsStatic)
-                    stack.Push(new ReferenceBTValue(BTType.Dynamic));
-                for (int i = 0; i < parms.Length; i++)
-                    stack.Push(new ReferenceBTValue(BTType.Dynamic));
-                ParameterValues paramVals = stack.Perform_CallMethod(sMethod, false);
-                ReferenceBTValue ret = ReferenceBTValue.NewReferenceBTValue(Annotation.GetReturnType(sMethod), BTType.Dynamic);
-                this.aMethods[sMethod] = aMethod = new AnnotatedMethod(paramVals, ret);
+                return this.LiftCount;
             }
+        }
 
-            return aMethod;
+        /* Number of annotated methods restored from the annotation cache */
+        public int ReusedMethodsNumber
+        {
+            get
+            {
+                return this.ReusedCount;
+            }
+        }
+
+        public AnnotatedMethod GetAnnotatedMethod (MethodBase sMethod)
+        {
+            lock (this.aMethods)
+            {
+                AnnotatedMethod aMethod = this.aMethods[sMethod] as AnnotatedMethod;
+                if (aMethod == null)
+                {
+                    ParameterInfo[] parms = sMethod.GetParameters();
+                    EvaluationStack stack = new EvaluationStack();
+                    if (! sMethod.IsStatic)
+                        stack.Push(new ReferenceBTValue(BTType.Dynamic));
+                    for (int i = 0; i < parms.Length; i++)
+                        stack.Push(new ReferenceBTValue(BTType.Dynamic));
+                    ParameterValues paramVals = stack.Perform_CallMethod(sMethod, false);
+                    ReferenceBTValue ret = ReferenceBTValue.NewReferenceBTValue(Annotation.GetReturnType(sMethod), BTType.Dynamic);
+                    this.aMethods[sMethod] = aMethod = new AnnotatedMethod(paramVals, ret);
+                }
+
+                return aMethod;
+            }
         }
     }
 }
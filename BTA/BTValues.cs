@@ -17,6 +17,7 @@ namespace CILPE.BTA
 {
     using System.Reflection;
     using System.Collections;
+    using System.Threading;
     using CILPE.Exceptions;
     using CILPE.ReflectionEx;
     using CILPE.CFG;
@@ -569,13 +570,13 @@ namespace CILPE.BTA
             {
                 #region private members
 
-                private readonly BTValue val1;
+                private readonly ReferenceBTValue val1;
 
-                private readonly BTValue val2;
+                private readonly ReferenceBTValue val2;
 
                 #endregion
 
-                internal BTValuePair (BTValue val1, BTValue val2)
+                internal BTValuePair (ReferenceBTValue val1, ReferenceBTValue val2)
                 {
                     this.val1 = val1;
                     this.val2 = val2;
@@ -594,7 +595,9 @@ namespace CILPE.BTA
 
                 public override int GetHashCode ()
                 {
-                    return DataModelUtils.GetObjectHashCode(val1) ^ DataModelUtils.GetObjectHashCode(val2);
+                    int id1 = Math.Min(val1.id, val2.id);
+                    int id2 = Math.Max(val1.id, val2.id);
+                    return unchecked(id1 * 0x10001 + id2);
                 }
             }
 
@@ -612,7 +615,7 @@ namespace CILPE.BTA
                 this.hash = new Hashtable();
             }
 
-            internal bool this [BTValue val1, BTValue val2]
+            internal bool this [ReferenceBTValue val1, ReferenceBTValue val2]
             {
                 get
                 {
@@ -634,9 +637,12 @@ namespace CILPE.BTA
         {
             val1 = val1.findLeaf();
             val2 = val2.findLeaf();
+            if (val1 == val2)
+                return new Creators();
+
             bool flag = pairs[val1, val2];
 
-            if (! flag && val1 != val2 && val1.btType == BTType.Static && val2.btType == BTType.Static)
+            if (! flag && val1.btType == BTType.Static && val2.btType == BTType.Static)
             {
                 Creators crtrs = new Creators();
 
@@ -683,8 +689,10 @@ namespace CILPE.BTA
         {
             val1 = val1.findLeaf();
             val2 = val2.findLeaf();
+            if (val1 == val2)
+                return new Creators();
 
-            if (val1 != val2 && val1.btType  == BTType.Static && val2.btType == BTType.Static)
+            if (val1.btType  == BTType.Static && val2.btType == BTType.Static)
             {
                 Creators crtrs = new Creators();
 
@@ -737,6 +745,11 @@ namespace CILPE.BTA
 
         #region Private members
 
+        private static int idCounter = 0;
+
+        /* Unique id of the value, used for hashing pairs of values */
+        private readonly int id;
+
         private ReferenceBTValue next;
 
         private readonly ArrayList types;
@@ -794,6 +807,7 @@ namespace CILPE.BTA
 
         internal ReferenceBTValue (BTType btType)
         {
+            this.id = Interlocked.Increment(ref idCounter);
             this.next = null;
             this.types = new ArrayList();
             this.btType = btType;
@@ -803,6 +817,7 @@ namespace CILPE.BTA
 
         internal ReferenceBTValue (Type type, BTType btType)
         {
+            this.id = Interlocked.Increment(ref idCounter);
             this.next = null;
             this.types = new ArrayList();
             this.addType(type);
@@ -847,6 +862,32 @@ namespace CILPE.BTA
             }
         }
 
+        /* Keys of the fields that have values: FieldInfo
+         * of an object field or "ArrayElements"
+         */
+        internal ICollection FieldKeys
+        {
+            get
+            {
+                return this.findLeaf().flds.Keys;
+            }
+        }
+
+        internal ReferenceBTValue GetFieldValue (object key)
+        {
+            return this.findLeaf().flds[key] as ReferenceBTValue;
+        }
+
+        internal void SetFieldValue (object key, ReferenceBTValue fld)
+        {
+            this.findLeaf().flds[key] = fld;
+        }
+
+        internal void AddType (Type type)
+        {
+            this.findLeaf().addType(type);
+        }
+
         internal ReferenceBTValue[] GetAllNotNullFieldBTValues ()
         {
             ICollection vals = this.findLeaf().flds.Values;
@@ -920,7 +961,9 @@ namespace CILPE.BTA
             {
                 ReferenceBTValue val1 = this.findLeaf();
                 ReferenceBTValue val2 = (o as ReferenceBTValue).findLeaf();
-                if (val1.btType == BTType.Dynamic && val2.btType == BTType.Dynamic)
+                if (val1 == val2)
+                    return true;
+                else if (val1.btType == BTType.Dynamic && val2.btType == BTType.Dynamic)
                     return true;
                 else if (val1.types.Count == 1 && val1.types[0] == PrimitiveBTValue.PrimitiveType() && val2.types.Count == 1 && val2.types[0] == PrimitiveBTValue.PrimitiveType())
                     return val1.btType == val2.btType;
@@ -0,0 +1,174 @@
+// =============================================================================
+// CILPE - Partial Evaluator for Common Intermediate Language
+// =============================================================================
+// File:
+//     LiveVariables.cs
+//
+// Description:
+//     Live variables of source method bodies
+//
+// Author:
+//     Yuri Klimov (yuri.klimov@cilpe.net)
+// =============================================================================
+
+using System;
+
+namespace CILPE.BTA
+{
+    using System.Collections;
+    using CILPE.CFG;
+
+
+    /* Variables that are live at the entry of a node of source method body.
+     * Sets are computed once for the whole method body and kept in options
+     * of its nodes. Variables of unknown nodes and of method bodies with
+     * exception handlers are considered to be live.
+     */
+    internal class LiveVariables
+    {
+        #region Private static members
+
+        private static readonly string LiveVariablesOption = "LiveVariables";
+
+        private static readonly LiveVariables allLive = new LiveVariables(0, null);
+
+        private static void addNode (Node node, ArrayList nodes, Hashtable indices)
+        {
+            if (node != null && ! indices.ContainsKey(node))
+            {
+                indices[node] = nodes.Count;
+                nodes.Add(node);
+            }
+        }
+
+        private static void compute (MethodBodyBlock mbb)
+        {
+            ArrayList nodes = new ArrayList();
+            Hashtable indices = new Hashtable();
+            bool hasHandlers = false;
+
+            addNode(mbb, nodes, indices);
+            for (int i = 0; i < nodes.Count; i++)
+            {
+                Node node = nodes[i] as Node;
+                if (node is Block && ! (node is MethodBodyBlock))
+                    hasHandlers = true;
+
+                for (int j = 0; j < node.NextArray.Count; j++)
+                    addNode(node.NextArray[j], nodes, indices);
+            }
+
+            if (hasHandlers)
+            {
+                foreach (Node node in nodes)
+                    node.Options[LiveVariables.LiveVariablesOption] = LiveVariables.allLive;
+                return;
+            }
+
+            int minIndex = Int32.MaxValue, maxIndex = -1;
+            foreach (Variable var in mbb.Variables)
+            {
+                minIndex = Math.Min(minIndex, var.Index);
+                maxIndex = Math.Max(maxIndex, var.Index);
+            }
+            int length = Math.Max(maxIndex - minIndex + 1, 0);
+
+            /* Variables whose address is taken are live everywhere */
+            BitArray addressed = new BitArray(length);
+            foreach (Node node in nodes)
+                if (node is LoadVarAddr)
+                    addressed[(node as LoadVarAddr).Var.Index - minIndex] = true;
+
+            BitArray[] live = new BitArray[nodes.Count];
+            for (int i = 0; i < nodes.Count; i++)
+                live[i] = new BitArray(addressed);
+
+            bool changed = true;
+            while (changed)
+            {
+                changed = false;
+                for (int i = nodes.Count - 1; i >= 0; i--)
+                {
+                    Node node = nodes[i] as Node;
+                    BitArray set = new BitArray(addressed);
+                    for (int j = 0; j < node.NextArray.Count; j++)
+                        if (node.NextArray[j] != null)
+                            set.Or(live[(int)indices[node.NextArray[j]]]);
+
+                    if (node is StoreVar)
+                    {
+                        int index = (node as StoreVar).Var.Index - minIndex;
+                        set[index] = addressed[index];
+                    }
+                    else if (node is LoadVar)
+                        set[(node as LoadVar).Var.Index - minIndex] = true;
+
+                    for (int k = 0; k < length && ! changed; k++)
+                        if (set[k] != live[i][k])
+                            changed = true;
+                    live[i] = set;
+                }
+            }
+
+            for (int i = 0; i < nodes.Count; i++)
+                (nodes[i] as Node).Options[LiveVariables.LiveVariablesOption] = new LiveVariables(minIndex, live[i]);
+        }
+
+        #endregion
+
+        #region Internal static members
+
+        internal static LiveVariables GetLiveVariables (Node downNode)
+        {
+            LiveVariables live = downNode.Options[LiveVariables.LiveVariablesOption] as LiveVariables;
+            if (live == null)
+                lock (Annotation.SourceOptionsLock)
+                {
+                    live = downNode.Options[LiveVariables.LiveVariablesOption] as LiveVariables;
+                    if (live == null)
+                    {
+                        Node mbb = downNode;
+                        while (mbb != null && ! (mbb is MethodBodyBlock))
+                            mbb = mbb.Parent;
+
+                        if (mbb != null)
+                            LiveVariables.compute(mbb as MethodBodyBlock);
+
+                        live = downNode.Options[LiveVariables.LiveVariablesOption] as LiveVariables;
+                        if (live == null)
+                            downNode.Options[LiveVariables.LiveVariablesOption] = live = LiveVariables.allLive;
+                    }
+                }
+
+            return live;
+        }
+
+        #endregion
+
+        #region Private members
+
+        private readonly int minIndex;
+
+        private readonly BitArray bits;
+
+        private LiveVariables (int minIndex, BitArray bits)
+        {
+            this.minIndex = minIndex;
+            this.bits = bits;
+        }
+
+        #endregion
+
+        internal bool this [Variable var]
+        {
+            get
+            {
+                if (this.bits == null)
+                    return true;
+
+                int index = var.Index - this.minIndex;
+                return index < 0 || index >= this.bits.Length || this.bits[index];
+            }
+        }
+    }
+}
@@ -418,6 +418,68 @@ namespace CILPE.CFG
 			}
 		}
 
+		/* Key of a computation for value numbering: kind of the node,
+		 * its operation and value numbers of its operands
+		 */
+		private class ExpressionKey
+		{
+			private Type nodeType;
+			private object operation;
+			private int[] operands;
+
+			public ExpressionKey(Type nodeType, object operation, int[] operands)
+			{
+				this.nodeType = nodeType;
+				this.operation = operation;
+				this.operands = operands;
+			}
+
+			public override bool Equals(object obj)
+			{
+				ExpressionKey key = obj as ExpressionKey;
+
+				if (key == null || key.nodeType != nodeType ||
+					! Object.Equals(key.operation,operation) ||
+					key.operands.Length != operands.Length)
+					return false;
+
+				for (int i = 0; i < operands.Length; i++)
+					if (key.operands[i] != operands[i])
+						return false;
+
+				return true;
+			}
+
+			public override int GetHashCode()
+			{
+				int hash = nodeType.GetHashCode();
+
+				if (operation != null)
+					hash ^= operation.GetHashCode();
+
+				foreach (int operand in operands)
+					hash = (hash << 5) - hash + operand;
+
+				return hash;
+			}
+		}
+
+		/* Value on the stack of a basic block: its value number and the
+		 * range of nodes that computes it (Start is -1 if the range
+		 * contains other nodes or is unknown)
+		 */
+		private class StackSlot
+		{
+			public readonly int Number, Start, End;
+
+			public StackSlot(int number, int start, int end)
+			{
+				Number = number;
+				Start = start;
+				End = end;
+			}
+		}
+
 		#endregion
 
         #region Private and internal members
@@ -1116,8 +1178,224 @@ namespace CILPE.CFG
             return result;
         }
 
+        private static bool isCommutative(BinaryOp node)
+        {
+            BinaryOp.ArithOp op = node.Op;
+
+            return op == BinaryOp.ArithOp.ADD || op == BinaryOp.ArithOp.AND ||
+                op == BinaryOp.ArithOp.CEQ || op == BinaryOp.ArithOp.MUL ||
+                op == BinaryOp.ArithOp.OR || op == BinaryOp.ArithOp.XOR;
+        }
+
+        /* Types of variables that keep stack values without conversion */
+        private static bool keepsStackValue(Type type)
+        {
+            return ! type.IsValueType || type == typeof(int) ||
+                type == typeof(long) || type == typeof(double) || type == typeof(IntPtr);
+        }
+
+        private static object getOperation(Node node)
+        {
+            object result = null;
+
+            if (node is LoadConst)
+                result = (node as LoadConst).Constant;
+            else if (node is UnaryOp)
+                result = (node as UnaryOp).Op;
+            else if (node is BinaryOp)
+            {
+                BinaryOp binaryOp = node as BinaryOp;
+                result = binaryOp.Op + "/" + binaryOp.Overflow + "/" + binaryOp.Unsigned;
+            }
+            else if (node is ConvertValue)
+            {
+                ConvertValue convertValue = node as ConvertValue;
+                result = convertValue.Type + "/" + convertValue.Overflow + "/" + convertValue.Unsigned;
+            }
+            else if (node is LoadField)
+                result = (node as LoadField).Field;
+
+            return result;
+        }
+
+        /* Number of stack operands of a pure computation or -1 */
+        private static int getOperandCount(Node node)
+        {
+            int result = -1;
+
+            if (node is LoadConst)
+                result = 0;
+            else if (node is UnaryOp || node is ConvertValue)
+                result = 1;
+            else if (node is BinaryOp)
+                result = 2;
+            else if (node is LoadField)
+                result = (node as LoadField).Field.IsStatic ? 0 : 1;
+
+            return result;
+        }
+
+        private static int getNumber(Hashtable numbers, object key, ref int count)
+        {
+            object number = numbers[key];
+
+            if (number == null)
+                numbers[key] = number = count++;
+
+            return (int)number;
+        }
+
+        private static void replaceByLoadVar(BasicBlock block, int start, int end, Variable var)
+        {
+            NodeArray body = block.Body;
+            Node n = new LoadVar(var);
+            n.Options[BasicBlock.BASIC_BLOCK_OPTION] = block;
+
+            body[start].ReplaceByNode(n);
+            n.Next = body[end].Next;
+
+            for (int i = end; i >= start; i--)
+            {
+                Node node = body[i];
+                body.RemoveAt(i);
+                node.RemoveFromGraph();
+            }
+
+            body.Insert(start,n);
+        }
+
+        /* Replaces one computation of the basic block by loading of the
+         * variable that keeps the same value computed earlier in the block.
+         * Returns false if there is no such computation
+         */
+        private bool eliminateCommonSubexpression(BasicBlock block)
+        {
+            NodeArray body = block.Body;
+            Hashtable numbers = new Hashtable();    /* ExpressionKey -> value number */
+            Hashtable varNumbers = new Hashtable(); /* Variable -> value number */
+            Hashtable holders = new Hashtable();    /* value number -> Variable */
+            ArrayList stack = new ArrayList();      /* known top of the stack */
+            int count = 0, memory = 0;
+
+            for (int i = 0; i < body.Count; i++)
+            {
+                Node node = body[i];
+                int operandCount = getOperandCount(node);
+
+                if (operandCount >= 0)
+                {
+                    StackSlot[] operands = new StackSlot[operandCount];
+                    for (int j = operandCount-1; j >= 0; j--)
+                    {
+                        if (stack.Count > 0)
+                        {
+                            operands[j] = stack[stack.Count-1] as StackSlot;
+                            stack.RemoveAt(stack.Count-1);
+                        }
+                        else
+                            operands[j] = new StackSlot(count++,-1,-1);
+                    }
+
+                    bool isContiguous = true;
+                    int[] keyOperands = new int[operandCount + (node is LoadField ? 1 : 0)];
+                    for (int j = 0; j < operandCount; j++)
+                    {
+                        keyOperands[j] = operands[j].Number;
+                        isContiguous &= operands[j].Start >= 0 &&
+                            operands[j].End == (j == operandCount-1 ? i-1 : operands[j+1].Start-1);
+                    }
+
+                    if (node is LoadField)
+                        keyOperands[operandCount] = memory;
+                    else if (node is BinaryOp && isCommutative(node as BinaryOp) &&
+                        keyOperands[0] > keyOperands[1])
+                    {
+                        int operand = keyOperands[0];
+                        keyOperands[0] = keyOperands[1];
+                        keyOperands[1] = operand;
+                    }
+
+                    ExpressionKey key = new ExpressionKey(node.GetType(),getOperation(node),keyOperands);
+                    int number = getNumber(numbers,key,ref count);
+                    int start = ! isContiguous ? -1 : (operandCount > 0 ? operands[0].Start : i);
+
+                    Variable holder = holders[number] as Variable;
+                    if (holder != null && start >= 0 && start < i)
+                    {
+                        replaceByLoadVar(block,start,i,holder);
+                        return true;
+                    }
+
+                    stack.Add(new StackSlot(number,start,i));
+                }
+                else if (node is LoadVar)
+                {
+                    Variable var = (node as LoadVar).Var;
+                    int number = varIsNotReferenced(var) ?
+                        getNumber(varNumbers,var,ref count) : count++;
+
+                    stack.Add(new StackSlot(number,i,i));
+                }
+                else if (node is StoreVar)
+                {
+                    Variable var = (node as StoreVar).Var;
+                    StackSlot value;
+                    if (stack.Count > 0)
+                    {
+                        value = stack[stack.Count-1] as StackSlot;
+                        stack.RemoveAt(stack.Count-1);
+                    }
+                    else
+                        value = new StackSlot(count++,-1,-1);
+
+                    object oldNumber = varNumbers[var];
+                    if (oldNumber != null && holders[oldNumber] == var)
+                        holders.Remove(oldNumber);
+
+                    if (! varIsNotReferenced(var))
+                        varNumbers.Remove(var);
+                    else if (! keepsStackValue(var.Type))
+                        varNumbers[var] = count++;
+                    else
+                    {
+                        varNumbers[var] = value.Number;
+
+                        if (! holders.ContainsKey(value.Number))
+                            holders[value.Number] = var;
+                    }
+                }
+                else if (node is DuplicateStackTop && stack.Count > 0)
+                {
+                    StackSlot top = stack[stack.Count-1] as StackSlot;
+                    stack.Add(new StackSlot(top.Number,-1,i));
+                }
+                else
+                {
+                    /* Any other node may change the stack and the memory */
+                    stack.Clear();
+                    memory++;
+                }
+            }
+
+            return false;
+        }
+
+        private bool performValueNumbering()
+        {
+            bool result = false;
+
+            foreach (BasicBlock block in blockList)
+                while (eliminateCommonSubexpression(block))
+                    result = true;
+
+            return result;
+        }
+
         #endregion
 
+        /* Enables elimination of common subexpressions in basic blocks */
+        public static bool ValueNumbering = false;
+
         public BasicBlocksGraph(MethodBodyBlock methodBodyBlock)
         {
             mbb = methodBodyBlock;
@@ -1159,6 +1437,9 @@ namespace CILPE.CFG
 				flag |= performConstantAliasesRemoval();
 				flag |= performUnusedVariablesRemoval();
 				flag |= performLeaveReproduction();
+
+				if (ValueNumbering)
+					flag |= performValueNumbering();
             }
             while (flag);
         }
@@ -37,30 +37,6 @@ namespace CILPE.CFG
 	public class Emitter
 	{
 
-		private class Labeler
-		{
-			private ILGenerator generator;
-			private Hashtable labels; //Node -> Label   mapping
-
-			private Labeler(ILGenerator generator)
-			{
-				this.generator = generator;
-				labels = new Hashtable();
-			}
-			
-			private void Label(Node node)
-			{
-				labels[node] = generator.DefineLabel();
-			}
-
-			public static Hashtable LabelNodes(MethodBodyBlock graph, ILGenerator generator)
-			{
-				Labeler labeler = new Labeler(generator);
-				ForEachVisitor.ForEach(graph, new ForEachCallback(labeler.Label) );
-				return(labeler.labels);
-			}
-		}
-
 		private class EmitterVisitor : Visitor
 		{
 			private class Tasks : VisitorTaskCollection
@@ -140,71 +116,78 @@ namespace CILPE.CFG
 
 			}
 
-			private Hashtable labels; //Node -> Label   mapping
-			private ILGenerator generator;
-			private Hashtable alreadyVisited;
-			private Hashtable locals; //Index -> LocalBuilder    mapping
+			private Hashtable labels; //Node -> label mapping, only for branch targets
+			private ILEncoder il;
+			private Hashtable alreadyVisited; //Node -> instruction position mapping
+			private Hashtable locals; //Variable -> local index    mapping
 			private ParameterMapper paramMapper;
 			private new Tasks tasks;
 			private Block currentBlock;
-			private Hashtable extraVars; //Type -> ArrayList mapping, ArrayList contains LocalBuilder objects
-			private LocalBuilder boolVar;
+			private Hashtable extraVars; //Type -> ArrayList mapping, ArrayList contains local indexes
+			private int boolVar;
 			private bool wasDumpedFlag;
 			private Hashtable wasDumped; //Node -> bool mapping
 			private bool prevHasNext;
 
-			public EmitterVisitor(GraphProcessor processor, ILGenerator generator, MethodBodyBlock method) 
+			public EmitterVisitor(GraphProcessor processor, ILEncoder il, MethodBodyBlock method) 
 				: base(processor, new Tasks())
 			{
 				this.tasks = base.tasks as Tasks;
 				tasks.SetVisitor(this);
 				paramMapper = method.Variables.ParameterMapper;
-				this.labels = Labeler.LabelNodes(method,generator);
-				this.generator = generator;
+				this.labels = new Hashtable();
+				this.il = il;
 				alreadyVisited = new Hashtable();
 				locals = new Hashtable();
 				AddTask(method,null);
 				foreach(Variable var in method.Variables)
 				{
 					if(var.Kind == VariableKind.Local)
-						locals[var] = generator.DeclareLocal(var.Type);
+						locals[var] = il.DeclareLocal(var.Type);
 				}
 				extraVars = new Hashtable();
-				boolVar = null;
+				boolVar = -1;
 				wasDumped = new Hashtable();;
 				wasDumpedFlag = false;
 				prevHasNext = true;
 			}
 
-			private LocalBuilder GetExtraVar(Type type, int index)
+			private int GetExtraVar(Type type, int index)
 			{
 				if(extraVars[type] == null)
 					extraVars[type] = new ArrayList();
 				ArrayList list = extraVars[type] as ArrayList;
 				if(index >= list.Count)
 					for(int i=list.Count;i<=index;i++)
-						list.Add(generator.DeclareLocal(type));
-				LocalBuilder var = list[index] as LocalBuilder;
-				if(var == null)
-					throw new EmissionException();
-				return(var);
+						list.Add(il.DeclareLocal(type));
+				return((int)list[index]);
 			}
 
-			private LocalBuilder GetBoolVar()
+			private int GetBoolVar()
 			{
-				if(boolVar == null)
-					boolVar = generator.DeclareLocal(typeof(int));
+				if(boolVar == -1)
+					boolVar = il.DeclareLocal(typeof(int));
 				return(boolVar);
 			}
 
-			private Label GetLabel(Node node)
+			//Labels are created on demand, so only real branch targets get them
+			private int GetLabel(Node node)
 			{
-				return((Label)labels[node]);
+				object label = labels[node];
+				if(label == null)
+				{
+					int newLabel = il.DefineLabel();
+					object position = alreadyVisited[node];
+					if(position != null) //backward branch
+						il.MarkLabel(newLabel, (int)position);
+					labels[node] = label = newLabel;
+				}
+				return((int)label);
 			}
 
-			private LocalBuilder GetLocal(Variable var)
+			private int GetLocal(Variable var)
 			{
-				return((LocalBuilder)locals[var]);
+				return((int)locals[var]);
 			}
 
 			private int GetArgIndex(Variable var)
@@ -228,7 +211,10 @@ namespace CILPE.CFG
 
 			private void AddAlreadyVisited(Node node)
 			{
-				alreadyVisited.Add(node,null);
+				alreadyVisited.Add(node,il.Position);
+				object label = labels[node];
+				if(label != null) //forward branch
+					il.MarkLabel((int)label);
 			}
 
 			private Type VarType(TypeEx typeEx)
@@ -246,7 +232,7 @@ namespace CILPE.CFG
 					for(int j=0; j<i; j++)
 						if(VarType(stack[j]) == type)
 							index++;
-					generator.Emit(OpCodes.Ldloc, GetExtraVar(type,index));
+					il.EmitLocal(OpCodes.Ldloc, GetExtraVar(type,index));
 				}
 			}
 
@@ -270,7 +256,7 @@ namespace CILPE.CFG
 					for(int j=0; j<i; j++)
 						if(VarType(stack[j]) == type)
 							index++;
-					generator.Emit(OpCodes.Stloc, GetExtraVar(type,index));
+					il.EmitLocal(OpCodes.Stloc, GetExtraVar(type,index));
 				}
 			}
       
@@ -288,14 +274,13 @@ namespace CILPE.CFG
 				if(IsAlreadyVisited(node))
 				{
 					if(prevHasNext)
-						generator.Emit(OpCodes.Br, GetLabel(node));
+						il.EmitBranch(OpCodes.Br, GetLabel(node));
 					prevHasNext = false;
 				}
 				else
 				{
 					prevHasNext = true;
 					AddAlreadyVisited(node);
-					generator.MarkLabel(GetLabel(node));
 					RestoreStack(node); 
 					CallVisitorMethod(node,null);
 					if(wasDumpedFlag)
@@ -321,7 +306,7 @@ namespace CILPE.CFG
 
 			protected internal override void VisitProtectedBlock(ProtectedBlock node, object data)
 			{
-				generator.BeginExceptionBlock();
+				il.BeginExceptionBlock();
 				currentBlock = node;
 				tasks.Suspend();
 				AddTask(node.Next,null);
@@ -329,7 +314,7 @@ namespace CILPE.CFG
 
 			protected internal override void VisitCatchBlock(CatchBlock node, object data)
 			{
-				generator.BeginCatchBlock(node.Type);
+				il.BeginCatchBlock(node.Type);
 				currentBlock = node;
 				tasks.Suspend();
 				AddTask(node.Next,null);
@@ -337,7 +322,7 @@ namespace CILPE.CFG
 
 			protected internal override void VisitFinallyBlock(FinallyBlock node, object data)
 			{
-				generator.BeginFinallyBlock();
+				il.BeginFinallyBlock();
 				currentBlock = node;
 				tasks.Suspend();
 				AddTask(node.Next,null);
@@ -356,7 +341,7 @@ namespace CILPE.CFG
 					EHBlock block = currentBlock as EHBlock;
 					if(block.TryBlock[block.TryBlock.Count - 1] == block)
 					{ // The last handler
-						generator.EndExceptionBlock();
+						il.EndExceptionBlock();
             tasks.TryResume();
 					}
 				}
@@ -380,14 +365,14 @@ namespace CILPE.CFG
 				prevHasNext = false;
 
 				if(node.Parent is MethodBodyBlock)
-					generator.Emit(OpCodes.Ret);
+					il.Emit(OpCodes.Ret);
 				else if(node.Parent is ProtectedBlock || node.Parent is CatchBlock)
 				{
-					generator.Emit(OpCodes.Leave, GetLabel(node.Next) );
+					il.EmitBranch(OpCodes.Leave, GetLabel(node.Next));
 					tasks.Burrow(node.Next,null);
 				}
 				else if(node.Parent is FinallyBlock)
-					generator.Emit(OpCodes.Endfinally);
+					il.Emit(OpCodes.Endfinally);
 				else
 					throw new EmissionException();
 			}
@@ -398,11 +383,11 @@ namespace CILPE.CFG
 				{
 					case UnaryOp.ArithOp.NEG:
 					{
-						generator.Emit(OpCodes.Neg);
+						il.Emit(OpCodes.Neg);
 					} break;
 					case UnaryOp.ArithOp.NOT:
 					{
-						generator.Emit(OpCodes.Not);
+						il.Emit(OpCodes.Not);
 					} break;
 					default: throw new EmissionException();
 				}
@@ -417,27 +402,27 @@ namespace CILPE.CFG
 					{
 						if(node.Overflow)
 							if(node.Unsigned)
-								generator.Emit(OpCodes.Add_Ovf_Un);
+								il.Emit(OpCodes.Add_Ovf_Un);
 							else
-								generator.Emit(OpCodes.Add_Ovf);
+								il.Emit(OpCodes.Add_Ovf);
 						else
-							generator.Emit(OpCodes.Add);
+							il.Emit(OpCodes.Add);
 					} break;
 					case BinaryOp.ArithOp.AND:
 					{
-						generator.Emit(OpCodes.And);
+						il.Emit(OpCodes.And);
 					} break;
 					case BinaryOp.ArithOp.CEQ:
 					{
 						if(node.Next is Branch && node.Next.PrevArray.Count == 1)
 						{
 							Branch br = node.Next as Branch;
-							generator.Emit(OpCodes.Beq, GetLabel(br.Alt));
+							il.EmitBranch(OpCodes.Beq, GetLabel(br.Alt));
 							AddTask(br.Alt,null);
 							AddTask(br.Next,null);
 							return;
 						}
-						generator.Emit(OpCodes.Ceq);
+						il.Emit(OpCodes.Ceq);
 					} break;
 					case BinaryOp.ArithOp.CGT:
 					{
@@ -445,17 +430,17 @@ namespace CILPE.CFG
 						{
 							Branch br = node.Next as Branch;
 							if(node.Unsigned)
-								generator.Emit(OpCodes.Bgt_Un, GetLabel(br.Alt));
+								il.EmitBranch(OpCodes.Bgt_Un, GetLabel(br.Alt));
 							else
-								generator.Emit(OpCodes.Bgt, GetLabel(br.Alt));
+								il.EmitBranch(OpCodes.Bgt, GetLabel(br.Alt));
 							AddTask(br.Alt,null);
 							AddTask(br.Next,null);
 							return;
 						}
 						if(node.Unsigned)
-							generator.Emit(OpCodes.Cgt_Un);
+							il.Emit(OpCodes.Cgt_Un);
 						else
-							generator.Emit(OpCodes.Cgt);
+							il.Emit(OpCodes.Cgt);
 					} break;
 					case BinaryOp.ArithOp.CLT:
 					{
@@ -463,67 +448,67 @@ namespace CILPE.CFG
 						{
 							Branch br = node.Next as Branch;
 							if(node.Unsigned)
-								generator.Emit(OpCodes.Blt_Un, GetLabel(br.Alt));
+								il.EmitBranch(OpCodes.Blt_Un, GetLabel(br.Alt));
 							else
-								generator.Emit(OpCodes.Blt, GetLabel(br.Alt));
+								il.EmitBranch(OpCodes.Blt, GetLabel(br.Alt));
 							AddTask(br.Alt,null);
 							AddTask(br.Next,null);
 							return;
 						}
 						if(node.Unsigned)
-							generator.Emit(OpCodes.Clt_Un);
+							il.Emit(OpCodes.Clt_Un);
 						else
-							generator.Emit(OpCodes.Clt);
+							il.Emit(OpCodes.Clt);
 					} break;
 					case BinaryOp.ArithOp.DIV:
 					{
 						if(node.Unsigned)
-							generator.Emit(OpCodes.Div_Un);
+							il.Emit(OpCodes.Div_Un);
 						else
-							generator.Emit(OpCodes.Div);
+							il.Emit(OpCodes.Div);
 					} break;
 					case BinaryOp.ArithOp.MUL:
 					{
 						if(node.Overflow)
 							if(node.Unsigned)
-								generator.Emit(OpCodes.Mul_Ovf_Un);
+								il.Emit(OpCodes.Mul_Ovf_Un);
 							else
-								generator.Emit(OpCodes.Mul_Ovf);
+								il.Emit(OpCodes.Mul_Ovf);
 						else
-							generator.Emit(OpCodes.Mul);
+							il.Emit(OpCodes.Mul);
 					} break;
 					case BinaryOp.ArithOp.OR:
 					{
-						generator.Emit(OpCodes.Or); 
+						il.Emit(OpCodes.Or); 
 					} break;
 					case BinaryOp.ArithOp.REM:
 					{
 						if(node.Unsigned)
-							generator.Emit(OpCodes.Rem_Un);
+							il.Emit(OpCodes.Rem_Un);
 						else
-							generator.Emit(OpCodes.Rem);
+							il.Emit(OpCodes.Rem);
 					} break;
 					case BinaryOp.ArithOp.SHL:
 					{
-						generator.Emit(OpCodes.Shl);
+						il.Emit(OpCodes.Shl);
 					} break;
 					case BinaryOp.ArithOp.SHR:
 					{
-						generator.Emit(OpCodes.Shr);
+						il.Emit(OpCodes.Shr);
 					} break;
 					case BinaryOp.ArithOp.SUB:
 					{
 						if(node.Overflow)
 							if(node.Unsigned)
-								generator.Emit(OpCodes.Sub_Ovf_Un);
+								il.Emit(OpCodes.Sub_Ovf_Un);
 							else
-								generator.Emit(OpCodes.Sub_Ovf);
+								il.Emit(OpCodes.Sub_Ovf);
 						else
-							generator.Emit(OpCodes.Sub);
+							il.Emit(OpCodes.Sub);
 					} break;
 					case BinaryOp.ArithOp.XOR:
 					{
-						generator.Emit(OpCodes.Xor);
+						il.Emit(OpCodes.Xor);
 					} break;
 					default: throw new EmissionException();
 				}
@@ -535,96 +520,96 @@ namespace CILPE.CFG
 				if(node.Type.Equals(typeof(IntPtr))) 
 					if(node.Overflow)
 						if(node.Unsigned)
-              generator.Emit(OpCodes.Conv_Ovf_I_Un);
+              il.Emit(OpCodes.Conv_Ovf_I_Un);
 						else
-							generator.Emit(OpCodes.Conv_Ovf_I);
+							il.Emit(OpCodes.Conv_Ovf_I);
 					else
-            generator.Emit(OpCodes.Conv_I);
+            il.Emit(OpCodes.Conv_I);
 				else if(node.Type.Equals(typeof(sbyte)))
 					if(node.Overflow)
 						if(node.Unsigned)
-							generator.Emit(OpCodes.Conv_Ovf_I1_Un);
+							il.Emit(OpCodes.Conv_Ovf_I1_Un);
 						else
-							generator.Emit(OpCodes.Conv_Ovf_I1);
+							il.Emit(OpCodes.Conv_Ovf_I1);
 					else
-						generator.Emit(OpCodes.Conv_I1);
+						il.Emit(OpCodes.Conv_I1);
 				else if(node.Type.Equals(typeof(short)))
 					if(node.Overflow)
 						if(node.Unsigned)
-							generator.Emit(OpCodes.Conv_Ovf_I2_Un);
+							il.Emit(OpCodes.Conv_Ovf_I2_Un);
 						else
-							generator.Emit(OpCodes.Conv_Ovf_I2);
+							il.Emit(OpCodes.Conv_Ovf_I2);
 					else
-						generator.Emit(OpCodes.Conv_I2);
+						il.Emit(OpCodes.Conv_I2);
 				else if(node.Type.Equals(typeof(int)))
 					if(node.Overflow)
 						if(node.Unsigned)
-							generator.Emit(OpCodes.Conv_Ovf_I4_Un);
+							il.Emit(OpCodes.Conv_Ovf_I4_Un);
 						else
-							generator.Emit(OpCodes.Conv_Ovf_I4);
+							il.Emit(OpCodes.Conv_Ovf_I4);
 					else
-						generator.Emit(OpCodes.Conv_I4);
+						il.Emit(OpCodes.Conv_I4);
 				else if(node.Type.Equals(typeof(long)))
 					if(node.Overflow)
 						if(node.Unsigned)
-							generator.Emit(OpCodes.Conv_Ovf_I8_Un);
+							il.Emit(OpCodes.Conv_Ovf_I8_Un);
 						else
-							generator.Emit(OpCodes.Conv_Ovf_I8);
+							il.Emit(OpCodes.Conv_Ovf_I8);
 					else
-						generator.Emit(OpCodes.Conv_I8);
+						il.Emit(OpCodes.Conv_I8);
 				else if(node.Type.Equals(typeof(UIntPtr)))
 					if(node.Overflow)
 						if(node.Unsigned)
-							generator.Emit(OpCodes.Conv_Ovf_U_Un);
+							il.Emit(OpCodes.Conv_Ovf_U_Un);
 						else
-							generator.Emit(OpCodes.Conv_Ovf_U);
+							il.Emit(OpCodes.Conv_Ovf_U);
 					else
-						generator.Emit(OpCodes.Conv_U);
+						il.Emit(OpCodes.Conv_U);
 				else if(node.Type.Equals(typeof(byte)))
 					if(node.Overflow)
 						if(node.Unsigned)
-							generator.Emit(OpCodes.Conv_Ovf_U1_Un);
+							il.Emit(OpCodes.Conv_Ovf_U1_Un);
 						else
-							generator.Emit(OpCodes.Conv_Ovf_U1);
+							il.Emit(OpCodes.Conv_Ovf_U1);
 					else
-						generator.Emit(OpCodes.Conv_U1);
+						il.Emit(OpCodes.Conv_U1);
 				else if(node.Type.Equals(typeof(ushort)))
 					if(node.Overflow)
 						if(node.Unsigned)
-							generator.Emit(OpCodes.Conv_Ovf_U2_Un);
+							il.Emit(OpCodes.Conv_Ovf_U2_Un);
 						else
-							generator.Emit(OpCodes.Conv_Ovf_U2);
+							il.Emit(OpCodes.Conv_Ovf_U2);
 					else
-						generator.Emit(OpCodes.Conv_U2);
+						il.Emit(OpCodes.Conv_U2);
 				else if(node.Type.Equals(typeof(uint)))
 					if(node.Overflow)
 						if(node.Unsigned)
-							generator.Emit(OpCodes.Conv_Ovf_U4_Un);
+							il.Emit(OpCodes.Conv_Ovf_U4_Un);
 						else
-							generator.Emit(OpCodes.Conv_Ovf_U4);
+							il.Emit(OpCodes.Conv_Ovf_U4);
 					else
-						generator.Emit(OpCodes.Conv_U4);
+						il.Emit(OpCodes.Conv_U4);
 				else if(node.Type.Equals(typeof(ulong)))
 					if(node.Overflow)
 						if(node.Unsigned)
-							generator.Emit(OpCodes.Conv_Ovf_U8_Un);
+							il.Emit(OpCodes.Conv_Ovf_U8_Un);
 						else
-							generator.Emit(OpCodes.Conv_Ovf_U8);
+							il.Emit(OpCodes.Conv_Ovf_U8);
 					else
-						generator.Emit(OpCodes.Conv_U8);
+						il.Emit(OpCodes.Conv_U8);
 				else if(node.Type.Equals(typeof(float)))
 					if(node.Unsigned)
-            generator.Emit(OpCodes.Conv_R_Un);
+            il.Emit(OpCodes.Conv_R_Un);
   				else
-	  				generator.Emit(OpCodes.Conv_R4);
+	  				il.Emit(OpCodes.Conv_R4);
 				else if(node.Type.Equals(typeof(double)))
-					generator.Emit(OpCodes.Conv_R8); 
+					il.Emit(OpCodes.Conv_R8); 
 				AddTask(node.Next,null);
 			}
 
 			protected internal override void VisitCheckFinite(CheckFinite node, object data)
 			{
-				generator.Emit(OpCodes.Ckfinite);
+				il.Emit(OpCodes.Ckfinite);
 				AddTask(node.Next,null);
 			}
 
@@ -632,17 +617,14 @@ namespace CILPE.CFG
 			{
 				if(node.Alt.PrevArray.Count > 1  &&  Stack(node.Alt).Count != 0)
 				{
-          generator.Emit(OpCodes.Stloc, GetBoolVar());
+          il.EmitLocal(OpCodes.Stloc, GetBoolVar());
 					DumpStack(Stack(node.Alt));
-          generator.Emit(OpCodes.Ldloc, GetBoolVar());
+          il.EmitLocal(OpCodes.Ldloc, GetBoolVar());
 					wasDumpedFlag = true;
 					wasDumped[node.Alt] = true;
 					wasDumped[node.Next] = true;
 				}
-				//if(node.Condition)
-				generator.Emit(OpCodes.Brtrue, GetLabel(node.Alt));
-				//else
-				//	generator.Emit(OpCodes.Brfalse, GetLabel(node.Alt));
+				il.EmitBranch(OpCodes.Brtrue, GetLabel(node.Alt));
 				AddTask(node.Alt,null);
 				AddTask(node.Next,null);
 			}
@@ -658,17 +640,17 @@ namespace CILPE.CFG
 					}
 				if(shouldDump)
 				{
-					generator.Emit(OpCodes.Stloc, GetBoolVar());
+					il.EmitLocal(OpCodes.Stloc, GetBoolVar());
 					DumpStack(Stack(node.Next));
-					generator.Emit(OpCodes.Ldloc, GetBoolVar());
+					il.EmitLocal(OpCodes.Ldloc, GetBoolVar());
 					wasDumpedFlag = true;
 					for(int i=0;i<node.Count;i++)
 					  wasDumped[node[i]] = true;
 				}
-				Label[] labels = new Label[node.Count];
+				int[] labels = new int[node.Count];
 				for(int i=0;i<labels.Length;i++)
 					labels[i] = GetLabel(node[i]);
-				generator.Emit(OpCodes.Switch,labels);
+				il.EmitSwitch(labels);
 				for(int i=0;i<node.Count;i++)
 					AddTask(node[i],null);
 				AddTask(node.Next,null);
@@ -677,26 +659,26 @@ namespace CILPE.CFG
 			protected internal override void VisitLoadConst(LoadConst node, object data)
 			{
 				if(node.Constant == null)
-          generator.Emit(OpCodes.Ldnull);
+          il.Emit(OpCodes.Ldnull);
 				else if(node.Constant is string )
-					generator.Emit(OpCodes.Ldstr, node.Constant as string);
+					il.Emit(OpCodes.Ldstr, node.Constant as string);
 				else if(node.Constant is RuntimeTypeHandle)
-					generator.Emit(OpCodes.Ldtoken,  Type.GetTypeFromHandle((RuntimeTypeHandle)(node.Constant)));
+					il.Emit(OpCodes.Ldtoken,  Type.GetTypeFromHandle((RuntimeTypeHandle)(node.Constant)));
 				else if(node.Constant is RuntimeMethodHandle)
-					generator.Emit(OpCodes.Ldtoken, MethodBase.GetMethodFromHandle((RuntimeMethodHandle)(node.Constant)) as MethodInfo);
+					il.Emit(OpCodes.Ldtoken, MethodBase.GetMethodFromHandle((RuntimeMethodHandle)(node.Constant)) as MethodInfo);
 					//Andrew: Zlp!
 				else if(node.Constant is RuntimeFieldHandle)
-					generator.Emit(OpCodes.Ldtoken, FieldInfo.GetFieldFromHandle((RuntimeFieldHandle)(node.Constant)));
+					il.Emit(OpCodes.Ldtoken, FieldInfo.GetFieldFromHandle((RuntimeFieldHandle)(node.Constant)));
 				else if(node.Constant is IntPtr)
-					generator.Emit(OpCodes.Ldc_I4, (int)(IntPtr)(node.Constant)); //Andrew!!
+					il.EmitLdcI4((int)(IntPtr)(node.Constant)); //Andrew!!
 				else if(node.Constant is int)
-					generator.Emit(OpCodes.Ldc_I4, (int)(node.Constant));
+					il.EmitLdcI4((int)(node.Constant));
 				else if(node.Constant is long)
-					generator.Emit(OpCodes.Ldc_I8, (long)(node.Constant));
+					il.EmitLdcI8((long)(node.Constant));
 				else if(node.Constant is float)
-					generator.Emit(OpCodes.Ldc_R4, (float)(node.Constant));
+					il.EmitLdcR4((float)(node.Constant));
 				else if(node.Constant is double)
-					generator.Emit(OpCodes.Ldc_R8, (double)(node.Constant));
+					il.EmitLdcR8((double)(node.Constant));
 				else 
 					throw new EmissionException();
 				AddTask(node.Next,null);
@@ -708,32 +690,11 @@ namespace CILPE.CFG
 				{
 					case VariableKind.Local:
 					{
-						generator.Emit(OpCodes.Ldloc, GetLocal(node.Var));
+						il.EmitLocal(OpCodes.Ldloc, GetLocal(node.Var));
 					} break;
 					case VariableKind.Parameter:
 					{
-						int index = GetArgIndex(node.Var);
-						switch(index)
-						{
-							case 0:
-								generator.Emit(OpCodes.Ldarg_0);
-								break;
-							case 1:
-								generator.Emit(OpCodes.Ldarg_1);
-								break;
-							case 2:
-								generator.Emit(OpCodes.Ldarg_2);
-								break;
-							case 3:
-								generator.Emit(OpCodes.Ldarg_3);
-								break;
-							default:
-								if(index <= 255)
-									generator.Emit(OpCodes.Ldarg_S, (byte)index);
-								else
-									generator.Emit(OpCodes.Ldarg, index);
-								break; 
-						}
+						il.EmitArg(OpCodes.Ldarg, GetArgIndex(node.Var));
 					} break;
 					case VariableKind.ArgList:
 						throw new EmissionException(); //TODO: not supported yet
@@ -747,15 +708,11 @@ namespace CILPE.CFG
 				{
 					case VariableKind.Local:
 					{
-						generator.Emit(OpCodes.Ldloca, GetLocal(node.Var));
+						il.EmitLocal(OpCodes.Ldloca, GetLocal(node.Var));
 					} break;
 					case VariableKind.Parameter:
 					{
-						int index = GetArgIndex(node.Var);
-						if(index <= 255)
-						  generator.Emit(OpCodes.Ldarga_S, (byte)index);
-						else
-              generator.Emit(OpCodes.Ldarga, index);
+						il.EmitArg(OpCodes.Ldarga, GetArgIndex(node.Var));
 					} break;
 					case VariableKind.ArgList:
 						throw new EmissionException(); //Impossible!
@@ -769,15 +726,11 @@ namespace CILPE.CFG
 				{
 					case VariableKind.Local:
 					{
-						generator.Emit(OpCodes.Stloc, GetLocal(node.Var));
+						il.EmitLocal(OpCodes.Stloc, GetLocal(node.Var));
 					} break;
 					case VariableKind.Parameter:
 					{
-						int index = GetArgIndex(node.Var);
-						if(index <= 255)
-							generator.Emit(OpCodes.Starg_S, (byte)index);
-						else
-							generator.Emit(OpCodes.Starg, index);
+						il.EmitArg(OpCodes.Starg, GetArgIndex(node.Var));
 					} break;
 					case VariableKind.ArgList:
 						throw new EmissionException(); //Impossible!
@@ -788,108 +741,108 @@ namespace CILPE.CFG
 			protected internal override void VisitLoadIndirect(LoadIndirect node, object data)
 			{
 				if(node.Type.Equals( typeof(IntPtr) ))
-					generator.Emit(OpCodes.Ldind_I);
+					il.Emit(OpCodes.Ldind_I);
 				else if(node.Type.Equals( typeof(sbyte) ))
-					generator.Emit(OpCodes.Ldind_I1);
+					il.Emit(OpCodes.Ldind_I1);
 				else if(node.Type.Equals( typeof(short) ))
-					generator.Emit(OpCodes.Ldind_I2);
+					il.Emit(OpCodes.Ldind_I2);
 				else if(node.Type.Equals( typeof(int) ))
-					generator.Emit(OpCodes.Ldind_I4);
+					il.Emit(OpCodes.Ldind_I4);
 				else if(node.Type.Equals( typeof(long) ))
-					generator.Emit(OpCodes.Ldind_I8);
+					il.Emit(OpCodes.Ldind_I8);
 				else if(node.Type.Equals( typeof(UIntPtr) ))
-					generator.Emit(OpCodes.Ldind_I); //missing Ldind_U ... ?...
+					il.Emit(OpCodes.Ldind_I); //missing Ldind_U ... ?...
 				else if(node.Type.Equals( typeof(byte) ))
-					generator.Emit(OpCodes.Ldind_U1);
+					il.Emit(OpCodes.Ldind_U1);
 				else if(node.Type.Equals( typeof(ushort) ))
-					generator.Emit(OpCodes.Ldind_U2);
+					il.Emit(OpCodes.Ldind_U2);
 				else if(node.Type.Equals( typeof(uint) ))
-					generator.Emit(OpCodes.Ldind_U4);
+					il.Emit(OpCodes.Ldind_U4);
 				else if(node.Type.Equals( typeof(ulong) ))
-					generator.Emit(OpCodes.Ldind_I8); //missing Ldind_U8 ... ?...
+					il.Emit(OpCodes.Ldind_I8); //missing Ldind_U8 ... ?...
 				else if(node.Type.Equals( typeof(float) ))
-					generator.Emit(OpCodes.Ldind_R4);
+					il.Emit(OpCodes.Ldind_R4);
 				else if(node.Type.Equals( typeof(double) ))
-					generator.Emit(OpCodes.Ldind_R8);
+					il.Emit(OpCodes.Ldind_R8);
 				else if(node.Type.IsValueType)
 				{
 					if(node.Next is StoreIndirect && node.Next.PrevArray.Count == 1)
 					{
-						generator.Emit(OpCodes.Cpobj, node.Type);
+						il.Emit(OpCodes.Cpobj, node.Type);
 						AddTask(node.Next.Next,null);
 						return;
 					}
-					generator.Emit(OpCodes.Ldobj, node.Type);
+					il.Emit(OpCodes.Ldobj, node.Type);
 				}
 				else 
-					generator.Emit(OpCodes.Ldind_Ref);
+					il.Emit(OpCodes.Ldind_Ref);
 				AddTask(node.Next,null);
 			}
 
 			protected internal override void VisitStoreIndirect(StoreIndirect node, object data)
 			{
 				if(node.Type.Equals( typeof(IntPtr) ))
-					generator.Emit(OpCodes.Stind_I);
+					il.Emit(OpCodes.Stind_I);
 				else if(node.Type.Equals( typeof(sbyte) ))
-					generator.Emit(OpCodes.Stind_I1);
+					il.Emit(OpCodes.Stind_I1);
 				else if(node.Type.Equals( typeof(short) ))
-					generator.Emit(OpCodes.Stind_I2);
+					il.Emit(OpCodes.Stind_I2);
 				else if(node.Type.Equals( typeof(int) ))
-					generator.Emit(OpCodes.Stind_I4);
+					il.Emit(OpCodes.Stind_I4);
 				else if(node.Type.Equals( typeof(long) ))
-					generator.Emit(OpCodes.Stind_I8);
+					il.Emit(OpCodes.Stind_I8);
 				else if(node.Type.Equals( typeof(UIntPtr) ))
-					generator.Emit(OpCodes.Stind_I);
+					il.Emit(OpCodes.Stind_I);
 				else if(node.Type.Equals( typeof(byte) ))
-					generator.Emit(OpCodes.Stind_I1);
+					il.Emit(OpCodes.Stind_I1);
 				else if(node.Type.Equals( typeof(ushort) ))
-					generator.Emit(OpCodes.Stind_I2);
+					il.Emit(OpCodes.Stind_I2);
 				else if(node.Type.Equals( typeof(uint) ))
-					generator.Emit(OpCodes.Stind_I4);
+					il.Emit(OpCodes.Stind_I4);
 				else if(node.Type.Equals( typeof(ulong) ))
-					generator.Emit(OpCodes.Stind_I8);
+					il.Emit(OpCodes.Stind_I8);
 				else if(node.Type.Equals( typeof(float) ))
-					generator.Emit(OpCodes.Stind_R4);
+					il.Emit(OpCodes.Stind_R4);
 				else if(node.Type.Equals( typeof(double) ))
-					generator.Emit(OpCodes.Stind_R8);
+					il.Emit(OpCodes.Stind_R8);
 				else if(node.Type.IsValueType)
-					generator.Emit(OpCodes.Stobj, node.Type);
+					il.Emit(OpCodes.Stobj, node.Type);
 				else 
-					generator.Emit(OpCodes.Stind_Ref);
+					il.Emit(OpCodes.Stind_Ref);
 				AddTask(node.Next,null);
 			}
 
 			protected internal override void VisitDuplicateStackTop(DuplicateStackTop node, object data)
 			{
-				generator.Emit(OpCodes.Dup);
+				il.Emit(OpCodes.Dup);
 				AddTask(node.Next,null);
 			}
 
 			protected internal override void VisitRemoveStackTop(RemoveStackTop node, object data)
 			{
-				generator.Emit(OpCodes.Pop);
+				il.Emit(OpCodes.Pop);
 				AddTask(node.Next,null);
 			}
 
 			protected internal override void VisitCastClass(CastClass node, object data)
 			{
 				if(node.ThrowException)
-					generator.Emit(OpCodes.Castclass, node.Type);
+					il.Emit(OpCodes.Castclass, node.Type);
 				else
-					generator.Emit(OpCodes.Isinst, node.Type);
+					il.Emit(OpCodes.Isinst, node.Type);
 				AddTask(node.Next,null);
 			}
 
 			protected internal override void VisitCallMethod(CallMethod node, object data)
 			{
 				if(HasPseudoParameter(node))
-					generator.Emit(OpCodes.Ldnull);
+					il.Emit(OpCodes.Ldnull);
 
 				OpCode code = node.IsVirtCall ?  OpCodes.Callvirt : OpCodes.Call;
 				if(node.Method is MethodInfo)
-					generator.Emit(code,node.Method as MethodInfo);
+					il.Emit(code,node.Method as MethodInfo);
 				else
-					generator.Emit(code,node.Method as ConstructorInfo);
+					il.Emit(code,node.Method as ConstructorInfo);
 				AddTask(node.Next,null);
 			}
 
@@ -897,14 +850,14 @@ namespace CILPE.CFG
 			{
 				if(node.IsVirtual)
 				{
-					generator.Emit(OpCodes.Dup);
-          generator.Emit(OpCodes.Ldvirtftn, node.Method);
-					generator.Emit(OpCodes.Newobj, node.DelegateCtor);
+					il.Emit(OpCodes.Dup);
+          il.Emit(OpCodes.Ldvirtftn, node.Method);
+					il.Emit(OpCodes.Newobj, node.DelegateCtor);
 				}
 				else
 				{
-					generator.Emit(OpCodes.Ldftn, node.Method);
-					generator.Emit(OpCodes.Newobj, node.DelegateCtor);
+					il.Emit(OpCodes.Ldftn, node.Method);
+					il.Emit(OpCodes.Newobj, node.DelegateCtor);
 				}
 				AddTask(node.Next,null);
 			}
@@ -912,40 +865,40 @@ namespace CILPE.CFG
 			protected internal override void VisitLoadField(LoadField node, object data)
 			{
 				if(node.Field.IsStatic)
-					generator.Emit(OpCodes.Ldsfld, node.Field);
+					il.Emit(OpCodes.Ldsfld, node.Field);
 				else
-					generator.Emit(OpCodes.Ldfld, node.Field);
+					il.Emit(OpCodes.Ldfld, node.Field);
 				AddTask(node.Next,null);
 			}
 
 			protected internal override void VisitLoadFieldAddr(LoadFieldAddr node, object data)
 			{
 				if(node.Field.IsStatic)
-					generator.Emit(OpCodes.Ldsflda, node.Field);
+					il.Emit(OpCodes.Ldsflda, node.Field);
 			    else
-					generator.Emit(OpCodes.Ldflda, node.Field);
+					il.Emit(OpCodes.Ldflda, node.Field);
 				AddTask(node.Next,null);
 			}
 
 			protected internal override void VisitStoreField(StoreField node, object data)
 			{
 				if(node.Field.IsStatic)
-				    generator.Emit(OpCodes.Stsfld, node.Field);
+				    il.Emit(OpCodes.Stsfld, node.Field);
 				else
-					generator.Emit(OpCodes.Stfld, node.Field);
+					il.Emit(OpCodes.Stfld, node.Field);
 				AddTask(node.Next,null);
 			}
 
 			protected internal override void VisitThrowException(ThrowException node, object data)
 			{
 				prevHasNext = false;
-				generator.Emit(OpCodes.Throw);
+				il.Emit(OpCodes.Throw);
 			}
 
 			protected internal override void VisitRethrowException(RethrowException node, object data)
 			{
 				prevHasNext = false;
-				generator.Emit(OpCodes.Rethrow);
+				il.Emit(OpCodes.Rethrow);
 			}
 
 			private static bool HasPseudoParameter(Node node)
@@ -959,39 +912,39 @@ namespace CILPE.CFG
 			protected internal override void VisitNewObject(NewObject node, object data)
 			{
 				if(HasPseudoParameter(node))
-					generator.Emit(OpCodes.Ldnull);
-				generator.Emit(OpCodes.Newobj, node.Constructor);
+					il.Emit(OpCodes.Ldnull);
+				il.Emit(OpCodes.Newobj, node.Constructor);
 				AddTask(node.Next,null);
 			}
 
 			protected internal override void VisitLoadElement(LoadElement node, object data)
 			{
 				if(node.Type.Equals( typeof(IntPtr) ))
-					generator.Emit(OpCodes.Ldelem_I);
+					il.Emit(OpCodes.Ldelem_I);
 				else if(node.Type.Equals( typeof(sbyte) ))
-					generator.Emit(OpCodes.Ldelem_I1);
+					il.Emit(OpCodes.Ldelem_I1);
 				else if(node.Type.Equals( typeof(short) ))
-					generator.Emit(OpCodes.Ldelem_I2);
+					il.Emit(OpCodes.Ldelem_I2);
 				else if(node.Type.Equals( typeof(int) ))
-					generator.Emit(OpCodes.Ldelem_I4);
+					il.Emit(OpCodes.Ldelem_I4);
 				else if(node.Type.Equals( typeof(long) ))
-					generator.Emit(OpCodes.Ldelem_I8);
+					il.Emit(OpCodes.Ldelem_I8);
 				else if(node.Type.Equals( typeof(UIntPtr) ))
-					generator.Emit(OpCodes.Ldelem_I);
+					il.Emit(OpCodes.Ldelem_I);
 				else if(node.Type.Equals( typeof(byte) ))
-					generator.Emit(OpCodes.Ldelem_I1);
+					il.Emit(OpCodes.Ldelem_I1);
 				else if(node.Type.Equals( typeof(ushort) ))
-					generator.Emit(OpCodes.Ldelem_I2);
+					il.Emit(OpCodes.Ldelem_I2);
 				else if(node.Type.Equals( typeof(uint) ))
-					generator.Emit(OpCodes.Ldelem_I4);
+					il.Emit(OpCodes.Ldelem_I4);
 				else if(node.Type.Equals( typeof(ulong) ))
-					generator.Emit(OpCodes.Ldelem_I8);
+					il.Emit(OpCodes.Ldelem_I8);
 				else if(node.Type.Equals( typeof(float) ))
-					generator.Emit(OpCodes.Ldelem_R4);
+					il.Emit(OpCodes.Ldelem_R4);
 				else if(node.Type.Equals( typeof(double) ))
-					generator.Emit(OpCodes.Ldelem_R8);
+					il.Emit(OpCodes.Ldelem_R8);
 				else if(node.Type.Equals( typeof(object) ))
-					generator.Emit(OpCodes.Ldelem_Ref);
+					il.Emit(OpCodes.Ldelem_Ref);
 				else
 					throw new EmissionException();
 				AddTask(node.Next,null);
@@ -999,38 +952,38 @@ namespace CILPE.CFG
 
 			protected internal override void VisitLoadElementAddr(LoadElementAddr node, object data)
 			{
-				generator.Emit(OpCodes.Ldelema);
+				il.Emit(OpCodes.Ldelema, node.Type);
 				AddTask(node.Next,null);
 			}
 
 			protected internal override void VisitStoreElement(StoreElement node, object data)
 			{
 				if(node.Type.Equals( typeof(IntPtr) ))
-					generator.Emit(OpCodes.Stelem_I);
+					il.Emit(OpCodes.Stelem_I);
 				else if(node.Type.Equals( typeof(sbyte) ))
-					generator.Emit(OpCodes.Stelem_I1);
+					il.Emit(OpCodes.Stelem_I1);
 				else if(node.Type.Equals( typeof(short) ))
-					generator.Emit(OpCodes.Stelem_I2);
+					il.Emit(OpCodes.Stelem_I2);
 				else if(node.Type.Equals( typeof(int) ))
-					generator.Emit(OpCodes.Stelem_I4);
+					il.Emit(OpCodes.Stelem_I4);
 				else if(node.Type.Equals( typeof(long) ))
-					generator.Emit(OpCodes.Stelem_I8);
+					il.Emit(OpCodes.Stelem_I8);
 				else if(node.Type.Equals( typeof(UIntPtr) ))
-					generator.Emit(OpCodes.Stelem_I);
+					il.Emit(OpCodes.Stelem_I);
 				else if(node.Type.Equals( typeof(byte) ))
-					generator.Emit(OpCodes.Stelem_I1);
+					il.Emit(OpCodes.Stelem_I1);
 				else if(node.Type.Equals( typeof(ushort) ))
-					generator.Emit(OpCodes.Stelem_I2);
+					il.Emit(OpCodes.Stelem_I2);
 				else if(node.Type.Equals( typeof(uint) ))
-					generator.Emit(OpCodes.Stelem_I4);
+					il.Emit(OpCodes.Stelem_I4);
 				else if(node.Type.Equals( typeof(ulong) ))
-					generator.Emit(OpCodes.Stelem_I8);
+					il.Emit(OpCodes.Stelem_I8);
 				else if(node.Type.Equals( typeof(float) ))
-					generator.Emit(OpCodes.Stelem_R4);
+					il.Emit(OpCodes.Stelem_R4);
 				else if(node.Type.Equals( typeof(double) ))
-					generator.Emit(OpCodes.Stelem_R8);
+					il.Emit(OpCodes.Stelem_R8);
 				else if(node.Type.Equals( typeof(object) ))
-					generator.Emit(OpCodes.Stelem_Ref);
+					il.Emit(OpCodes.Stelem_Ref);
 				else
 					throw new EmissionException();
 				AddTask(node.Next,null);
@@ -1038,55 +991,55 @@ namespace CILPE.CFG
 
 			protected internal override void VisitLoadLength(LoadLength node, object data)
 			{
-				generator.Emit(OpCodes.Ldlen);
+				il.Emit(OpCodes.Ldlen);
 				AddTask(node.Next,null);
 			}
 
 			protected internal override void VisitNewArray(NewArray node, object data)
 			{
-				generator.Emit(OpCodes.Newarr, node.Type);
+				il.Emit(OpCodes.Newarr, node.Type);
 				AddTask(node.Next,null);
 			}
 
 			protected internal override void VisitBoxValue(BoxValue node, object data)
 			{
-				generator.Emit(OpCodes.Box, node.Type);
+				il.Emit(OpCodes.Box, node.Type);
 				AddTask(node.Next,null);
 			}
 
 			protected internal override void VisitUnboxValue(UnboxValue node, object data)
 			{
-				generator.Emit(OpCodes.Unbox, node.Type);
+				il.Emit(OpCodes.Unbox, node.Type);
 				AddTask(node.Next,null);
 			}
 
 			//protected internal override void VisitCopyObject(CopyObject node, object data)
 			//{
-			//	generator.Emit(OpCodes.Cpobj, node.Type);
+			//	il.Emit(OpCodes.Cpobj, node.Type);
 			//	AddTask(node.Next,null);
 			//}
 
 			protected internal override void VisitInitValue(InitValue node, object data)
 			{
-				generator.Emit(OpCodes.Initobj, node.Type);
+				il.Emit(OpCodes.Initobj, node.Type);
 				AddTask(node.Next,null);
 			}
 
 			//protected internal override void VisitLoadObject(LoadObject node, object data)
 			//{
-			//	generator.Emit(OpCodes.Ldobj, node.Type);
+			//	il.Emit(OpCodes.Ldobj, node.Type);
 			//	AddTask(node.Next,null);
 			//}
 
 			protected internal override void VisitLoadSizeOfValue(LoadSizeOfValue node, object data)
 			{
-				generator.Emit(OpCodes.Sizeof, node.Type);
+				il.Emit(OpCodes.Sizeof, node.Type);
 				AddTask(node.Next,null);
 			}
 
 			//protected internal override void VisitStoreObject(StoreObject node, object data)
 			//{
-			//	generator.Emit(OpCodes.Stobj, node.Type);
+			//	il.Emit(OpCodes.Stobj, node.Type);
 			//	AddTask(node.Next,null);
 			//}
 
@@ -1108,9 +1061,11 @@ namespace CILPE.CFG
 
 		public static void Emit(ILGenerator generator, MethodBodyBlock method)
 		{
+			ILEncoder il = new ILEncoder(generator);
 			GraphProcessor graphProcessor = new GraphProcessor();
-			EmitterVisitor visitor = new EmitterVisitor(graphProcessor, generator, method);
+			EmitterVisitor visitor = new EmitterVisitor(graphProcessor, il, method);
 			graphProcessor.Process(); 
+			il.Flush();
 		}
 	}
 }
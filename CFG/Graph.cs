@@ -323,7 +323,7 @@ namespace CILPE.CFG
             usersArray = new NodeArray();
         }
 
-        internal int Index { get { return index; } }
+        public int Index { get { return index; } }
 
         internal void addUser(ManageVar node) { usersArray.Add(node); }
 
@@ -331,7 +331,7 @@ namespace CILPE.CFG
 
         internal Variable(Type type, VariableKind kind)
         {
-            index = freeIndex++;
+            index = System.Threading.Interlocked.Increment(ref freeIndex) - 1;
 
             this.type = type;
             this.kind = kind;
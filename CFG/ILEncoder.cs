@@ -0,0 +1,537 @@
+
+// ===========================================================================
+// CILPE - Partial Evaluator for Common Intermediate Language
+// ===========================================================================
+// File:
+//     ILEncoder.cs
+//
+// Description:
+//     Buffered IL encoding with branch shortening.
+//
+// Author:
+//     Andrei Mishchenko
+// ===========================================================================
+
+
+
+using System;
+using System.Reflection;
+using System.Reflection.Emit;
+using System.Collections;
+
+
+namespace CILPE.CFG
+{
+	/// <summary>
+	/// Collects IL instructions of one method in a growable buffer instead of
+	/// sending them to ILGenerator one by one. Local, argument and constant
+	/// instructions get their shortest encoding when they are appended;
+	/// branches are relaxed by Flush() once the whole method is known,
+	/// so only the branches that really need 32-bit offsets stay long.
+	/// Labels are plain integers and exist only for branch targets.
+	/// </summary>
+	internal class ILEncoder
+	{
+		//Instruction kinds
+		private const byte INSTRUCTION = 0;
+		private const byte BRANCH = 1;
+		private const byte BEGIN_TRY = 2;
+		private const byte BEGIN_CATCH = 3;
+		private const byte BEGIN_FINALLY = 4;
+		private const byte END_TRY = 5;
+
+		//Upper bounds of the code ILGenerator inserts for exception blocks:
+		//BeginCatchBlock emits 'leave', BeginFinallyBlock up to two 'leave's,
+		//EndExceptionBlock either 'leave' or 'endfinally'.
+		//Overestimation only makes the relaxation more conservative.
+		private const int BEGIN_CATCH_SIZE = 5;
+		private const int BEGIN_FINALLY_SIZE = 10;
+		private const int END_TRY_SIZE = 5;
+
+		private const int INITIAL_CAPACITY = 64;
+
+		private static readonly OpCode[] longBranches = new OpCode[]
+		{
+			OpCodes.Br, OpCodes.Brtrue, OpCodes.Brfalse,
+			OpCodes.Beq, OpCodes.Bne_Un,
+			OpCodes.Bge, OpCodes.Bge_Un, OpCodes.Bgt, OpCodes.Bgt_Un,
+			OpCodes.Ble, OpCodes.Ble_Un, OpCodes.Blt, OpCodes.Blt_Un,
+			OpCodes.Leave
+		};
+
+		private static readonly OpCode[] shortBranches = new OpCode[]
+		{
+			OpCodes.Br_S, OpCodes.Brtrue_S, OpCodes.Brfalse_S,
+			OpCodes.Beq_S, OpCodes.Bne_Un_S,
+			OpCodes.Bge_S, OpCodes.Bge_Un_S, OpCodes.Bgt_S, OpCodes.Bgt_Un_S,
+			OpCodes.Ble_S, OpCodes.Ble_Un_S, OpCodes.Blt_S, OpCodes.Blt_Un_S,
+			OpCodes.Leave_S
+		};
+
+		private ILGenerator generator;
+
+		private byte[] kinds;
+		private OpCode[] codes;
+		private int[] args;     //label, local/argument index, integer immediate
+		private object[] refs;  //metadata, string, boxed long/float/double, int[] for switch
+		private int count;
+
+		private ArrayList locals; //index -> LocalBuilder mapping
+		private int[] labelPositions; //label -> instruction index mapping, -1 if not marked yet
+		private int labelCount;
+
+		public ILEncoder(ILGenerator generator)
+		{
+			this.generator = generator;
+			kinds = new byte[INITIAL_CAPACITY];
+			codes = new OpCode[INITIAL_CAPACITY];
+			args = new int[INITIAL_CAPACITY];
+			refs = new object[INITIAL_CAPACITY];
+			count = 0;
+			locals = new ArrayList();
+			labelPositions = new int[INITIAL_CAPACITY];
+			labelCount = 0;
+		}
+
+		#region Buffer management
+
+		private void Grow()
+		{
+			int capacity = kinds.Length * 2;
+
+			byte[] newKinds = new byte[capacity];
+			Array.Copy(kinds, newKinds, count);
+			kinds = newKinds;
+
+			OpCode[] newCodes = new OpCode[capacity];
+			Array.Copy(codes, newCodes, count);
+			codes = newCodes;
+
+			int[] newArgs = new int[capacity];
+			Array.Copy(args, newArgs, count);
+			args = newArgs;
+
+			object[] newRefs = new object[capacity];
+			Array.Copy(refs, newRefs, count);
+			refs = newRefs;
+		}
+
+		private void Append(byte kind, OpCode code, int arg, object operand)
+		{
+			if(count == kinds.Length)
+				Grow();
+			kinds[count] = kind;
+			codes[count] = code;
+			args[count] = arg;
+			refs[count] = operand;
+			count++;
+		}
+
+		/// <summary>Index of the next instruction to be appended.</summary>
+		public int Position
+		{
+			get { return(count); }
+		}
+
+		#endregion
+
+		#region Locals and labels
+
+		public int DeclareLocal(Type type)
+		{
+			locals.Add(generator.DeclareLocal(type));
+			return(locals.Count - 1);
+		}
+
+		public int DefineLabel()
+		{
+			if(labelCount == labelPositions.Length)
+			{
+				int[] newPositions = new int[labelCount * 2];
+				Array.Copy(labelPositions, newPositions, labelCount);
+				labelPositions = newPositions;
+			}
+			labelPositions[labelCount] = -1;
+			return(labelCount++);
+		}
+
+		public void MarkLabel(int label)
+		{
+			MarkLabel(label, count);
+		}
+
+		/// <summary>
+		/// Marks label at an already emitted instruction, it is used for
+		/// backward branches to the nodes that had no label when they were emitted.
+		/// </summary>
+		public void MarkLabel(int label, int position)
+		{
+			if(labelPositions[label] != -1)
+				throw new EmissionException();
+			labelPositions[label] = position;
+		}
+
+		#endregion
+
+		#region Instructions
+
+		public void Emit(OpCode code)
+		{
+			Append(INSTRUCTION, code, 0, null);
+		}
+
+		/// <summary>
+		/// Instructions with a metadata or string operand: Type, FieldInfo,
+		/// MethodInfo, ConstructorInfo or string.
+		/// </summary>
+		public void Emit(OpCode code, object operand)
+		{
+			if(operand == null)
+				throw new EmissionException();
+			Append(INSTRUCTION, code, 0, operand);
+		}
+
+		public void EmitLdcI4(int val)
+		{
+			switch(val)
+			{
+				case -1: Emit(OpCodes.Ldc_I4_M1); return;
+				case 0: Emit(OpCodes.Ldc_I4_0); return;
+				case 1: Emit(OpCodes.Ldc_I4_1); return;
+				case 2: Emit(OpCodes.Ldc_I4_2); return;
+				case 3: Emit(OpCodes.Ldc_I4_3); return;
+				case 4: Emit(OpCodes.Ldc_I4_4); return;
+				case 5: Emit(OpCodes.Ldc_I4_5); return;
+				case 6: Emit(OpCodes.Ldc_I4_6); return;
+				case 7: Emit(OpCodes.Ldc_I4_7); return;
+				case 8: Emit(OpCodes.Ldc_I4_8); return;
+			}
+			if(val >= sbyte.MinValue && val <= sbyte.MaxValue)
+				Append(INSTRUCTION, OpCodes.Ldc_I4_S, val, null);
+			else
+				Append(INSTRUCTION, OpCodes.Ldc_I4, val, null);
+		}
+
+		public void EmitLdcI8(long val)
+		{
+			if(val >= int.MinValue && val <= int.MaxValue)
+			{
+				EmitLdcI4((int)val);
+				Emit(OpCodes.Conv_I8);
+			}
+			else
+				Append(INSTRUCTION, OpCodes.Ldc_I8, 0, val);
+		}
+
+		public void EmitLdcR4(float val)
+		{
+			Append(INSTRUCTION, OpCodes.Ldc_R4, 0, val);
+		}
+
+		public void EmitLdcR8(double val)
+		{
+			Append(INSTRUCTION, OpCodes.Ldc_R8, 0, val);
+		}
+
+		/// <summary>Code is one of Ldloc, Stloc, Ldloca.</summary>
+		public void EmitLocal(OpCode code, int index)
+		{
+			LocalBuilder local = locals[index] as LocalBuilder;
+			if(code.Equals(OpCodes.Ldloc))
+			{
+				switch(index)
+				{
+					case 0: Emit(OpCodes.Ldloc_0); return;
+					case 1: Emit(OpCodes.Ldloc_1); return;
+					case 2: Emit(OpCodes.Ldloc_2); return;
+					case 3: Emit(OpCodes.Ldloc_3); return;
+				}
+				code = index <= byte.MaxValue ? OpCodes.Ldloc_S : OpCodes.Ldloc;
+			}
+			else if(code.Equals(OpCodes.Stloc))
+			{
+				switch(index)
+				{
+					case 0: Emit(OpCodes.Stloc_0); return;
+					case 1: Emit(OpCodes.Stloc_1); return;
+					case 2: Emit(OpCodes.Stloc_2); return;
+					case 3: Emit(OpCodes.Stloc_3); return;
+				}
+				code = index <= byte.MaxValue ? OpCodes.Stloc_S : OpCodes.Stloc;
+			}
+			else if(code.Equals(OpCodes.Ldloca))
+				code = index <= byte.MaxValue ? OpCodes.Ldloca_S : OpCodes.Ldloca;
+			else
+				throw new EmissionException();
+			Append(INSTRUCTION, code, index, local);
+		}
+
+		/// <summary>Code is one of Ldarg, Starg, Ldarga.</summary>
+		public void EmitArg(OpCode code, int index)
+		{
+			if(code.Equals(OpCodes.Ldarg))
+			{
+				switch(index)
+				{
+					case 0: Emit(OpCodes.Ldarg_0); return;
+					case 1: Emit(OpCodes.Ldarg_1); return;
+					case 2: Emit(OpCodes.Ldarg_2); return;
+					case 3: Emit(OpCodes.Ldarg_3); return;
+				}
+				code = index <= byte.MaxValue ? OpCodes.Ldarg_S : OpCodes.Ldarg;
+			}
+			else if(code.Equals(OpCodes.Starg))
+				code = index <= byte.MaxValue ? OpCodes.Starg_S : OpCodes.Starg;
+			else if(code.Equals(OpCodes.Ldarga))
+				code = index <= byte.MaxValue ? OpCodes.Ldarga_S : OpCodes.Ldarga;
+			else
+				throw new EmissionException();
+			Append(INSTRUCTION, code, index, null);
+		}
+
+		/// <summary>Code is the long form of a conditional or unconditional branch, or Leave.</summary>
+		public void EmitBranch(OpCode code, int label)
+		{
+			if(ShortBranch(code) < 0)
+				throw new EmissionException();
+			Append(BRANCH, code, label, null);
+		}
+
+		public void EmitSwitch(int[] labels)
+		{
+			Append(INSTRUCTION, OpCodes.Switch, 0, labels);
+		}
+
+		public void BeginExceptionBlock()
+		{
+			Append(BEGIN_TRY, OpCodes.Nop, 0, null);
+		}
+
+		public void BeginCatchBlock(Type type)
+		{
+			Append(BEGIN_CATCH, OpCodes.Nop, 0, type);
+		}
+
+		public void BeginFinallyBlock()
+		{
+			Append(BEGIN_FINALLY, OpCodes.Nop, 0, null);
+		}
+
+		public void EndExceptionBlock()
+		{
+			Append(END_TRY, OpCodes.Nop, 0, null);
+		}
+
+		#endregion
+
+		#region Relaxation
+
+		private static int ShortBranch(OpCode code)
+		{
+			for(int i=0; i<longBranches.Length; i++)
+				if(longBranches[i].Equals(code))
+					return(i);
+			return(-1);
+		}
+
+		private static int OperandSize(OpCode code, object operand)
+		{
+			switch(code.OperandType)
+			{
+				case OperandType.InlineNone:
+					return(0);
+				case OperandType.ShortInlineBrTarget:
+				case OperandType.ShortInlineI:
+				case OperandType.ShortInlineVar:
+					return(1);
+				case OperandType.InlineVar:
+					return(2);
+				case OperandType.InlineI8:
+				case OperandType.InlineR:
+					return(8);
+				case OperandType.InlineSwitch:
+					return(4 + 4*(operand as int[]).Length);
+				default:
+					return(4);
+			}
+		}
+
+		private int Size(int i, bool isLong)
+		{
+			switch(kinds[i])
+			{
+				case INSTRUCTION:
+					return(codes[i].Size + OperandSize(codes[i], refs[i]));
+				case BRANCH:
+					return(isLong ? codes[i].Size + 4 : 2);
+				case BEGIN_CATCH:
+					return(BEGIN_CATCH_SIZE);
+				case BEGIN_FINALLY:
+					return(BEGIN_FINALLY_SIZE);
+				case END_TRY:
+					return(END_TRY_SIZE);
+				default:
+					return(0);
+			}
+		}
+
+		/// <summary>
+		/// Starts with all branches short and widens those that do not reach
+		/// their targets until nothing changes. Sizes only grow, so it terminates.
+		/// </summary>
+		private bool[] Relax()
+		{
+			bool[] isLong = new bool[count];
+			int[] offsets = new int[count + 1];
+			bool changed;
+			do
+			{
+				int offset = 0;
+				for(int i=0; i<count; i++)
+				{
+					offsets[i] = offset;
+					offset += Size(i, isLong[i]);
+				}
+				offsets[count] = offset;
+
+				changed = false;
+				for(int i=0; i<count; i++)
+				{
+					if(kinds[i] != BRANCH || isLong[i])
+						continue;
+					int position = labelPositions[args[i]];
+					if(position < 0)
+						throw new EmissionException();
+					int displacement = offsets[position] - (offsets[i] + 2);
+					if(displacement < sbyte.MinValue || displacement > sbyte.MaxValue)
+					{
+						isLong[i] = true;
+						changed = true;
+					}
+				}
+			}
+			while(changed);
+			return(isLong);
+		}
+
+		#endregion
+
+		#region Flushing
+
+		private void EmitInstruction(int i, Label[] labels)
+		{
+			OpCode code = codes[i];
+			object operand = refs[i];
+			switch(code.OperandType)
+			{
+				case OperandType.InlineNone:
+					generator.Emit(code);
+					break;
+				case OperandType.ShortInlineI:
+					generator.Emit(code, (sbyte)args[i]);
+					break;
+				case OperandType.InlineI:
+					generator.Emit(code, args[i]);
+					break;
+				case OperandType.InlineI8:
+					generator.Emit(code, (long)operand);
+					break;
+				case OperandType.ShortInlineR:
+					generator.Emit(code, (float)operand);
+					break;
+				case OperandType.InlineR:
+					generator.Emit(code, (double)operand);
+					break;
+				case OperandType.ShortInlineVar:
+					if(operand != null)
+						generator.Emit(code, operand as LocalBuilder);
+					else
+						generator.Emit(code, (byte)args[i]);
+					break;
+				case OperandType.InlineVar:
+					if(operand != null)
+						generator.Emit(code, operand as LocalBuilder);
+					else
+						generator.Emit(code, (short)args[i]);
+					break;
+				case OperandType.InlineString:
+					generator.Emit(code, operand as string);
+					break;
+				case OperandType.InlineSwitch:
+				{
+					int[] targets = operand as int[];
+					Label[] switchLabels = new Label[targets.Length];
+					for(int j=0; j<targets.Length; j++)
+						switchLabels[j] = labels[targets[j]];
+					generator.Emit(code, switchLabels);
+				} break;
+				default:
+					if(operand is Type)
+						generator.Emit(code, operand as Type);
+					else if(operand is MethodInfo)
+						generator.Emit(code, operand as MethodInfo);
+					else if(operand is ConstructorInfo)
+						generator.Emit(code, operand as ConstructorInfo);
+					else if(operand is FieldInfo)
+						generator.Emit(code, operand as FieldInfo);
+					else
+						throw new EmissionException();
+					break;
+			}
+		}
+
+		/// <summary>
+		/// Relaxes branches and passes the whole buffer to ILGenerator.
+		/// </summary>
+		public void Flush()
+		{
+			bool[] isLong = Relax();
+
+			Label[] labels = new Label[labelCount];
+			int[] order = new int[labelCount];
+			int[] positions = new int[labelCount];
+			for(int l=0; l<labelCount; l++)
+			{
+				labels[l] = generator.DefineLabel();
+				order[l] = l;
+				positions[l] = labelPositions[l];
+			}
+			Array.Sort(positions, order);
+
+			int nextLabel = 0;
+			for(int i=0; i<count; i++)
+			{
+				while(nextLabel < labelCount && positions[nextLabel] == i)
+					generator.MarkLabel(labels[order[nextLabel++]]);
+
+				switch(kinds[i])
+				{
+					case INSTRUCTION:
+						EmitInstruction(i, labels);
+						break;
+					case BRANCH:
+					{
+						OpCode code = isLong[i] ? codes[i] : shortBranches[ShortBranch(codes[i])];
+						generator.Emit(code, labels[args[i]]);
+					} break;
+					case BEGIN_TRY:
+						generator.BeginExceptionBlock();
+						break;
+					case BEGIN_CATCH:
+						generator.BeginCatchBlock(refs[i] as Type);
+						break;
+					case BEGIN_FINALLY:
+						generator.BeginFinallyBlock();
+						break;
+					case END_TRY:
+						generator.EndExceptionBlock();
+						break;
+				}
+			}
+			while(nextLabel < labelCount)
+				generator.MarkLabel(labels[order[nextLabel++]]);
+		}
+
+		#endregion
+	}
+}
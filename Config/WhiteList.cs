@@ -35,6 +35,8 @@ namespace CILPE.Config
 
         public void AddMethod(MethodBase method) { methods.Add(method,true); }
 
+        public ICollection GetMethods() { return methods.Keys; }
+
         public void AddMethod(string className, string methodName, string[] paramTypes)
         {
             Type type = Type.GetType(className);
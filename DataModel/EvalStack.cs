@@ -229,14 +229,35 @@ namespace CILPE.DataModel
                     parameters[i-pos] = p;
             }
 
+            /* Compiled invoker is used only if it needs no conversions */
+            MethodInvoker invoker = Invokers.GetInvoker(method);
+            if (invoker != null && ! method.IsStatic && ! method.DeclaringType.IsInstanceOfType(obj))
+                invoker = null;
+            if (invoker != null && ! Invokers.CanInvoke(types,parameters))
+                invoker = null;
+
             object retVal = null;
-            try
+            if (invoker != null)
             {
-                retVal = method.Invoke(obj,parameters);
+                try
+                {
+                    retVal = invoker.Invoke(obj,parameters);
+                }
+                catch (Exception e)
+                {
+                    exc = e;
+                }
             }
-            catch (Exception e)
+            else
             {
-                exc = e.InnerException;
+                try
+                {
+                    retVal = method.Invoke(obj,parameters);
+                }
+                catch (Exception e)
+                {
+                    exc = e.InnerException;
+                }
             }
 
             Value result = null;
@@ -277,13 +298,231 @@ namespace CILPE.DataModel
     {
         #region Private and internal members
 
-        /* Internal representation of the stack */
-        private ArrayList stack;
+        /* Internal representation of the stack. Every slot has a tag:
+         * values of primitive stack types (int32, int64, native int and
+         * float64) are kept unboxed in bits or reals, any other value is
+         * kept in values. Primitive arithmetic works on the unboxed slots,
+         * StructValue objects are created only when a primitive value
+         * leaves the stack through Pop() or the indexer.
+         */
+        private const StructValue.TypeIndex VALUE_SLOT = StructValue.TypeIndex.INVALID;
+        private const int INITIAL_CAPACITY = 16;
+
+        private StructValue.TypeIndex[] tags;
+        private long[] bits;    /* int32, int64 and native int slots */
+        private double[] reals; /* float64 slots */
+        private Value[] values; /* slots with other values, null for primitive slots */
+        private int count;
+
+        /* Reserves a new slot at the top of the stack */
+        private int allocSlot()
+        {
+            if (count == tags.Length)
+            {
+                int capacity = 2*count;
+
+                StructValue.TypeIndex[] newTags = new StructValue.TypeIndex[capacity];
+                Array.Copy(tags,newTags,count);
+                tags = newTags;
+
+                long[] newBits = new long[capacity];
+                Array.Copy(bits,newBits,count);
+                bits = newBits;
+
+                double[] newReals = new double[capacity];
+                Array.Copy(reals,newReals,count);
+                reals = newReals;
+
+                Value[] newValues = new Value[capacity];
+                Array.Copy(values,newValues,count);
+                values = newValues;
+            }
+
+            return count++;
+        }
+
+        /* Removes the slot at the top of the stack */
+        private void removeTop()
+        {
+            count--;
+            values[count] = null;
+        }
+
+        private void pushBits(StructValue.TypeIndex tag, long val)
+        {
+            int slot = allocSlot();
+            tags[slot] = tag;
+            bits[slot] = val;
+        }
+
+        private void pushReal(double val)
+        {
+            int slot = allocSlot();
+            tags[slot] = StructValue.TypeIndex.FLOAT64;
+            reals[slot] = val;
+        }
+
+        /* Inserts a value at the top of the stack as is, 
+         * primitive values are not unboxed
+         */
+        private void pushValue(Value val)
+        {
+            int slot = allocSlot();
+            tags[slot] = VALUE_SLOT;
+            values[slot] = val;
+        }
+
+        /* Native int slots keep the value sign-extended to 64 bits */
+        private static long unsignedNativeToBits(UIntPtr val)
+        {
+            ulong bitsVal = val.ToUInt64();
+            return unchecked((IntPtr.Size == 4) ? (long)(int)(uint)bitsVal : (long)bitsVal);
+        }
+
+        /* Stores primitive value to the slot converting it to the stack type
+         * (the same conversion as DataModelUtils.ToStack performs)
+         */
+        private void storePrimitive(int slot, ValueType obj, StructValue.TypeIndex typeIndex)
+        {
+            values[slot] = null;
+
+            switch (typeIndex)
+            {
+                case StructValue.TypeIndex.INT32:
+                    tags[slot] = StructValue.TypeIndex.INT32;
+                    bits[slot] = (Int32)obj;
+                    break;
+
+                case StructValue.TypeIndex.INT64:
+                    tags[slot] = StructValue.TypeIndex.INT64;
+                    bits[slot] = (Int64)obj;
+                    break;
+
+                case StructValue.TypeIndex.NATIVEINT:
+                    tags[slot] = StructValue.TypeIndex.NATIVEINT;
+                    bits[slot] = ((IntPtr)obj).ToInt64();
+                    break;
+
+                case StructValue.TypeIndex.FLOAT64:
+                    tags[slot] = StructValue.TypeIndex.FLOAT64;
+                    reals[slot] = (Double)obj;
+                    break;
+
+                case StructValue.TypeIndex.INT8:
+                    tags[slot] = StructValue.TypeIndex.INT32;
+                    bits[slot] = (SByte)obj;
+                    break;
+
+                case StructValue.TypeIndex.UINT8:
+                    tags[slot] = StructValue.TypeIndex.INT32;
+                    bits[slot] = (Byte)obj;
+                    break;
+
+                case StructValue.TypeIndex.INT16:
+                    tags[slot] = StructValue.TypeIndex.INT32;
+                    bits[slot] = (Int16)obj;
+                    break;
+
+                case StructValue.TypeIndex.UINT16:
+                    tags[slot] = StructValue.TypeIndex.INT32;
+                    bits[slot] = (UInt16)obj;
+                    break;
+
+                case StructValue.TypeIndex.UINT32:
+                    tags[slot] = StructValue.TypeIndex.INT32;
+                    bits[slot] = unchecked((Int32)(UInt32)obj);
+                    break;
+
+                case StructValue.TypeIndex.UINT64:
+                    tags[slot] = StructValue.TypeIndex.INT64;
+                    bits[slot] = unchecked((Int64)(UInt64)obj);
+                    break;
+
+                case StructValue.TypeIndex.UNATIVEINT:
+                    tags[slot] = StructValue.TypeIndex.NATIVEINT;
+                    bits[slot] = unsignedNativeToBits((UIntPtr)obj);
+                    break;
+
+                case StructValue.TypeIndex.FLOAT32:
+                    tags[slot] = StructValue.TypeIndex.FLOAT64;
+                    reals[slot] = (Single)obj;
+                    break;
+
+                case StructValue.TypeIndex.BOOL:
+                    tags[slot] = StructValue.TypeIndex.INT32;
+                    bits[slot] = (Boolean)obj ? 1 : 0;
+                    break;
+
+                case StructValue.TypeIndex.CHAR:
+                    tags[slot] = StructValue.TypeIndex.INT32;
+                    bits[slot] = (Char)obj;
+                    break;
+
+                default:
+                    throw new InvalidOperandException();
+            }
+        }
+
+        /* Stores a value to the slot 
+         * (without conversion of non-primitive data)
+         */
+        private void store(int slot, Value val)
+        {
+            StructValue structVal = val as StructValue;
+
+            if (structVal != null && structVal.IsPrimitive)
+                storePrimitive(slot,structVal.Obj,structVal.getTypeIndex());
+            else
+            {
+                tags[slot] = VALUE_SLOT;
+                values[slot] = val;
+            }
+        }
 
         /* Inserts a value at the top of the stack
-         * (without conversion of primitive data)
+         * (without conversion of non-primitive data)
          */
-        private void push(Value val) { stack.Add(val); }
+        private void push(Value val) { store(allocSlot(),val); }
+
+        /* Returns the value kept in the slot, 
+         * a new StructValue is created for a primitive slot
+         */
+        private Value valueAt(int slot)
+        {
+            Value result;
+
+            switch (tags[slot])
+            {
+                case StructValue.TypeIndex.INT32:
+                    result = new StructValue((Int32)bits[slot]);
+                    break;
+
+                case StructValue.TypeIndex.INT64:
+                    result = new StructValue(bits[slot]);
+                    break;
+
+                case StructValue.TypeIndex.NATIVEINT:
+                    result = new StructValue(new IntPtr(bits[slot]));
+                    break;
+
+                case StructValue.TypeIndex.FLOAT64:
+                    result = new StructValue(reals[slot]);
+                    break;
+
+                default:
+                    result = values[slot];
+                    break;
+            }
+
+            return result;
+        }
+
+        private static bool isIntegerSlot(StructValue.TypeIndex tag)
+        {
+            return tag == StructValue.TypeIndex.INT32 ||
+                tag == StructValue.TypeIndex.INT64 ||
+                tag == StructValue.TypeIndex.NATIVEINT;
+        }
 
         /* Categories of binary operations */
         private enum OpCategory
@@ -344,6 +583,18 @@ namespace CILPE.DataModel
 
         int popArrayIndex()
         {
+            if (count > 0 && tags[count-1] != VALUE_SLOT)
+            {
+                int top = count-1;
+                if (tags[top] != StructValue.TypeIndex.INT32 && 
+                    tags[top] != StructValue.TypeIndex.NATIVEINT)
+                    throw new InvalidOperandException();
+
+                int result = (int)bits[top];
+                removeTop();
+                return result;
+            }
+
             Value indexVal = Pop();
             if (! (indexVal is StructValue && (indexVal as StructValue).IsPrimitive))
                 throw new InvalidOperandException();
@@ -400,6 +651,58 @@ namespace CILPE.DataModel
             return type1 == type2;
         }
 
+        /* Returns the kernel cached in the node options 
+         * if it suits the operand types
+         */
+        private static Kernel cachedKernel(Node node, StructValue.TypeIndex typeA, 
+            StructValue.TypeIndex typeB)
+        {
+            Kernel kernel = node.Options[Kernels.KERNEL_OPTION] as Kernel;
+
+            if (kernel != null && kernel.TypeA == typeA && kernel.TypeB == typeB)
+                return kernel;
+
+            return null;
+        }
+
+        /* Applies kernel of unary operation or conversion to the stack top */
+        private void applyUnaryKernel(Kernel kernel, out Exception exc)
+        {
+            exc = null;
+            int top = count-1;
+
+            try
+            {
+                kernel.Method(bits,reals,top,top);
+                tags[top] = kernel.ResultType;
+            }
+            catch (ArithmeticException e)
+            {
+                exc = e;
+                removeTop();
+            }
+        }
+
+        /* Applies kernel of binary operation to two values on top of the stack */
+        private void applyBinaryKernel(Kernel kernel, out Exception exc)
+        {
+            exc = null;
+            int a = count-2, b = count-1;
+
+            try
+            {
+                kernel.Method(bits,reals,a,b);
+                tags[a] = kernel.ResultType;
+                removeTop();
+            }
+            catch (ArithmeticException e)
+            {
+                exc = e;
+                removeTop();
+                removeTop();
+            }
+        }
+
         #endregion
 
         // ================================================================
@@ -409,53 +712,101 @@ namespace CILPE.DataModel
         /* Creates new instance of EvaluationStack class */
         public EvaluationStack()
         {
-            stack = new ArrayList();
+            tags = new StructValue.TypeIndex[INITIAL_CAPACITY];
+            bits = new long[INITIAL_CAPACITY];
+            reals = new double[INITIAL_CAPACITY];
+            values = new Value[INITIAL_CAPACITY];
+            count = 0;
         }
 
         /* Gets the number of values contained in the stack */
-        public int Count { get { return stack.Count; } }
+        public int Count { get { return count; } }
 
         /* Removes all values from the stack */
-        public void Clear() { stack.Clear(); }
+        public void Clear() 
+        { 
+            Array.Clear(values,0,count);
+            count = 0;
+        }
 
         /* Returns the value at the top of the stack without removing it */
         public Value this [int depth] 
         {
             get
             {
-                if (stack.Count == 0)
+                if (count == 0)
                     throw new EmptyStackException();
 
-                return stack[stack.Count-1-depth] as Value; 
+                return valueAt(count-1-depth); 
             }
 
             set
             {
-                if (stack.Count == 0)
+                if (count == 0)
                     throw new EmptyStackException();
 
-                stack[stack.Count-1-depth] = value.ToStack();
+                StructValue structVal = value as StructValue;
+                store(count-1-depth, 
+                    (structVal != null && structVal.IsPrimitive) ? value : value.ToStack());
             }
         }
 
         /* Removes and returns the value at the top of the stack */
         public Value Pop()
         {
-            if (stack.Count == 0)
+            if (count == 0)
                 throw new EmptyStackException();
 
-            Value result = this[0];
-            stack.RemoveAt(stack.Count-1);
+            Value result = valueAt(count-1);
+            removeTop();
+            return result; 
+        }
+
+        /* Removes the value at the top of the stack and returns its copy
+         * (primitive values are created anew, so they are not copied twice)
+         */
+        public Value PopCopy()
+        {
+            if (count == 0)
+                throw new EmptyStackException();
+
+            int top = count-1;
+            Value result = (tags[top] == VALUE_SLOT) ? values[top].MakeCopy() : valueAt(top);
+            removeTop();
             return result; 
         }
 
         public void RemoveAt (int depth)
         {
-            stack.RemoveAt(stack.Count-1-depth);
+            int slot = count-1-depth;
+            int tail = count-1-slot;
+
+            Array.Copy(tags,slot+1,tags,slot,tail);
+            Array.Copy(bits,slot+1,bits,slot,tail);
+            Array.Copy(reals,slot+1,reals,slot,tail);
+            Array.Copy(values,slot+1,values,slot,tail);
+            removeTop();
         }
 
         /* Inserts a value at the top of the stack */
-        public void Push(Value val) { push(val.ToStack()); }
+        public void Push(Value val) 
+        { 
+            StructValue structVal = val as StructValue;
+            push((structVal != null && structVal.IsPrimitive) ? val : val.ToStack()); 
+        }
+
+        /* Inserts a copy of the value at the top of the stack
+         * (primitive values are unboxed, so they need no copying)
+         */
+        public void PushCopy(Value val)
+        {
+            StructValue structVal = val as StructValue;
+
+            if (structVal != null && structVal.IsPrimitive)
+                push(val);
+            else
+                Push(val.MakeCopy());
+        }
 
         public override string ToString()
         {
@@ -466,8 +817,8 @@ namespace CILPE.DataModel
         {
             string result = "";
 
-            foreach (Value val in stack)
-                result += ", " + val.ToString(format,formatProvider);
+            for (int i = 0; i < count; i++)
+                result += ", " + valueAt(i).ToString(format,formatProvider);
 
             if (result.Length == 0)
                 result = "EvaluationStack: []";
@@ -486,8 +837,19 @@ namespace CILPE.DataModel
          */
         public void Perform_DuplicateStackTop()
         {
-            Value top = this[0];
-            push(top.MakeCopy());
+            if (count == 0)
+                throw new EmptyStackException();
+
+            int top = count-1;
+            if (tags[top] == VALUE_SLOT)
+                push(values[top].MakeCopy());
+            else
+            {
+                int slot = allocSlot();
+                tags[slot] = tags[top];
+                bits[slot] = bits[top];
+                reals[slot] = reals[top];
+            }
         }
 
         /* Removes stack top 
@@ -505,14 +867,17 @@ namespace CILPE.DataModel
                 push(new NullValue());
             else if (obj is string)
                 push(new ObjectReferenceValue(obj));
+            else if (obj is Int32)
+                pushBits(StructValue.TypeIndex.INT32,(Int32)obj);
+            else if (obj is Int64)
+                pushBits(StructValue.TypeIndex.INT64,(Int64)obj);
+            else if (obj is Double)
+                pushReal((Double)obj);
             else
             {
                 Type type = obj.GetType();
 
-                if (type == typeof(Int32) ||
-                    type == typeof(Int64) ||
-                    type == typeof(Double) ||
-                    type == typeof(RuntimeTypeHandle) || 
+                if (type == typeof(RuntimeTypeHandle) || 
                     type == typeof(RuntimeMethodHandle) ||
                     type == typeof(RuntimeFieldHandle))
                     push(new StructValue(obj as ValueType));
@@ -526,6 +891,14 @@ namespace CILPE.DataModel
          */
         public void Perform_UnaryOp(UnaryOp.ArithOp op)
         {
+            Kernel kernel = (count > 0) ? Kernels.GetUnaryKernel(op,tags[count-1]) : null;
+            if (kernel != null)
+            {
+                Exception exc;
+                applyUnaryKernel(kernel,out exc);
+                return;
+            }
+
             Value val = Pop();
             ValueType res = null;
             
@@ -558,6 +931,15 @@ namespace CILPE.DataModel
             if (category == OpCategory.InvalidOp)
                 throw new InvalidBinaryOpException();
 
+            /* Unboxed operands are processed by the kernel for their types */
+            Kernel kernel = (count >= 2) ? 
+                Kernels.GetBinaryKernel(op,overflow,unsigned,tags[count-2],tags[count-1]) : null;
+            if (kernel != null)
+            {
+                applyBinaryKernel(kernel,out exc);
+                return;
+            }
+
             /* Getting operands from stack */
             Value val1, val2;
             val2 = Pop();
@@ -675,6 +1057,14 @@ namespace CILPE.DataModel
         public void Perform_ConvertValue(Type type, bool overflow, bool unsigned,
             out Exception exc)
         {
+            Kernel kernel = (count > 0) ? 
+                Kernels.GetConvertKernel(StructValue.getTypeIndex(type),overflow,unsigned,tags[count-1]) : null;
+            if (kernel != null)
+            {
+                applyUnaryKernel(kernel,out exc);
+                return;
+            }
+
             exc = null;
             Value val = Pop();
 
@@ -703,6 +1093,82 @@ namespace CILPE.DataModel
                 push(new StructValue(res as ValueType));
         }
 
+        /* Performs unary operation of the node. The kernel chosen for
+         * the operand type is cached in the node options
+         */
+        public void Perform_UnaryOp(UnaryOp node)
+        {
+            if (count > 0)
+            {
+                StructValue.TypeIndex type = tags[count-1];
+                Kernel kernel = cachedKernel(node,type,VALUE_SLOT);
+
+                if (kernel == null && (kernel = Kernels.GetUnaryKernel(node.Op,type)) != null)
+                    lock (node.Options)
+                        node.Options[Kernels.KERNEL_OPTION] = kernel;
+
+                if (kernel != null)
+                {
+                    Exception exc;
+                    applyUnaryKernel(kernel,out exc);
+                    return;
+                }
+            }
+
+            Perform_UnaryOp(node.Op);
+        }
+
+        /* Performs binary operation of the node. The kernel chosen for
+         * the operand types is cached in the node options
+         */
+        public void Perform_BinaryOp(BinaryOp node, out Exception exc)
+        {
+            if (count >= 2)
+            {
+                StructValue.TypeIndex typeA = tags[count-2], typeB = tags[count-1];
+                Kernel kernel = cachedKernel(node,typeA,typeB);
+
+                if (kernel == null && 
+                    (kernel = Kernels.GetBinaryKernel(node.Op,node.Overflow,node.Unsigned,typeA,typeB)) != null)
+                    lock (node.Options)
+                        node.Options[Kernels.KERNEL_OPTION] = kernel;
+
+                if (kernel != null)
+                {
+                    applyBinaryKernel(kernel,out exc);
+                    return;
+                }
+            }
+
+            Perform_BinaryOp(node.Op,node.Overflow,node.Unsigned,out exc);
+        }
+
+        /* Performs conversion of the node. The kernel chosen for
+         * the operand type is cached in the node options
+         */
+        public void Perform_ConvertValue(ConvertValue node, out Exception exc)
+        {
+            if (count > 0)
+            {
+                StructValue.TypeIndex type = tags[count-1];
+                Kernel kernel = cachedKernel(node,type,VALUE_SLOT);
+
+                if (kernel == null && 
+                    (kernel = Kernels.GetConvertKernel(StructValue.getTypeIndex(node.Type),
+                    node.Overflow,node.Unsigned,type)) != null)
+                    lock (node.Options)
+                        node.Options[Kernels.KERNEL_OPTION] = kernel;
+
+                if (kernel != null)
+                {
+                    applyUnaryKernel(kernel,out exc);
+                    return;
+                }
+            }
+
+            Perform_ConvertValue(node.Type,node.Overflow,node.Unsigned,out exc);
+        }
+
         /* Performs casting of object to a class
          * (corresponds to CILPE.CFG.CastClass class)
          */
@@ -728,6 +1194,18 @@ namespace CILPE.DataModel
         public void Perform_CheckFinite(out Exception exc)
         {
             exc = null;
+
+            if (count > 0 && tags[count-1] != VALUE_SLOT)
+            {
+                if (tags[count-1] != StructValue.TypeIndex.FLOAT64)
+                    throw new InvalidOperandException();
+
+                double real = reals[count-1];
+                if (Double.IsInfinity(real) || Double.IsNaN(real))
+                    exc = new ArithmeticException();
+                return;
+            }
+
             Value val = this[0];
 
             if (! (val is StructValue && (val as StructValue).IsPrimitive))
@@ -928,10 +1406,7 @@ namespace CILPE.DataModel
             Array array = popArray(out exc);
 
             if (exc == null)
-            {
-                UIntPtr length = (UIntPtr)(array.Length);
-                Push(new StructValue(length));
-            }
+                pushBits(StructValue.TypeIndex.NATIVEINT,array.Length);
         }
 
         /* Performs creating of array
@@ -1173,6 +1648,17 @@ namespace CILPE.DataModel
         public bool Perform_Branch()
         {
             bool branchFlag = false;
+
+            if (count > 0 && tags[count-1] != VALUE_SLOT)
+            {
+                if (! isIntegerSlot(tags[count-1]))
+                    throw new InvalidOperandException();
+
+                branchFlag = bits[count-1] != 0;
+                removeTop();
+                return branchFlag;
+            }
+
             Value val = Pop();
 
             if (val is StructValue)
@@ -1203,21 +1689,33 @@ namespace CILPE.DataModel
         public int Perform_Switch(int targetNum)
         {
             long index;
-            Value val = Pop();
 
-            if (! (val is StructValue))
-                throw new InvalidOperandException();
-            
-            object obj = (val as StructValue).Obj;
+            if (count > 0 && tags[count-1] != VALUE_SLOT)
+            {
+                if (! isIntegerSlot(tags[count-1]))
+                    throw new InvalidOperandException();
 
-            if (obj is Int32)
-                index = (long)(Int32)obj;
-            else if (obj is Int64)
-                index = (long)obj;
-            else if (obj is IntPtr)
-                index = (long)(IntPtr)obj;
+                index = bits[count-1];
+                removeTop();
+            }
             else
-                throw new InvalidOperandException();
+            {
+                Value val = Pop();
+
+                if (! (val is StructValue))
+                    throw new InvalidOperandException();
+            
+                object obj = (val as StructValue).Obj;
+
+                if (obj is Int32)
+                    index = (long)(Int32)obj;
+                else if (obj is Int64)
+                    index = (long)obj;
+                else if (obj is IntPtr)
+                    index = (long)(IntPtr)obj;
+                else
+                    throw new InvalidOperandException();
+            }
 
             if (index < 0 || index >= targetNum)
                 index = -1;
@@ -1293,7 +1791,9 @@ namespace CILPE.DataModel
             else
                 values[0] = resultValue = new ObjectReferenceValue(obj);
 
-            push(resultValue);
+            /* The constructor initializes obj in place, so the value 
+             * is kept boxed even if its type is primitive */
+            pushValue(resultValue);
 
             return new ParameterValues(ctor,values);
         }
@@ -0,0 +1,212 @@
+
+// ===========================================================================
+// CILPE - Partial Evaluator for Common Intermediate Language
+// ===========================================================================
+// File:
+//     Invokers.cs
+//
+// Description:
+//     Compiled invokers of methods called during evaluation
+//
+// Author:
+//     Sergei Skorobogatov (Sergei.Skorobogatov@supercompilers.com)
+// ===========================================================================
+
+
+using System;
+
+namespace CILPE.DataModel
+{
+    using System.Collections;
+    using System.Reflection;
+    using System.Reflection.Emit;
+
+    /* Base class of compiled invokers. Invoke calls the method directly,
+     * exceptions thrown by the method are not wrapped. The class is public
+     * because invokers are emitted to a separate dynamic assembly.
+     */
+    public abstract class MethodInvoker
+    {
+        public abstract object Invoke(object obj, object[] parameters);
+    }
+
+    /* Cache of compiled invokers. An invoker is emitted on the first call
+     * of a method. Methods that emitted code cannot access (non-public
+     * methods and types, by-reference and pointer parameters, constructors)
+     * have no invoker and are called through reflection.
+     */
+    internal class Invokers
+    {
+        #region Private and internal members
+
+        private static readonly object NO_INVOKER = new object();
+
+        private static Hashtable invokers = new Hashtable(); /* MethodBase -> MethodInvoker or NO_INVOKER */
+        private static ModuleBuilder module = null;
+        private static int invokerCount = 0;
+
+        private static bool isVisible(Type type)
+        {
+            if (type.IsByRef || type.IsPointer)
+                return false;
+            if (type.HasElementType)
+                return isVisible(type.GetElementType());
+            if (type.IsNested)
+                return type.IsNestedPublic && isVisible(type.DeclaringType);
+
+            return type.IsPublic;
+        }
+
+        private static bool canCompile(MethodBase method)
+        {
+            if (! (method is MethodInfo) || ! method.IsPublic)
+                return false;
+            if ((method.CallingConvention & CallingConventions.VarArgs) != 0)
+                return false;
+            if (! isVisible(method.DeclaringType))
+                return false;
+
+            Type retType = (method as MethodInfo).ReturnType;
+            if (retType != typeof(void) && ! isVisible(retType))
+                return false;
+
+            foreach (ParameterInfo info in method.GetParameters())
+                if (! isVisible(info.ParameterType))
+                    return false;
+
+            return true;
+        }
+
+        private static ModuleBuilder getModule()
+        {
+            if (module == null)
+            {
+                AssemblyName name = new AssemblyName();
+                name.Name = "CILPE.Invokers";
+
+                AssemblyBuilder assembly = AppDomain.CurrentDomain.DefineDynamicAssembly
+                    (name,AssemblyBuilderAccess.Run);
+                module = assembly.DefineDynamicModule(name.Name);
+            }
+
+            return module;
+        }
+
+        private static void emitCast(ILGenerator il, Type type)
+        {
+            if (type.IsValueType)
+            {
+                il.Emit(OpCodes.Unbox,type);
+                il.Emit(OpCodes.Ldobj,type);
+            }
+            else if (type != typeof(object))
+                il.Emit(OpCodes.Castclass,type);
+        }
+
+        private static MethodInvoker compile(MethodInfo method)
+        {
+            TypeBuilder typeBuilder = getModule().DefineType
+                ("Invoker" + invokerCount++,
+                TypeAttributes.Public | TypeAttributes.Sealed | TypeAttributes.Class,
+                typeof(MethodInvoker));
+            typeBuilder.DefineDefaultConstructor(MethodAttributes.Public);
+
+            MethodBuilder invoke = typeBuilder.DefineMethod
+                ("Invoke",
+                MethodAttributes.Public | MethodAttributes.Virtual | MethodAttributes.HideBySig,
+                typeof(object), new Type[] { typeof(object), typeof(object[]) });
+            ILGenerator il = invoke.GetILGenerator();
+
+            Type declType = method.DeclaringType;
+            if (! method.IsStatic)
+            {
+                il.Emit(OpCodes.Ldarg_1);
+                if (declType.IsValueType)
+                    il.Emit(OpCodes.Unbox,declType);
+                else
+                    il.Emit(OpCodes.Castclass,declType);
+            }
+
+            ParameterInfo[] parms = method.GetParameters();
+            for (int i = 0; i < parms.Length; i++)
+            {
+                il.Emit(OpCodes.Ldarg_2);
+                il.Emit(OpCodes.Ldc_I4,i);
+                il.Emit(OpCodes.Ldelem_Ref);
+                emitCast(il,parms[i].ParameterType);
+            }
+
+            if (method.IsStatic || declType.IsValueType)
+                il.Emit(OpCodes.Call,method);
+            else
+                il.Emit(OpCodes.Callvirt,method);
+
+            if (method.ReturnType == typeof(void))
+                il.Emit(OpCodes.Ldnull);
+            else if (method.ReturnType.IsValueType)
+                il.Emit(OpCodes.Box,method.ReturnType);
+            il.Emit(OpCodes.Ret);
+
+            Type invokerType = typeBuilder.CreateType();
+            return Activator.CreateInstance(invokerType) as MethodInvoker;
+        }
+
+        #endregion
+
+        /* Returns compiled invoker of the method or null
+         * if the method has to be called through reflection
+         */
+        public static MethodInvoker GetInvoker(MethodBase method)
+        {
+            object invoker = invokers[method];
+
+            if (invoker == null)
+            {
+                lock (invokers)
+                {
+                    invoker = invokers[method];
+                    if (invoker == null)
+                    {
+                        invoker = NO_INVOKER;
+                        if (canCompile(method))
+                        {
+                            try
+                            {
+                                invoker = compile(method as MethodInfo);
+                            }
+                            catch (Exception)
+                            {
+                                /* Falling back to reflection */
+                            }
+                        }
+
+                        invokers[method] = invoker;
+                    }
+                }
+            }
+
+            return invoker as MethodInvoker;
+        }
+
+        /* Checks that parameters have exactly the types expected by invoker,
+         * otherwise reflection has to perform conversions
+         */
+        public static bool CanInvoke(Type[] types, object[] parameters)
+        {
+            for (int i = 0; i < types.Length; i++)
+            {
+                object p = parameters[i];
+
+                if (types[i].IsValueType)
+                {
+                    if (p == null || p.GetType() != types[i])
+                        return false;
+                }
+                else if (p != null && ! types[i].IsInstanceOfType(p))
+                    return false;
+            }
+
+            return true;
+        }
+    }
+}
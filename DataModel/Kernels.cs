@@ -0,0 +1,557 @@
+
+// ===========================================================================
+// CILPE - Partial Evaluator for Common Intermediate Language
+// ===========================================================================
+// File:
+//     Kernels.cs
+//
+// Description:
+//     Type-pair specialized kernels of primitive operations
+//
+// Author:
+//     Sergei Skorobogatov (Sergei.Skorobogatov@supercompilers.com)
+// ===========================================================================
+
+
+using System;
+
+namespace CILPE.DataModel
+{
+    using CILPE.CFG;
+
+    /* Method of a kernel. Takes operands from the slots a and b of the
+     * unboxed evaluation stack and stores the result to the slot a
+     * (kernels of unary operations and conversions ignore b).
+     * Arithmetic errors are reported by ArithmeticException.
+     */
+    internal delegate void KernelMethod(long[] bits, double[] reals, int a, int b);
+
+    /* Kernel of primitive operation for a fixed combination of operand types */
+    internal class Kernel
+    {
+        public readonly KernelMethod Method;
+        public readonly StructValue.TypeIndex TypeA, TypeB, ResultType;
+
+        public Kernel(KernelMethod method, StructValue.TypeIndex typeA,
+            StructValue.TypeIndex typeB, StructValue.TypeIndex resultType)
+        {
+            Method = method;
+            TypeA = typeA;
+            TypeB = typeB;
+            ResultType = resultType;
+        }
+    }
+
+    /* Dispatch tables of kernels. A kernel is looked up by operation,
+     * overflow and unsigned flags and types of unboxed operands
+     * (int32, int64, native int or float64). Combinations that are not
+     * valid CIL have no kernel.
+     */
+    internal class Kernels
+    {
+        /* Name of the node option that caches the kernel chosen for the node */
+        public const string KERNEL_OPTION = "Kernel";
+
+        #region Private and internal members
+
+        private const StructValue.TypeIndex INT32 = StructValue.TypeIndex.INT32;
+        private const StructValue.TypeIndex INT64 = StructValue.TypeIndex.INT64;
+        private const StructValue.TypeIndex NATIVEINT = StructValue.TypeIndex.NATIVEINT;
+        private const StructValue.TypeIndex FLOAT64 = StructValue.TypeIndex.FLOAT64;
+        private const StructValue.TypeIndex NONE = StructValue.TypeIndex.INVALID;
+
+        private const int STACK_TYPES = 4;      /* int32, int64, native int, float64 */
+        private const int FLAG_COMBINATIONS = 4; /* overflow and unsigned flags */
+        private const int BINARY_OPS = 13;
+        private const int UNARY_OPS = 2;
+        private const int CONVERT_TYPES = 14;    /* INT32 .. CHAR */
+
+        private static Kernel[] binaryKernels;
+        private static Kernel[] unaryKernels;
+        private static Kernel[] convertKernels;
+
+        private static bool isStackType(StructValue.TypeIndex type)
+        {
+            return type >= INT32 && type <= FLOAT64;
+        }
+
+        private static int flagsIndex(bool overflow, bool unsigned)
+        {
+            return (overflow ? 2 : 0) + (unsigned ? 1 : 0);
+        }
+
+        private static int binaryIndex(BinaryOp.ArithOp op, bool overflow, bool unsigned,
+            StructValue.TypeIndex typeA, StructValue.TypeIndex typeB)
+        {
+            return (((int)op*FLAG_COMBINATIONS + flagsIndex(overflow,unsigned))*STACK_TYPES +
+                (int)typeA)*STACK_TYPES + (int)typeB;
+        }
+
+        private static int convertIndex(StructValue.TypeIndex type, bool overflow, bool unsigned,
+            StructValue.TypeIndex source)
+        {
+            return ((int)type*FLAG_COMBINATIONS + flagsIndex(overflow,unsigned))*STACK_TYPES +
+                (int)source;
+        }
+
+        private static void setBinary(BinaryOp.ArithOp op, bool overflow, bool unsigned,
+            StructValue.TypeIndex typeA, StructValue.TypeIndex typeB,
+            StructValue.TypeIndex resultType, KernelMethod method)
+        {
+            binaryKernels[binaryIndex(op,overflow,unsigned,typeA,typeB)] =
+                new Kernel(method,typeA,typeB,resultType);
+        }
+
+        private static void setUnary(UnaryOp.ArithOp op, StructValue.TypeIndex type, KernelMethod method)
+        {
+            unaryKernels[(int)op*STACK_TYPES + (int)type] = new Kernel(method,type,NONE,type);
+        }
+
+        private static void setConvert(StructValue.TypeIndex type, bool overflow, bool unsigned,
+            StructValue.TypeIndex source, KernelMethod method)
+        {
+            StructValue.TypeIndex resultType;
+
+            switch (type)
+            {
+                case StructValue.TypeIndex.INT64:
+                case StructValue.TypeIndex.UINT64:
+                    resultType = INT64;
+                    break;
+
+                case StructValue.TypeIndex.NATIVEINT:
+                case StructValue.TypeIndex.UNATIVEINT:
+                    resultType = NATIVEINT;
+                    break;
+
+                case StructValue.TypeIndex.FLOAT32:
+                case StructValue.TypeIndex.FLOAT64:
+                    resultType = FLOAT64;
+                    break;
+
+                default:
+                    resultType = INT32;
+                    break;
+            }
+
+            convertKernels[convertIndex(type,overflow,unsigned,source)] =
+                new Kernel(method,source,NONE,resultType);
+        }
+
+        private static KernelMethod pick(bool wide, KernelMethod narrowMethod, KernelMethod wideMethod)
+        {
+            return wide ? wideMethod : narrowMethod;
+        }
+
+        /* Integer operations on operands of the given types.
+         * wide means that the operation is performed on 64-bit values
+         */
+        private static void initIntegerOps(StructValue.TypeIndex typeA, StructValue.TypeIndex typeB,
+            StructValue.TypeIndex resultType, bool wide)
+        {
+            setBinary(BinaryOp.ArithOp.ADD,false,false,typeA,typeB,resultType,pick(wide,new KernelMethod(addI4),new KernelMethod(addI8)));
+            setBinary(BinaryOp.ArithOp.SUB,false,false,typeA,typeB,resultType,pick(wide,new KernelMethod(subI4),new KernelMethod(subI8)));
+            setBinary(BinaryOp.ArithOp.MUL,false,false,typeA,typeB,resultType,pick(wide,new KernelMethod(mulI4),new KernelMethod(mulI8)));
+            setBinary(BinaryOp.ArithOp.DIV,false,false,typeA,typeB,resultType,pick(wide,new KernelMethod(divI4),new KernelMethod(divI8)));
+            setBinary(BinaryOp.ArithOp.REM,false,false,typeA,typeB,resultType,pick(wide,new KernelMethod(remI4),new KernelMethod(remI8)));
+            setBinary(BinaryOp.ArithOp.DIV,false,true,typeA,typeB,resultType,pick(wide,new KernelMethod(divUnI4),new KernelMethod(divUnI8)));
+            setBinary(BinaryOp.ArithOp.REM,false,true,typeA,typeB,resultType,pick(wide,new KernelMethod(remUnI4),new KernelMethod(remUnI8)));
+
+            /* Values are kept sign-extended, so bitwise operations and
+             * signed comparisons do not depend on the width
+             */
+            setBinary(BinaryOp.ArithOp.AND,false,false,typeA,typeB,resultType,new KernelMethod(and));
+            setBinary(BinaryOp.ArithOp.OR,false,false,typeA,typeB,resultType,new KernelMethod(or));
+            setBinary(BinaryOp.ArithOp.XOR,false,false,typeA,typeB,resultType,new KernelMethod(xor));
+            setBinary(BinaryOp.ArithOp.CEQ,false,false,typeA,typeB,INT32,new KernelMethod(ceq));
+            setBinary(BinaryOp.ArithOp.CGT,false,false,typeA,typeB,INT32,new KernelMethod(cgt));
+            setBinary(BinaryOp.ArithOp.CLT,false,false,typeA,typeB,INT32,new KernelMethod(clt));
+            setBinary(BinaryOp.ArithOp.CGT,false,true,typeA,typeB,INT32,pick(wide,new KernelMethod(cgtUnI4),new KernelMethod(cgtUnI8)));
+            setBinary(BinaryOp.ArithOp.CLT,false,true,typeA,typeB,INT32,pick(wide,new KernelMethod(cltUnI4),new KernelMethod(cltUnI8)));
+
+            setBinary(BinaryOp.ArithOp.ADD,true,false,typeA,typeB,resultType,pick(wide,new KernelMethod(addOvfI4),new KernelMethod(addOvfI8)));
+            setBinary(BinaryOp.ArithOp.SUB,true,false,typeA,typeB,resultType,pick(wide,new KernelMethod(subOvfI4),new KernelMethod(subOvfI8)));
+            setBinary(BinaryOp.ArithOp.MUL,true,false,typeA,typeB,resultType,pick(wide,new KernelMethod(mulOvfI4),new KernelMethod(mulOvfI8)));
+            setBinary(BinaryOp.ArithOp.ADD,true,true,typeA,typeB,resultType,pick(wide,new KernelMethod(addOvfUnI4),new KernelMethod(addOvfUnI8)));
+            setBinary(BinaryOp.ArithOp.SUB,true,true,typeA,typeB,resultType,pick(wide,new KernelMethod(subOvfUnI4),new KernelMethod(subOvfUnI8)));
+            setBinary(BinaryOp.ArithOp.MUL,true,true,typeA,typeB,resultType,pick(wide,new KernelMethod(mulOvfUnI4),new KernelMethod(mulOvfUnI8)));
+        }
+
+        /* Shifts of the value of the given type by int32 or native int amount */
+        private static void initShiftOps(StructValue.TypeIndex type, bool wide)
+        {
+            StructValue.TypeIndex[] amountTypes = new StructValue.TypeIndex[] { INT32, NATIVEINT };
+
+            foreach (StructValue.TypeIndex amount in amountTypes)
+            {
+                setBinary(BinaryOp.ArithOp.SHL,false,false,type,amount,type,pick(wide,new KernelMethod(shlI4),new KernelMethod(shlI8)));
+                setBinary(BinaryOp.ArithOp.SHR,false,false,type,amount,type,pick(wide,new KernelMethod(shrI4),new KernelMethod(shrI8)));
+                setBinary(BinaryOp.ArithOp.SHR,false,true,type,amount,type,pick(wide,new KernelMethod(shrUnI4),new KernelMethod(shrUnI8)));
+            }
+        }
+
+        private static void initFloatOps()
+        {
+            setBinary(BinaryOp.ArithOp.ADD,false,false,FLOAT64,FLOAT64,FLOAT64,new KernelMethod(addR8));
+            setBinary(BinaryOp.ArithOp.SUB,false,false,FLOAT64,FLOAT64,FLOAT64,new KernelMethod(subR8));
+            setBinary(BinaryOp.ArithOp.MUL,false,false,FLOAT64,FLOAT64,FLOAT64,new KernelMethod(mulR8));
+            setBinary(BinaryOp.ArithOp.DIV,false,false,FLOAT64,FLOAT64,FLOAT64,new KernelMethod(divR8));
+            setBinary(BinaryOp.ArithOp.REM,false,false,FLOAT64,FLOAT64,FLOAT64,new KernelMethod(remR8));
+            setBinary(BinaryOp.ArithOp.CEQ,false,false,FLOAT64,FLOAT64,INT32,new KernelMethod(ceqR8));
+            setBinary(BinaryOp.ArithOp.CGT,false,false,FLOAT64,FLOAT64,INT32,new KernelMethod(cgtR8));
+            setBinary(BinaryOp.ArithOp.CLT,false,false,FLOAT64,FLOAT64,INT32,new KernelMethod(cltR8));
+            setBinary(BinaryOp.ArithOp.CGT,false,true,FLOAT64,FLOAT64,INT32,new KernelMethod(cgtUnR8));
+            setBinary(BinaryOp.ArithOp.CLT,false,true,FLOAT64,FLOAT64,INT32,new KernelMethod(cltUnR8));
+        }
+
+        private static void initUnaryOps(bool nativeWide)
+        {
+            setUnary(UnaryOp.ArithOp.NEG,INT32,new KernelMethod(negI4));
+            setUnary(UnaryOp.ArithOp.NEG,INT64,new KernelMethod(negI8));
+            setUnary(UnaryOp.ArithOp.NEG,NATIVEINT,pick(nativeWide,new KernelMethod(negI4),new KernelMethod(negI8)));
+            setUnary(UnaryOp.ArithOp.NEG,FLOAT64,new KernelMethod(negR8));
+            setUnary(UnaryOp.ArithOp.NOT,INT32,new KernelMethod(not));
+            setUnary(UnaryOp.ArithOp.NOT,INT64,new KernelMethod(not));
+            setUnary(UnaryOp.ArithOp.NOT,NATIVEINT,new KernelMethod(not));
+        }
+
+        /* Conversions of integer source. wide means that the source is 64-bit,
+         * nativeWide means that native int is 64-bit
+         */
+        private static void initIntegerConvertOps(StructValue.TypeIndex source, bool wide, bool nativeWide)
+        {
+            KernelMethod
+                convI4 = new KernelMethod(convI4FromI),
+                convU4 = convI4,
+                convI8 = new KernelMethod(nop),
+                convU8 = pick(wide,new KernelMethod(convU8FromI4),convI8);
+
+            setConvert(StructValue.TypeIndex.INT8,false,false,source,new KernelMethod(convI1FromI));
+            setConvert(StructValue.TypeIndex.UINT8,false,false,source,new KernelMethod(convU1FromI));
+            setConvert(StructValue.TypeIndex.INT16,false,false,source,new KernelMethod(convI2FromI));
+            setConvert(StructValue.TypeIndex.UINT16,false,false,source,new KernelMethod(convU2FromI));
+            setConvert(StructValue.TypeIndex.INT32,false,false,source,convI4);
+            setConvert(StructValue.TypeIndex.UINT32,false,false,source,convU4);
+            setConvert(StructValue.TypeIndex.INT64,false,false,source,convI8);
+            setConvert(StructValue.TypeIndex.UINT64,false,false,source,convU8);
+            setConvert(StructValue.TypeIndex.NATIVEINT,false,false,source,pick(nativeWide,convI4,convI8));
+            setConvert(StructValue.TypeIndex.UNATIVEINT,false,false,source,pick(nativeWide,convU4,convU8));
+            setConvert(StructValue.TypeIndex.FLOAT32,false,false,source,new KernelMethod(convR4FromI));
+            setConvert(StructValue.TypeIndex.FLOAT64,false,false,source,new KernelMethod(convR8FromI));
+            setConvert(StructValue.TypeIndex.FLOAT64,false,true,source,pick(wide,new KernelMethod(convRUnFromI4),new KernelMethod(convRUnFromI8)));
+
+            /* conv.ovf.* treat the source as signed, so they do not depend on its width */
+            convI4 = new KernelMethod(convOvfI4FromI);
+            convU4 = new KernelMethod(convOvfU4FromI);
+            convU8 = new KernelMethod(convOvfU8FromI);
+
+            setConvert(StructValue.TypeIndex.INT8,true,false,source,new KernelMethod(convOvfI1FromI));
+            setConvert(StructValue.TypeIndex.UINT8,true,false,source,new KernelMethod(convOvfU1FromI));
+            setConvert(StructValue.TypeIndex.INT16,true,false,source,new KernelMethod(convOvfI2FromI));
+            setConvert(StructValue.TypeIndex.UINT16,true,false,source,new KernelMethod(convOvfU2FromI));
+            setConvert(StructValue.TypeIndex.INT32,true,false,source,convI4);
+            setConvert(StructValue.TypeIndex.UINT32,true,false,source,convU4);
+            setConvert(StructValue.TypeIndex.INT64,true,false,source,convI8);
+            setConvert(StructValue.TypeIndex.UINT64,true,false,source,convU8);
+            setConvert(StructValue.TypeIndex.NATIVEINT,true,false,source,pick(nativeWide,convI4,convI8));
+            setConvert(StructValue.TypeIndex.UNATIVEINT,true,false,source,pick(nativeWide,convU4,convU8));
+
+            /* conv.ovf.*.un treat the source as unsigned value of its width */
+            convI4 = pick(wide,new KernelMethod(convOvfI4UnFromI4),new KernelMethod(convOvfI4UnFromI8));
+            convU4 = pick(wide,new KernelMethod(nop),new KernelMethod(convOvfU4UnFromI8));
+            convI8 = pick(wide,new KernelMethod(convU8FromI4),new KernelMethod(convOvfI8UnFromI8));
+            convU8 = pick(wide,new KernelMethod(convU8FromI4),new KernelMethod(nop));
+
+            setConvert(StructValue.TypeIndex.INT8,true,true,source,pick(wide,new KernelMethod(convOvfI1UnFromI4),new KernelMethod(convOvfI1UnFromI8)));
+            setConvert(StructValue.TypeIndex.UINT8,true,true,source,pick(wide,new KernelMethod(convOvfU1UnFromI4),new KernelMethod(convOvfU1UnFromI8)));
+            setConvert(StructValue.TypeIndex.INT16,true,true,source,pick(wide,new KernelMethod(convOvfI2UnFromI4),new KernelMethod(convOvfI2UnFromI8)));
+            setConvert(StructValue.TypeIndex.UINT16,true,true,source,pick(wide,new KernelMethod(convOvfU2UnFromI4),new KernelMethod(convOvfU2UnFromI8)));
+            setConvert(StructValue.TypeIndex.INT32,true,true,source,convI4);
+            setConvert(StructValue.TypeIndex.UINT32,true,true,source,convU4);
+            setConvert(StructValue.TypeIndex.INT64,true,true,source,convI8);
+            setConvert(StructValue.TypeIndex.UINT64,true,true,source,convU8);
+            setConvert(StructValue.TypeIndex.NATIVEINT,true,true,source,pick(nativeWide,convI4,convI8));
+            setConvert(StructValue.TypeIndex.UNATIVEINT,true,true,source,pick(nativeWide,convU4,convU8));
+        }
+
+        /* Conversions of float64 source (conv.ovf.*.un and conv.r.un
+         * of floating point values are left to DataModelUtils)
+         */
+        private static void initFloatConvertOps(bool nativeWide)
+        {
+            KernelMethod
+                convI4 = new KernelMethod(convI4FromR),
+                convU4 = new KernelMethod(convU4FromR),
+                convI8 = new KernelMethod(convI8FromR),
+                convU8 = new KernelMethod(convU8FromR);
+
+            setConvert(StructValue.TypeIndex.INT8,false,false,FLOAT64,new KernelMethod(convI1FromR));
+            setConvert(StructValue.TypeIndex.UINT8,false,false,FLOAT64,new KernelMethod(convU1FromR));
+            setConvert(StructValue.TypeIndex.INT16,false,false,FLOAT64,new KernelMethod(convI2FromR));
+            setConvert(StructValue.TypeIndex.UINT16,false,false,FLOAT64,new KernelMethod(convU2FromR));
+            setConvert(StructValue.TypeIndex.INT32,false,false,FLOAT64,convI4);
+            setConvert(StructValue.TypeIndex.UINT32,false,false,FLOAT64,convU4);
+            setConvert(StructValue.TypeIndex.INT64,false,false,FLOAT64,convI8);
+            setConvert(StructValue.TypeIndex.UINT64,false,false,FLOAT64,convU8);
+            setConvert(StructValue.TypeIndex.NATIVEINT,false,false,FLOAT64,pick(nativeWide,convI4,convI8));
+            setConvert(StructValue.TypeIndex.UNATIVEINT,false,false,FLOAT64,pick(nativeWide,convU4,convU8));
+            setConvert(StructValue.TypeIndex.FLOAT32,false,false,FLOAT64,new KernelMethod(convR4FromR));
+            setConvert(StructValue.TypeIndex.FLOAT64,false,false,FLOAT64,new KernelMethod(nop));
+
+            convI4 = new KernelMethod(convOvfI4FromR);
+            convU4 = new KernelMethod(convOvfU4FromR);
+            convI8 = new KernelMethod(convOvfI8FromR);
+            convU8 = new KernelMethod(convOvfU8FromR);
+
+            setConvert(StructValue.TypeIndex.INT8,true,false,FLOAT64,new KernelMethod(convOvfI1FromR));
+            setConvert(StructValue.TypeIndex.UINT8,true,false,FLOAT64,new KernelMethod(convOvfU1FromR));
+            setConvert(StructValue.TypeIndex.INT16,true,false,FLOAT64,new KernelMethod(convOvfI2FromR));
+            setConvert(StructValue.TypeIndex.UINT16,true,false,FLOAT64,new KernelMethod(convOvfU2FromR));
+            setConvert(StructValue.TypeIndex.INT32,true,false,FLOAT64,convI4);
+            setConvert(StructValue.TypeIndex.UINT32,true,false,FLOAT64,convU4);
+            setConvert(StructValue.TypeIndex.INT64,true,false,FLOAT64,convI8);
+            setConvert(StructValue.TypeIndex.UINT64,true,false,FLOAT64,convU8);
+            setConvert(StructValue.TypeIndex.NATIVEINT,true,false,FLOAT64,pick(nativeWide,convI4,convI8));
+            setConvert(StructValue.TypeIndex.UNATIVEINT,true,false,FLOAT64,pick(nativeWide,convU4,convU8));
+        }
+
+        static Kernels()
+        {
+            bool nativeWide = IntPtr.Size == 8;
+
+            binaryKernels = new Kernel[BINARY_OPS*FLAG_COMBINATIONS*STACK_TYPES*STACK_TYPES];
+            unaryKernels = new Kernel[UNARY_OPS*STACK_TYPES];
+            convertKernels = new Kernel[CONVERT_TYPES*FLAG_COMBINATIONS*STACK_TYPES];
+
+            /* int32 operand is sign-extended when combined with native int */
+            initIntegerOps(INT32,INT32,INT32,false);
+            initIntegerOps(INT64,INT64,INT64,true);
+            initIntegerOps(NATIVEINT,NATIVEINT,NATIVEINT,nativeWide);
+            initIntegerOps(INT32,NATIVEINT,NATIVEINT,nativeWide);
+            initIntegerOps(NATIVEINT,INT32,NATIVEINT,nativeWide);
+
+            initShiftOps(INT32,false);
+            initShiftOps(INT64,true);
+            initShiftOps(NATIVEINT,nativeWide);
+
+            initFloatOps();
+            initUnaryOps(nativeWide);
+
+            initIntegerConvertOps(INT32,false,nativeWide);
+            initIntegerConvertOps(INT64,true,nativeWide);
+            initIntegerConvertOps(NATIVEINT,nativeWide,nativeWide);
+            initFloatConvertOps(nativeWide);
+        }
+
+        #endregion
+
+        #region Kernels of binary operations
+
+        private static void addI4(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((int)bits[a] + (int)bits[b]); }
+        private static void subI4(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((int)bits[a] - (int)bits[b]); }
+        private static void mulI4(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((int)bits[a] * (int)bits[b]); }
+        private static void divI4(long[] bits, double[] reals, int a, int b) { bits[a] = (int)bits[a] / (int)bits[b]; }
+        private static void remI4(long[] bits, double[] reals, int a, int b) { bits[a] = (int)bits[a] % (int)bits[b]; }
+        private static void divUnI4(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((int)((uint)bits[a] / (uint)bits[b])); }
+        private static void remUnI4(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((int)((uint)bits[a] % (uint)bits[b])); }
+        private static void cgtUnI4(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((uint)bits[a] > (uint)bits[b]) ? 1 : 0; }
+        private static void cltUnI4(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((uint)bits[a] < (uint)bits[b]) ? 1 : 0; }
+        private static void shlI4(long[] bits, double[] reals, int a, int b) { bits[a] = (int)bits[a] << (int)bits[b]; }
+        private static void shrI4(long[] bits, double[] reals, int a, int b) { bits[a] = (int)bits[a] >> (int)bits[b]; }
+        private static void shrUnI4(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((int)((uint)bits[a] >> (int)bits[b])); }
+
+        private static void addOvfI4(long[] bits, double[] reals, int a, int b)
+        {
+            int x = (int)bits[a], y = (int)bits[b];
+            bits[a] = checked(x + y);
+        }
+
+        private static void subOvfI4(long[] bits, double[] reals, int a, int b)
+        {
+            int x = (int)bits[a], y = (int)bits[b];
+            bits[a] = checked(x - y);
+        }
+
+        private static void mulOvfI4(long[] bits, double[] reals, int a, int b)
+        {
+            int x = (int)bits[a], y = (int)bits[b];
+            bits[a] = checked(x * y);
+        }
+
+        private static void addOvfUnI4(long[] bits, double[] reals, int a, int b)
+        {
+            uint x = unchecked((uint)bits[a]), y = unchecked((uint)bits[b]);
+            bits[a] = unchecked((int)checked(x + y));
+        }
+
+        private static void subOvfUnI4(long[] bits, double[] reals, int a, int b)
+        {
+            uint x = unchecked((uint)bits[a]), y = unchecked((uint)bits[b]);
+            bits[a] = unchecked((int)checked(x - y));
+        }
+
+        private static void mulOvfUnI4(long[] bits, double[] reals, int a, int b)
+        {
+            uint x = unchecked((uint)bits[a]), y = unchecked((uint)bits[b]);
+            bits[a] = unchecked((int)checked(x * y));
+        }
+
+        private static void addI8(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked(bits[a] + bits[b]); }
+        private static void subI8(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked(bits[a] - bits[b]); }
+        private static void mulI8(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked(bits[a] * bits[b]); }
+        private static void divI8(long[] bits, double[] reals, int a, int b) { bits[a] = bits[a] / bits[b]; }
+        private static void remI8(long[] bits, double[] reals, int a, int b) { bits[a] = bits[a] % bits[b]; }
+        private static void divUnI8(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((long)((ulong)bits[a] / (ulong)bits[b])); }
+        private static void remUnI8(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((long)((ulong)bits[a] % (ulong)bits[b])); }
+        private static void cgtUnI8(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((ulong)bits[a] > (ulong)bits[b]) ? 1 : 0; }
+        private static void cltUnI8(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((ulong)bits[a] < (ulong)bits[b]) ? 1 : 0; }
+        private static void shlI8(long[] bits, double[] reals, int a, int b) { bits[a] = bits[a] << (int)bits[b]; }
+        private static void shrI8(long[] bits, double[] reals, int a, int b) { bits[a] = bits[a] >> (int)bits[b]; }
+        private static void shrUnI8(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((long)((ulong)bits[a] >> (int)bits[b])); }
+        private static void addOvfI8(long[] bits, double[] reals, int a, int b) { bits[a] = checked(bits[a] + bits[b]); }
+        private static void subOvfI8(long[] bits, double[] reals, int a, int b) { bits[a] = checked(bits[a] - bits[b]); }
+        private static void mulOvfI8(long[] bits, double[] reals, int a, int b) { bits[a] = checked(bits[a] * bits[b]); }
+
+        private static void addOvfUnI8(long[] bits, double[] reals, int a, int b)
+        {
+            ulong x = unchecked((ulong)bits[a]), y = unchecked((ulong)bits[b]);
+            bits[a] = unchecked((long)checked(x + y));
+        }
+
+        private static void subOvfUnI8(long[] bits, double[] reals, int a, int b)
+        {
+            ulong x = unchecked((ulong)bits[a]), y = unchecked((ulong)bits[b]);
+            bits[a] = unchecked((long)checked(x - y));
+        }
+
+        private static void mulOvfUnI8(long[] bits, double[] reals, int a, int b)
+        {
+            ulong x = unchecked((ulong)bits[a]), y = unchecked((ulong)bits[b]);
+            bits[a] = unchecked((long)checked(x * y));
+        }
+
+        private static void and(long[] bits, double[] reals, int a, int b) { bits[a] = bits[a] & bits[b]; }
+        private static void or(long[] bits, double[] reals, int a, int b) { bits[a] = bits[a] | bits[b]; }
+        private static void xor(long[] bits, double[] reals, int a, int b) { bits[a] = bits[a] ^ bits[b]; }
+        private static void ceq(long[] bits, double[] reals, int a, int b) { bits[a] = (bits[a] == bits[b]) ? 1 : 0; }
+        private static void cgt(long[] bits, double[] reals, int a, int b) { bits[a] = (bits[a] > bits[b]) ? 1 : 0; }
+        private static void clt(long[] bits, double[] reals, int a, int b) { bits[a] = (bits[a] < bits[b]) ? 1 : 0; }
+
+        private static void addR8(long[] bits, double[] reals, int a, int b) { reals[a] = reals[a] + reals[b]; }
+        private static void subR8(long[] bits, double[] reals, int a, int b) { reals[a] = reals[a] - reals[b]; }
+        private static void mulR8(long[] bits, double[] reals, int a, int b) { reals[a] = reals[a] * reals[b]; }
+        private static void divR8(long[] bits, double[] reals, int a, int b) { reals[a] = reals[a] / reals[b]; }
+        private static void remR8(long[] bits, double[] reals, int a, int b) { reals[a] = reals[a] % reals[b]; }
+        private static void ceqR8(long[] bits, double[] reals, int a, int b) { bits[a] = (reals[a] == reals[b]) ? 1 : 0; }
+        private static void cgtR8(long[] bits, double[] reals, int a, int b) { bits[a] = (reals[a] > reals[b]) ? 1 : 0; }
+        private static void cltR8(long[] bits, double[] reals, int a, int b) { bits[a] = (reals[a] < reals[b]) ? 1 : 0; }
+
+        /* cgt.un and clt.un are true for unordered operands */
+        private static void cgtUnR8(long[] bits, double[] reals, int a, int b) { bits[a] = ! (reals[a] <= reals[b]) ? 1 : 0; }
+        private static void cltUnR8(long[] bits, double[] reals, int a, int b) { bits[a] = ! (reals[a] >= reals[b]) ? 1 : 0; }
+
+        #endregion
+
+        #region Kernels of unary operations
+
+        private static void negI4(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked(-(int)bits[a]); }
+        private static void negI8(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked(-bits[a]); }
+        private static void negR8(long[] bits, double[] reals, int a, int b) { reals[a] = -reals[a]; }
+        private static void not(long[] bits, double[] reals, int a, int b) { bits[a] = ~bits[a]; }
+
+        #endregion
+
+        #region Kernels of conversions
+
+        private static void nop(long[] bits, double[] reals, int a, int b) { }
+
+        private static void convI1FromI(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((sbyte)bits[a]); }
+        private static void convU1FromI(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((byte)bits[a]); }
+        private static void convI2FromI(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((short)bits[a]); }
+        private static void convU2FromI(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((ushort)bits[a]); }
+        private static void convI4FromI(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((int)bits[a]); }
+        private static void convU8FromI4(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((uint)bits[a]); }
+        private static void convR4FromI(long[] bits, double[] reals, int a, int b) { reals[a] = (float)bits[a]; }
+        private static void convR8FromI(long[] bits, double[] reals, int a, int b) { reals[a] = (double)bits[a]; }
+        private static void convRUnFromI4(long[] bits, double[] reals, int a, int b) { reals[a] = unchecked((uint)bits[a]); }
+        private static void convRUnFromI8(long[] bits, double[] reals, int a, int b) { reals[a] = unchecked((ulong)bits[a]); }
+
+        private static void convOvfI1FromI(long[] bits, double[] reals, int a, int b) { bits[a] = checked((sbyte)bits[a]); }
+        private static void convOvfU1FromI(long[] bits, double[] reals, int a, int b) { bits[a] = checked((byte)bits[a]); }
+        private static void convOvfI2FromI(long[] bits, double[] reals, int a, int b) { bits[a] = checked((short)bits[a]); }
+        private static void convOvfU2FromI(long[] bits, double[] reals, int a, int b) { bits[a] = checked((ushort)bits[a]); }
+        private static void convOvfI4FromI(long[] bits, double[] reals, int a, int b) { bits[a] = checked((int)bits[a]); }
+        private static void convOvfU4FromI(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((int)checked((uint)bits[a])); }
+        private static void convOvfU8FromI(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((long)checked((ulong)bits[a])); }
+
+        private static void convOvfI1UnFromI4(long[] bits, double[] reals, int a, int b) { uint x = unchecked((uint)bits[a]); bits[a] = checked((sbyte)x); }
+        private static void convOvfU1UnFromI4(long[] bits, double[] reals, int a, int b) { uint x = unchecked((uint)bits[a]); bits[a] = checked((byte)x); }
+        private static void convOvfI2UnFromI4(long[] bits, double[] reals, int a, int b) { uint x = unchecked((uint)bits[a]); bits[a] = checked((short)x); }
+        private static void convOvfU2UnFromI4(long[] bits, double[] reals, int a, int b) { uint x = unchecked((uint)bits[a]); bits[a] = checked((ushort)x); }
+        private static void convOvfI4UnFromI4(long[] bits, double[] reals, int a, int b) { uint x = unchecked((uint)bits[a]); bits[a] = checked((int)x); }
+
+        private static void convOvfI1UnFromI8(long[] bits, double[] reals, int a, int b) { ulong x = unchecked((ulong)bits[a]); bits[a] = checked((sbyte)x); }
+        private static void convOvfU1UnFromI8(long[] bits, double[] reals, int a, int b) { ulong x = unchecked((ulong)bits[a]); bits[a] = checked((byte)x); }
+        private static void convOvfI2UnFromI8(long[] bits, double[] reals, int a, int b) { ulong x = unchecked((ulong)bits[a]); bits[a] = checked((short)x); }
+        private static void convOvfU2UnFromI8(long[] bits, double[] reals, int a, int b) { ulong x = unchecked((ulong)bits[a]); bits[a] = checked((ushort)x); }
+        private static void convOvfI4UnFromI8(long[] bits, double[] reals, int a, int b) { ulong x = unchecked((ulong)bits[a]); bits[a] = checked((int)x); }
+        private static void convOvfU4UnFromI8(long[] bits, double[] reals, int a, int b) { ulong x = unchecked((ulong)bits[a]); bits[a] = unchecked((int)checked((uint)x)); }
+        private static void convOvfI8UnFromI8(long[] bits, double[] reals, int a, int b) { ulong x = unchecked((ulong)bits[a]); bits[a] = checked((long)x); }
+
+        private static void convI1FromR(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((sbyte)reals[a]); }
+        private static void convU1FromR(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((byte)reals[a]); }
+        private static void convI2FromR(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((short)reals[a]); }
+        private static void convU2FromR(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((ushort)reals[a]); }
+        private static void convI4FromR(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((int)reals[a]); }
+        private static void convU4FromR(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((int)(uint)reals[a]); }
+        private static void convI8FromR(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((long)reals[a]); }
+        private static void convU8FromR(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((long)(ulong)reals[a]); }
+        private static void convR4FromR(long[] bits, double[] reals, int a, int b) { reals[a] = (float)reals[a]; }
+
+        private static void convOvfI1FromR(long[] bits, double[] reals, int a, int b) { bits[a] = checked((sbyte)reals[a]); }
+        private static void convOvfU1FromR(long[] bits, double[] reals, int a, int b) { bits[a] = checked((byte)reals[a]); }
+        private static void convOvfI2FromR(long[] bits, double[] reals, int a, int b) { bits[a] = checked((short)reals[a]); }
+        private static void convOvfU2FromR(long[] bits, double[] reals, int a, int b) { bits[a] = checked((ushort)reals[a]); }
+        private static void convOvfI4FromR(long[] bits, double[] reals, int a, int b) { bits[a] = checked((int)reals[a]); }
+        private static void convOvfU4FromR(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((int)checked((uint)reals[a])); }
+        private static void convOvfI8FromR(long[] bits, double[] reals, int a, int b) { bits[a] = checked((long)reals[a]); }
+        private static void convOvfU8FromR(long[] bits, double[] reals, int a, int b) { bits[a] = unchecked((long)checked((ulong)reals[a])); }
+
+        #endregion
+
+        // ================================================================
+        // Lookup
+        // ----------------------------------------------------------------
+
+        /* Returns kernel of binary operation or null if there is no kernel
+         * for the combination (DataModelUtils should be used then)
+         */
+        public static Kernel GetBinaryKernel(BinaryOp.ArithOp op, bool overflow, bool unsigned,
+            StructValue.TypeIndex typeA, StructValue.TypeIndex typeB)
+        {
+            if (! isStackType(typeA) || ! isStackType(typeB))
+                return null;
+
+            return binaryKernels[binaryIndex(op,overflow,unsigned,typeA,typeB)];
+        }
+
+        /* Returns kernel of unary operation or null */
+        public static Kernel GetUnaryKernel(UnaryOp.ArithOp op, StructValue.TypeIndex type)
+        {
+            if (! isStackType(type))
+                return null;
+
+            return unaryKernels[(int)op*STACK_TYPES + (int)type];
+        }
+
+        /* Returns kernel of conversion to the type or null */
+        public static Kernel GetConvertKernel(StructValue.TypeIndex type, bool overflow, bool unsigned,
+            StructValue.TypeIndex source)
+        {
+            if (type < INT32 || type >= (StructValue.TypeIndex)CONVERT_TYPES || ! isStackType(source))
+                return null;
+
+            return convertKernels[convertIndex(type,overflow,unsigned,source)];
+        }
+    }
+}
@@ -47,6 +47,7 @@ namespace CILPE.DataModel
 			public int[] fields; // == null for primitive types; == new int[0] for types without fields
 			public long primitiveIntValue; // == 0 if not used
 			public double primitiveDoubleValue; // == 0 if not used
+			public object data; // string or bytes of primitive array; == null if not used
 			public int hashCode;
 
 			private int Length(Array array)
@@ -69,6 +70,33 @@ namespace CILPE.DataModel
 				}
 				hashCode ^= primitiveIntValue.GetHashCode();
 				hashCode ^= primitiveDoubleValue.GetHashCode();
+				if(data is string)
+					hashCode ^= data.GetHashCode();
+				else if(data != null)
+				{
+					byte[] bytes = data as byte[];
+					for(int i=0; i<bytes.Length; i++)
+						hashCode = (hashCode << 5) - hashCode + bytes[i];
+				}
+			}
+
+			private static bool DataEquals(object x, object y)
+			{
+				if(x == y)
+					return(true);
+				if(x == null || y == null)
+					return(false);
+				if(x is string)
+					return(x.Equals(y));
+				byte[] xBytes = x as byte[], yBytes = y as byte[];
+				if(yBytes == null || xBytes.Length != yBytes.Length)
+					return(false);
+				for(int i=0; i<xBytes.Length; i++)
+				{
+					if(xBytes[i] != yBytes[i])
+						return(false);
+				}
+				return(true);
 			}
 
 
@@ -78,6 +106,7 @@ namespace CILPE.DataModel
 				this.fields = fields;
 				primitiveIntValue = 0;
 				primitiveDoubleValue = 0.0;
+				data = null;
 				hashCode = 0;
 				CalculateHashCode();
 			}
@@ -88,6 +117,7 @@ namespace CILPE.DataModel
 				this.fields = null;
 				primitiveIntValue = x;
 				primitiveDoubleValue = 0.0;
+				data = null;
 				hashCode = 0;
 				CalculateHashCode();
 			}
@@ -98,6 +128,18 @@ namespace CILPE.DataModel
 				this.fields = null;
 				primitiveIntValue = 0;
 				primitiveDoubleValue = x;
+				data = null;
+				hashCode = 0;
+				CalculateHashCode();
+			}
+
+			public MemoObject(Type type, object data)
+			{
+				this.type = type;
+				this.fields = null;
+				primitiveIntValue = 0;
+				primitiveDoubleValue = 0.0;
+				this.data = data;
 				hashCode = 0;
 				CalculateHashCode();
 			}
@@ -130,6 +172,8 @@ namespace CILPE.DataModel
 					return(false);
 				if(primitiveDoubleValue != obj.primitiveDoubleValue)
 					return(false);
+				if(!DataEquals(data, obj.data))
+					return(false);
 				return(true);
 			}
 
@@ -145,6 +189,127 @@ namespace CILPE.DataModel
 			list[i] = obj;
 		}
 
+		private enum PlanKind
+		{
+			Primitive,
+			String,
+			PrimitiveArray,
+			Array,
+			Object
+		}
+
+		/* Memo plan of a type: field layout and the way objects of the type
+		 * are snapshotted, built once per type
+		 */
+		private sealed class MemoPlan
+		{
+			public readonly PlanKind kind;
+			public readonly TypeCode typeCode; // for primitive types
+			public readonly FieldInfo[] fields; // == null for everything but custom objects
+			public readonly MemberInfo[] members; // the same fields for FormatterServices
+			public readonly bool[] isReference; // fields that are kept in ObjectHashtable
+			public readonly bool elementIsReference; // for arrays
+
+			public MemoPlan(Type type)
+			{
+				typeCode = Type.GetTypeCode(type);
+				fields = null;
+				members = null;
+				isReference = null;
+				elementIsReference = false;
+
+				if(typeof(Pointer).IsAssignableFrom(type))
+					throw new MemoException(); //some mannaged wrapper for unmannaged data...
+
+				if(type.IsPrimitive)
+					kind = PlanKind.Primitive;
+				else if(Equals(type,typeof(string)))
+					kind = PlanKind.String;
+				else if(type.IsArray)
+				{
+					Type elementType = type.GetElementType();
+					if(type.GetArrayRank() > 1)
+						throw new MemoException(); //not supported yet...
+					kind = elementType.IsPrimitive ? PlanKind.PrimitiveArray : PlanKind.Array;
+					elementIsReference = ! elementType.IsValueType;
+				}
+				else
+				{
+					kind = PlanKind.Object;
+					fields = ReflectionUtils.GetAllFields(type);
+					members = new MemberInfo[fields.Length];
+					isReference = new bool[fields.Length];
+					for(int i=0; i<fields.Length; i++)
+					{
+						members[i] = fields[i];
+						isReference[i] = ! fields[i].FieldType.IsValueType;
+					}
+				}
+			}
+		}
+
+		private static Hashtable plans = new Hashtable();
+
+		private static MemoPlan GetPlan(Type type)
+		{
+			MemoPlan plan = plans[type] as MemoPlan;
+			if(plan == null)
+			{
+				plan = new MemoPlan(type);
+				lock(plans)
+				{
+					plans[type] = plan;
+				}
+			}
+			return(plan);
+		}
+
+		private static long PrimitiveToInt64(object obj, TypeCode typeCode)
+		{
+			switch(typeCode)
+			{
+				case TypeCode.Boolean:
+					return((bool)obj ? 1 : 0);
+				case TypeCode.Byte:
+					return((byte)obj);
+				case TypeCode.SByte:
+					return((sbyte)obj);
+				case TypeCode.Char:
+					return((char)obj);
+				case TypeCode.Int16:
+					return((short)obj);
+				case TypeCode.UInt16:
+					return((ushort)obj);
+				case TypeCode.Int32:
+					return((int)obj);
+				case TypeCode.UInt32:
+					return((uint)obj);
+				case TypeCode.Int64:
+					return((long)obj);
+				case TypeCode.UInt64:
+					return(unchecked((long)(ulong)obj));
+				default: //IntPtr? UIntPtr?
+					if(obj is IntPtr)
+						return(((IntPtr)obj).ToInt64());
+					else if(obj is UIntPtr)
+						return(unchecked((long)((UIntPtr)obj).ToUInt64()));
+					else
+						throw new MemoException();
+			}
+		}
+
+		/* Snapshot of a value kept in a field or an array element */
+		private static int MemoValue(object value, bool isReference, ArrayList heap, ObjectHashtable hash)
+		{
+			if(isReference)
+			{
+				int index = hash[value];
+				if(index != ObjectHashtable.NOT_FOUND)
+					return(index);
+			}
+			return(Memo(value, heap, hash, isReference));
+		}
+
 		private static int Memo(object obj, ArrayList heap, ObjectHashtable hash, bool addToHash)
 		{
 			int myIndex = heap.Count;
@@ -152,95 +317,56 @@ namespace CILPE.DataModel
 			if(addToHash) //addToHash == false, when obj is a boxed representation of some non-boxed value 
 			    hash[obj] = myIndex;
 			Type type = obj.GetType();
-			if(typeof(Pointer).IsAssignableFrom(type))
-				throw new MemoException(); //some mannaged wrapper for unmannaged data...
-			if(type.IsPrimitive)
-			{
-				switch(Type.GetTypeCode(type))
-				{ 
-					case TypeCode.Boolean:
-					case TypeCode.Byte:
-					case TypeCode.SByte:
-					case TypeCode.Char:
-					case TypeCode.Int16:
-					case TypeCode.UInt16:
-					case TypeCode.Int32:
-					case TypeCode.UInt32:
-					case TypeCode.Int64:
-					case TypeCode.UInt64:
-						SetElement(heap , myIndex , new MemoObject(type, (obj as IConvertible).ToInt64(null)));
-						return(myIndex); 
-					case TypeCode.Single:
-					case TypeCode.Double:
-						SetElement(heap , myIndex , new MemoObject(type, (obj as IConvertible).ToDouble(null)));
-						return(myIndex);
-					default: //IntPtr? UIntPtr?
-						if(type.Equals(typeof(IntPtr)))
-						{
-							SetElement(heap , myIndex , new MemoObject(type, ((IntPtr)obj).ToInt64()));
-							return(myIndex);
-						}
-						else if(type.Equals(typeof(UIntPtr)))
-						{
-							SetElement(heap , myIndex , new MemoObject(type, (long)((UIntPtr)obj).ToUInt64()));
-							return(myIndex);
-						}
-						else
-							throw new MemoException();
-				}//switch
-			}//if(IsPrimitive)
+			MemoPlan plan = GetPlan(type);
 			int[] fieldIndices;
-			if(Equals(type,typeof(string)))
+			switch(plan.kind)
 			{
-				string str = obj as string;
-				fieldIndices = new int[str.Length];
-				for(int i=0; i<str.Length; i++)
+				case PlanKind.Primitive:
+					if(plan.typeCode == TypeCode.Single || plan.typeCode == TypeCode.Double)
+						SetElement(heap , myIndex , new MemoObject(type, plan.typeCode == TypeCode.Single ? (double)(float)obj : (double)obj));
+					else
+						SetElement(heap , myIndex , new MemoObject(type, PrimitiveToInt64(obj, plan.typeCode)));
+					return(myIndex);
+
+				case PlanKind.String:
+					//strings are immutable, so the string itself is the snapshot
+					SetElement(heap , myIndex , new MemoObject(type, obj));
+					return(myIndex);
+
+				case PlanKind.PrimitiveArray:
 				{
-					char fieldValue = str[i];
-					fieldIndices[i] = Memo(fieldValue, heap, hash, false);
+					Array array = obj as Array;
+					if(array.GetLowerBound(0) != 0)
+						throw new MemoException(); //not supported yet...
+					byte[] bytes = new byte[Buffer.ByteLength(array)];
+					Buffer.BlockCopy(array, 0, bytes, 0, bytes.Length);
+					SetElement(heap , myIndex , new MemoObject(type, (object)bytes));
+					return(myIndex);
 				}
-			}
-			else if(type.IsArray)
-			{
-				Array array = obj as Array;
-				if(array.Rank > 1 || array.GetLowerBound(0) != 0)
-					throw new MemoException(); //not supported yet...
-				fieldIndices = new int[array.Length];
-				bool doAddToHash = ! type.GetElementType().IsValueType;
-				for(int i=0; i<array.Length; i++)
+
+				case PlanKind.Array:
 				{
-					object fieldValue = array.GetValue(i);
-					if(doAddToHash)
+					Array array = obj as Array;
+					if(array.GetLowerBound(0) != 0)
+						throw new MemoException(); //not supported yet...
+					fieldIndices = new int[array.Length];
+					object[] refArray = array as object[];
+					for(int i=0; i<fieldIndices.Length; i++)
 					{
-						object fieldIndexBoxed = hash[fieldValue];
-						if(fieldIndexBoxed != null)
-						{
-							fieldIndices[i] = (int)fieldIndexBoxed;
-							continue;
-						}
+						object fieldValue = refArray != null ? refArray[i] : array.GetValue(i);
+						fieldIndices[i] = MemoValue(fieldValue, plan.elementIsReference, heap, hash);
 					}
-					fieldIndices[i] = Memo(fieldValue, heap, hash, doAddToHash);																				
+					break;
 				}
-			}
-			else
-			{
-				//Custom object
-				FieldInfo[] fieldInfos = ReflectionUtils.GetAllFields(type);
-				fieldIndices = new int[fieldInfos.Length];
-				for(int i=0; i<fieldInfos.Length; i++)
+
+				default:
 				{
-					bool doAddToHash = ! fieldInfos[i].FieldType.IsValueType;
-					object fieldValue = fieldInfos[i].GetValue(obj);
-					if(doAddToHash)
-					{
-						object fieldIndexBoxed = hash[fieldValue];
-						if(fieldIndexBoxed != null)
-						{
-							fieldIndices[i] = (int)fieldIndexBoxed;
-							continue;
-						}
-					}
-					fieldIndices[i] = Memo(fieldValue, heap, hash, doAddToHash);
+					//Custom object
+					object[] fieldValues = FormatterServices.GetObjectData(obj, plan.members);
+					fieldIndices = new int[fieldValues.Length];
+					for(int i=0; i<fieldValues.Length; i++)
+						fieldIndices[i] = MemoValue(fieldValues[i], plan.isReference[i], heap, hash);
+					break;
 				}
 			}
 			SetElement(heap , myIndex , new MemoObject(type, fieldIndices));
@@ -249,7 +375,7 @@ namespace CILPE.DataModel
 
 		private void RecallObject(object obj, int i, object[] objs)
 		{
-			FieldInfo[] fieldInfos = ReflectionUtils.GetAllFields(memo[i].type);
+			FieldInfo[] fieldInfos = GetPlan(memo[i].type).fields;
 			if(fieldInfos.Length != memo[i].fields.Length)
 				throw new MemoException();
 			for(int f=0; f<fieldInfos.Length; f++)
@@ -261,10 +387,22 @@ namespace CILPE.DataModel
 
 		private void RecallArray(Array obj, int i, object[] objs)
 		{
+			if(memo[i].data != null)
+			{
+				//primitive array
+				byte[] bytes = memo[i].data as byte[];
+				Buffer.BlockCopy(bytes, 0, obj, 0, bytes.Length);
+				return;
+			}
+			object[] refArray = obj as object[];
 			for(int f=0; f<obj.Length; f++)
 			{
 				int j = memo[i].fields[f];
-				obj.SetValue( objs[j] != null ? objs[j] : CreateStruct(j,objs) ,f);  
+				object value = objs[j] != null ? objs[j] : CreateStruct(j,objs);
+				if(refArray != null)
+					refArray[f] = value;
+				else
+					obj.SetValue(value, f);
 			}
 		}
 
@@ -386,8 +524,7 @@ namespace CILPE.DataModel
 		{
 			//hash is an (object -> int) mapping, the same that was used while memoizing
 			object[] objs = new object[memo.Length];
-			foreach(object obj in hash.Keys)
-				objs[(int)hash[obj]] = obj;
+			hash.CopyKeysTo(objs);
 			for(int i=0; i<memo.Length; i++)
 			{
 			    object obj = objs[i];
@@ -4,48 +4,153 @@ using System.Collections;
 namespace CILPE.DataModel
 {
 	/// <summary>
-	/// Summary description for ObjectHashtable.
+	/// Map from objects (compared by reference) to int values.
+	/// Open addressing with linear probing, values are stored inline.
+	/// Clear() keeps the allocated table, so the map can be reused.
 	/// </summary>
-	 
-	public class ObjectHashtable : Hashtable
+
+	public class ObjectHashtable
 	{
 		#region private members
 
+		private const int INITIAL_CAPACITY = 32; // power of two
+
+		private object[] keys; // == null for empty slots
+		private int[] values;
+		private int count;
 
-		private class HashCodeProvider : IHashCodeProvider
+		private bool hasNull;
+		private int nullValue;
+
+		private static int Hash(object key, int mask)
 		{
-			public int GetHashCode(object obj){ return(DataModelUtils.GetObjectHashCode(obj)); }
+			//identity hash codes are often sequential, so they are scattered first
+			int h = unchecked(DataModelUtils.GetObjectHashCode(key) * (int)0x9E3779B1);
+			return((h ^ (h >> 16)) & mask);
 		}
 
-		private class Comparer : IComparer
+		//Returns the slot of the key or the empty slot where it should be placed
+		private int FindSlot(object key)
 		{
-			public int Compare(object x, object y){ return(x == y ? 0 : 1); }
+			int mask = keys.Length - 1;
+			int i = Hash(key, mask);
+			object k;
+			while((k = keys[i]) != null && k != key)
+				i = (i + 1) & mask;
+			return(i);
 		}
 
-		object nullValue;
+		private void Grow()
+		{
+			object[] oldKeys = keys;
+			int[] oldValues = values;
+			keys = new object[oldKeys.Length * 2];
+			values = new int[oldKeys.Length * 2];
+			for(int i=0; i<oldKeys.Length; i++)
+			{
+				if(oldKeys[i] != null)
+				{
+					int slot = FindSlot(oldKeys[i]);
+					keys[slot] = oldKeys[i];
+					values[slot] = oldValues[i];
+				}
+			}
+		}
 
 		#endregion
 
+		public const int NOT_FOUND = -1;
+
 		public ObjectHashtable()
-		: base(new HashCodeProvider(),new Comparer())
-		{}
+		{
+			keys = new object[INITIAL_CAPACITY];
+			values = new int[INITIAL_CAPACITY];
+			count = 0;
+			hasNull = false;
+		}
 
-		public override object this[object key]
+		public int Count
+		{
+			get { return(hasNull ? count + 1 : count); }
+		}
+
+		//Getter returns NOT_FOUND for absent keys
+		public int this[object key]
 		{
 			get
 			{
-				if(key == null) 
-					return(nullValue);
-				return(base[key]);
+				if(key == null)
+					return(hasNull ? nullValue : NOT_FOUND);
+				int slot = FindSlot(key);
+				return(keys[slot] != null ? values[slot] : NOT_FOUND);
 			}
 			set
 			{
-				if(key == null) 
+				if(key == null)
+				{
+					hasNull = true;
 					nullValue = value;
-				else
-				    base[key] = value;
+					return;
+				}
+				int slot = FindSlot(key);
+				if(keys[slot] == null)
+				{
+					if((count + 1) * 2 > keys.Length)
+					{
+						Grow();
+						slot = FindSlot(key);
+					}
+					keys[slot] = key;
+					count++;
+				}
+				values[slot] = value;
+			}
+		}
+
+		public bool Contains(object key)
+		{
+			if(key == null)
+				return(hasNull);
+			return(keys[FindSlot(key)] != null);
+		}
+
+		//Returns a new array with all keys of the map
+		public object[] Keys
+		{
+			get
+			{
+				object[] result = new object[Count];
+				int j = 0;
+				if(hasNull)
+					result[j++] = null;
+				for(int i=0; i<keys.Length; i++)
+				{
+					if(keys[i] != null)
+						result[j++] = keys[i];
+				}
+				return(result);
 			}
 		}
 
+		//Puts every key into the array at the position given by its value
+		public void CopyKeysTo(object[] array)
+		{
+			if(hasNull)
+				array[nullValue] = null;
+			for(int i=0; i<keys.Length; i++)
+			{
+				if(keys[i] != null)
+					array[values[i]] = keys[i];
+			}
+		}
+
+		public void Clear()
+		{
+			if(count != 0)
+				Array.Clear(keys, 0, keys.Length);
+			count = 0;
+			hasNull = false;
+		}
+
 	};
 }
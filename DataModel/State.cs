@@ -195,19 +195,19 @@ namespace CILPE.DataModel
 
             protected override void VisitUnaryOp(UnaryOp node, object data)
             {
-                state.Stack.Perform_UnaryOp(node.Op);
+                state.Stack.Perform_UnaryOp(node);
                 nextNode = node.Next;
             }
 
             protected override void VisitBinaryOp(BinaryOp node, object data)
             {
-                state.Stack.Perform_BinaryOp(node.Op,node.Overflow,node.Unsigned,out exc);
+                state.Stack.Perform_BinaryOp(node,out exc);
                 nextNode = node.Next;
             }
 
             protected override void VisitConvertValue(ConvertValue node, object data)
             {
-                state.Stack.Perform_ConvertValue(node.Type,node.Overflow,node.Unsigned,out exc);
+                state.Stack.Perform_ConvertValue(node,out exc);
                 nextNode = node.Next;
             }
 
@@ -450,7 +450,7 @@ namespace CILPE.DataModel
 
         public void Perform_LoadVar(Variable var)
         {
-            Stack.Push(Pool[var].Val.MakeCopy());
+            Stack.PushCopy(Pool[var].Val);
         }
 
         public void Perform_LoadVarAddr(Variable var)
@@ -461,7 +461,7 @@ namespace CILPE.DataModel
 
         public void Perform_StoreVar(Variable var)
         {
-            Pool[var].Val = Stack.Pop().MakeCopy();
+            Pool[var].Val = Stack.PopCopy();
         }
 
         public override string ToString()
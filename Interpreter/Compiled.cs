@@ -0,0 +1,465 @@
+
+// ===========================================================================
+// CILPE - Partial Evaluator for Common Intermediate Language
+// ===========================================================================
+// File:
+//     Compiled.cs
+//
+// Description:
+//     Method bodies translated to arrays of operations for the interpreter
+//
+// Author:
+//     Sergei Skorobogatov (Sergei.Skorobogatov@supercompilers.com)
+// ===========================================================================
+
+
+using System;
+
+namespace CILPE.Interpreter
+{
+    using System.Collections;
+    using CILPE.DataModel;
+    using CILPE.CFG;
+    using CILPE.Exceptions;
+
+    /* Method body translated to an array of operations. Every operation
+     * is bound to its node and knows the indices of its successors, so
+     * the body is run in a loop without visitor dispatch and task stack.
+     * Nodes that have no special operation are performed by
+     * State.InterpretNode
+     */
+    internal class CompiledMethod
+    {
+        /* Name of the MethodBodyBlock option that keeps its compiled form */
+        public const string COMPILED_METHOD_OPTION = "CompiledMethod";
+
+        #region Private and internal members
+
+        private const int EXIT = -1;
+
+        private Operation[] operations; /* operations[0] is the method body block */
+        private Hashtable indices;      /* node -> index of its operation */
+
+        private abstract class Operation
+        {
+            public readonly Node Node;
+            protected int next;
+
+            protected Operation(Node node) { Node = node; }
+
+            /* Resolves successors of the operation */
+            public virtual void Link(CompiledMethod method)
+            {
+                next = method.indexOf(Node.Next);
+            }
+
+            /* Performs the operation and returns the index of next operation */
+            public abstract int Execute(IntVisitor visitor, out Exception exc);
+        }
+
+        private class MethodBodyBlockOp: Operation
+        {
+            public MethodBodyBlockOp(MethodBodyBlock node): base(node) {  }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                exc = null;
+                visitor.InitVariables(Node as MethodBodyBlock);
+                return next;
+            }
+        }
+
+        /* Protected and catch blocks, leave from them */
+        private class GoToOp: Operation
+        {
+            public GoToOp(Node node): base(node) {  }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                exc = null;
+                return next;
+            }
+        }
+
+        /* Leave from the method body */
+        private class ExitOp: Operation
+        {
+            public ExitOp(Node node): base(node) {  }
+
+            public override void Link(CompiledMethod method) {  }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                exc = null;
+                return EXIT;
+            }
+        }
+
+        private class UnsupportedOp: Operation
+        {
+            public UnsupportedOp(Node node): base(node) {  }
+
+            public override void Link(CompiledMethod method) {  }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                throw new NodeNotSupportedException(Node);
+            }
+        }
+
+        private class LoadConstOp: Operation
+        {
+            private object constant;
+
+            public LoadConstOp(LoadConst node): base(node) { constant = node.Constant; }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                exc = null;
+                visitor.State.Stack.Perform_LoadConst(constant);
+                return next;
+            }
+        }
+
+        private class LoadVarOp: Operation
+        {
+            private Variable var;
+
+            public LoadVarOp(LoadVar node): base(node) { var = node.Var; }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                exc = null;
+                visitor.State.Perform_LoadVar(var);
+                return next;
+            }
+        }
+
+        private class StoreVarOp: Operation
+        {
+            private Variable var;
+
+            public StoreVarOp(StoreVar node): base(node) { var = node.Var; }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                exc = null;
+                visitor.State.Perform_StoreVar(var);
+                return next;
+            }
+        }
+
+        private class LoadVarAddrOp: Operation
+        {
+            private Variable var;
+
+            public LoadVarAddrOp(LoadVarAddr node): base(node) { var = node.Var; }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                exc = null;
+                visitor.State.Perform_LoadVarAddr(var);
+                return next;
+            }
+        }
+
+        private class UnaryOpOp: Operation
+        {
+            public UnaryOpOp(UnaryOp node): base(node) {  }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                exc = null;
+                visitor.State.Stack.Perform_UnaryOp(Node as UnaryOp);
+                return next;
+            }
+        }
+
+        private class BinaryOpOp: Operation
+        {
+            private BinaryOp binaryOp;
+
+            public BinaryOpOp(BinaryOp node): base(node) { binaryOp = node; }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                visitor.State.Stack.Perform_BinaryOp(binaryOp,out exc);
+                return next;
+            }
+        }
+
+        private class ConvertValueOp: Operation
+        {
+            private ConvertValue convertValue;
+
+            public ConvertValueOp(ConvertValue node): base(node) { convertValue = node; }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                visitor.State.Stack.Perform_ConvertValue(convertValue,out exc);
+                return next;
+            }
+        }
+
+        private class DuplicateStackTopOp: Operation
+        {
+            public DuplicateStackTopOp(DuplicateStackTop node): base(node) {  }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                exc = null;
+                visitor.State.Stack.Perform_DuplicateStackTop();
+                return next;
+            }
+        }
+
+        private class RemoveStackTopOp: Operation
+        {
+            public RemoveStackTopOp(RemoveStackTop node): base(node) {  }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                exc = null;
+                visitor.State.Stack.Perform_RemoveStackTop();
+                return next;
+            }
+        }
+
+        private class BranchOp: Operation
+        {
+            private int alt;
+
+            public BranchOp(Branch node): base(node) {  }
+
+            public override void Link(CompiledMethod method)
+            {
+                base.Link(method);
+                alt = method.indexOf((Node as Branch).Alt);
+            }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                exc = null;
+                return visitor.State.Stack.Perform_Branch() ? alt : next;
+            }
+        }
+
+        private class SwitchOp: Operation
+        {
+            private int[] targets; /* targets[0] is the default successor */
+
+            public SwitchOp(Switch node): base(node) {  }
+
+            public override void Link(CompiledMethod method)
+            {
+                targets = new int[Node.NextArray.Count];
+                for (int i = 0; i < targets.Length; i++)
+                    targets[i] = method.indexOf(Node.NextArray[i]);
+            }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                exc = null;
+                return targets[visitor.State.Stack.Perform_Switch(targets.Length-1)+1];
+            }
+        }
+
+        private class CallMethodOp: Operation
+        {
+            private CallMethod callMethod;
+
+            public CallMethodOp(CallMethod node): base(node) { callMethod = node; }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                EvaluationStack stack = visitor.State.Stack;
+                ParameterValues paramVals =
+                    stack.Perform_CallMethod(callMethod.Method,callMethod.IsVirtCall);
+
+                if (callMethod.IsVirtCall)
+                    paramVals.ChooseVirtualMethod();
+
+                Value retVal = visitor.CallMethod(paramVals,out exc);
+                if (exc == null && retVal != null)
+                    stack.Push(retVal);
+
+                return next;
+            }
+        }
+
+        private class NewObjectOp: Operation
+        {
+            private NewObject newObject;
+
+            public NewObjectOp(NewObject node): base(node) { newObject = node; }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                ParameterValues paramVals =
+                    visitor.State.Stack.Perform_CreateObject(newObject.Constructor);
+
+                visitor.CallMethod(paramVals,out exc);
+                return next;
+            }
+        }
+
+        private class ThrowExceptionOp: Operation
+        {
+            public ThrowExceptionOp(ThrowException node): base(node) {  }
+
+            public override void Link(CompiledMethod method) {  }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                Exception obj;
+                visitor.State.Stack.Perform_Throw(out obj,out exc);
+                if (exc == null)
+                    exc = obj;
+
+                return EXIT;
+            }
+        }
+
+        /* Any other node supported by State.InterpretNode */
+        private class StateOp: Operation
+        {
+            public StateOp(Node node): base(node) {  }
+
+            public override int Execute(IntVisitor visitor, out Exception exc)
+            {
+                Node nextNode;
+                visitor.State.InterpretNode(Node,out nextNode,out exc);
+
+                if (exc == null && nextNode == null)
+                    throw new NodeNotSupportedException(Node);
+
+                return next;
+            }
+        }
+
+        private static Operation createOperation(Node node)
+        {
+            if (node is MethodBodyBlock)
+                return new MethodBodyBlockOp(node as MethodBodyBlock);
+            if (node is ProtectedBlock || node is CatchBlock)
+                return new GoToOp(node);
+            if (node is Leave)
+            {
+                if (node.Parent is ProtectedBlock || node.Parent is CatchBlock)
+                    return new GoToOp(node);
+                if (node.Parent is MethodBodyBlock)
+                    return new ExitOp(node);
+                return new UnsupportedOp(node);
+            }
+            if (node is Block || node is RethrowException || node is CreateDelegate)
+                return new UnsupportedOp(node);
+
+            if (node is LoadConst)
+                return new LoadConstOp(node as LoadConst);
+            if (node is LoadVar)
+                return new LoadVarOp(node as LoadVar);
+            if (node is StoreVar)
+                return new StoreVarOp(node as StoreVar);
+            if (node is LoadVarAddr)
+                return new LoadVarAddrOp(node as LoadVarAddr);
+            if (node is UnaryOp)
+                return new UnaryOpOp(node as UnaryOp);
+            if (node is BinaryOp)
+                return new BinaryOpOp(node as BinaryOp);
+            if (node is ConvertValue)
+                return new ConvertValueOp(node as ConvertValue);
+            if (node is DuplicateStackTop)
+                return new DuplicateStackTopOp(node as DuplicateStackTop);
+            if (node is RemoveStackTop)
+                return new RemoveStackTopOp(node as RemoveStackTop);
+            if (node is Branch)
+                return new BranchOp(node as Branch);
+            if (node is Switch)
+                return new SwitchOp(node as Switch);
+            if (node is CallMethod)
+                return new CallMethodOp(node as CallMethod);
+            if (node is NewObject)
+                return new NewObjectOp(node as NewObject);
+            if (node is ThrowException)
+                return new ThrowExceptionOp(node as ThrowException);
+
+            return new StateOp(node);
+        }
+
+        /* Adds the node to the list of nodes if it is met for the first time */
+        private void addNode(Node node, ArrayList nodes)
+        {
+            if (node != null && ! indices.ContainsKey(node))
+            {
+                indices[node] = nodes.Count;
+                nodes.Add(node);
+            }
+        }
+
+        private int indexOf(Node node)
+        {
+            return (node == null) ? EXIT : (int)indices[node];
+        }
+
+        private CompiledMethod(MethodBodyBlock body)
+        {
+            ArrayList nodes = new ArrayList();
+            indices = new Hashtable();
+
+            addNode(body,nodes);
+            for (int i = 0; i < nodes.Count; i++)
+            {
+                Node node = nodes[i] as Node;
+
+                for (int j = 0; j < node.NextArray.Count; j++)
+                    addNode(node.NextArray[j],nodes);
+
+                if (node is ProtectedBlock)
+                {
+                    ProtectedBlock tryBlock = node as ProtectedBlock;
+                    for (int j = 0; j < tryBlock.Count; j++)
+                        addNode(tryBlock[j],nodes);
+                }
+            }
+
+            operations = new Operation[nodes.Count];
+            for (int i = 0; i < operations.Length; i++)
+                operations[i] = createOperation(nodes[i] as Node);
+
+            foreach (Operation op in operations)
+                op.Link(this);
+        }
+
+        #endregion
+
+        /* Returns compiled form of the method body,
+         * it is built on the first request
+         */
+        public static CompiledMethod GetCompiledMethod(MethodBodyBlock body)
+        {
+            CompiledMethod method = body.Options[COMPILED_METHOD_OPTION] as CompiledMethod;
+
+            if (method == null)
+                body.Options[COMPILED_METHOD_OPTION] = method = new CompiledMethod(body);
+
+            return method;
+        }
+
+        /* Runs the method body in the state of the visitor */
+        public void Run(IntVisitor visitor)
+        {
+            int index = 0;
+
+            while (index != EXIT)
+            {
+                Operation op = operations[index];
+                Exception exc;
+
+                index = op.Execute(visitor,out exc);
+
+                if (exc != null)
+                    index = indexOf(visitor.CatchException(op.Node,exc));
+            }
+        }
+    }
+}
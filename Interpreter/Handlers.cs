@@ -0,0 +1,104 @@
+
+// ===========================================================================
+// CILPE - Partial Evaluator for Common Intermediate Language
+// ===========================================================================
+// File:
+//     Handlers.cs
+//
+// Description:
+//     Tables of exception handlers for the interpreter
+//
+// Author:
+//     Sergei Skorobogatov (Sergei.Skorobogatov@supercompilers.com)
+// ===========================================================================
+
+
+using System;
+
+namespace CILPE.Interpreter
+{
+    using System.Collections;
+    using CILPE.CFG;
+
+    /* Catch blocks of all protected blocks enclosing some block, ordered
+     * from the innermost protected block to the outermost one. The table
+     * is built once for each block and remembers the handler found for
+     * every exception type
+     */
+    internal class HandlerTable
+    {
+        /* Name of the Block option that keeps its handler table */
+        public const string HANDLER_TABLE_OPTION = "HandlerTable";
+
+        #region Private and internal members
+
+        private static readonly object NO_HANDLER = new object();
+
+        private Type[] catchTypes;
+        private CatchBlock[] catchBlocks;
+        private Hashtable matches; /* exception type -> CatchBlock or NO_HANDLER */
+
+        private HandlerTable(Block block)
+        {
+            ArrayList handlers = new ArrayList();
+
+            for (Block parent = block; ! (parent is MethodBodyBlock); parent = parent.Parent)
+            {
+                if (parent is ProtectedBlock)
+                {
+                    ProtectedBlock tryBlock = parent as ProtectedBlock;
+
+                    for (int count = 0; count < tryBlock.Count; count++)
+                        if (tryBlock[count] is CatchBlock)
+                            handlers.Add(tryBlock[count]);
+                }
+            }
+
+            catchBlocks = handlers.ToArray(typeof(CatchBlock)) as CatchBlock[];
+            catchTypes = new Type[catchBlocks.Length];
+            for (int i = 0; i < catchBlocks.Length; i++)
+                catchTypes[i] = catchBlocks[i].Type;
+
+            matches = new Hashtable();
+        }
+
+        #endregion
+
+        /* Returns handler table of the block, it is built on the first request */
+        public static HandlerTable GetHandlerTable(Block block)
+        {
+            HandlerTable table = block.Options[HANDLER_TABLE_OPTION] as HandlerTable;
+
+            if (table == null)
+                block.Options[HANDLER_TABLE_OPTION] = table = new HandlerTable(block);
+
+            return table;
+        }
+
+        /* Returns the first catch block that accepts exceptions
+         * of the given type or null if there is no such block
+         */
+        public CatchBlock FindHandler(Type excType)
+        {
+            if (catchBlocks.Length == 0)
+                return null;
+
+            object match = matches[excType];
+
+            if (match == null)
+            {
+                match = NO_HANDLER;
+                for (int i = 0; i < catchTypes.Length; i++)
+                    if (catchTypes[i].IsAssignableFrom(excType))
+                    {
+                        match = catchBlocks[i];
+                        break;
+                    }
+
+                matches[excType] = match;
+            }
+
+            return match as CatchBlock;
+        }
+    }
+}
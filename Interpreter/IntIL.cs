@@ -52,6 +52,11 @@ namespace CILPE.Interpreter
 
         private string indent;
 
+        /* Method bodies are translated to arrays of operations and run
+         * in a loop (see CompiledMethod) instead of being visited node by node
+         */
+        public static bool CompiledMode = true;
+
         protected override void DispatchNode(Node node, object data)
         {
 //            Console.WriteLine(indent + state.ToString());
@@ -74,32 +79,14 @@ namespace CILPE.Interpreter
 
         private void AddTask(Node node) { AddTask(node,null); }
 
-        private void HandleException(Node node, Exception exc)
+        /* Searches the handler of exception thrown by the node. If the handler
+         * is found the stack is prepared for it, otherwise the exception
+         * becomes unhandled. Returns the handler or null
+         */
+        internal Node CatchException(Node node, Exception exc)
         {
-            // Searching appropriate handler
-            Type excType = exc.GetType();
-            EHBlock handler = null;
-            Block parent = node.Parent;
-            while (! (parent is MethodBodyBlock))
-            {
-                if (parent is ProtectedBlock)
-                {
-                    ProtectedBlock tryBlock = parent as ProtectedBlock;
-
-                    for (int count = 0; count < tryBlock.Count && handler == null; count++)
-                    {
-                        if (tryBlock[count] is CatchBlock)
-                        {
-                            CatchBlock catchBlock = tryBlock[count] as CatchBlock;
-
-                            if (catchBlock.Type.IsAssignableFrom(excType))
-                                handler = catchBlock;
-                        }
-                    }
-                }
-                
-                parent = parent.Parent;
-            }
+            CatchBlock handler =
+                HandlerTable.GetHandlerTable(node.Parent).FindHandler(exc.GetType());
 
             if (handler == null)
                 unhandledException = exc;
@@ -107,8 +94,35 @@ namespace CILPE.Interpreter
             {
                 state.Stack.Clear();
                 state.Stack.Push(new ObjectReferenceValue(exc));
-                AddTask(handler);
             }
+
+            return handler;
+        }
+
+        private void HandleException(Node node, Exception exc)
+        {
+            Node handler = CatchException(node,exc);
+            if (handler != null)
+                AddTask(handler);
+        }
+
+        internal State State { get { return state; } }
+
+        /* Initializes local variables of the method body */
+        internal void InitVariables(MethodBodyBlock body)
+        {
+            foreach (Variable var in body.Variables)
+                if (! state.Pool.ContainsVar(var))
+                    state.Pool[var] = new Location(var.Type);
+        }
+
+        /* Calls the method, methods with known body are interpreted */
+        internal Value CallMethod(ParameterValues paramVals, out Exception exc)
+        {
+            if (holder.ContainsMethodBody(paramVals.Method))
+                return InterpretMethod(holder,holder[paramVals.Method],paramVals,out exc,indent+"    ");
+
+            return paramVals.Invoke(out exc);
         }
 
         internal IntVisitor(GraphProcessor graphProcessor, MethodBodyHolder holder, string indent):
@@ -120,10 +134,7 @@ namespace CILPE.Interpreter
 
         protected override void VisitMethodBodyBlock(MethodBodyBlock node, object data)
         {
-            foreach (Variable var in node.Variables)
-                if (! state.Pool.ContainsVar(var))
-                    state.Pool[var] = new Location(var.Type);
-
+            InitVariables(node);
             AddTask(node.Next);
         }
 
@@ -170,13 +181,8 @@ namespace CILPE.Interpreter
 			if (node.IsVirtCall)
 				paramVals.ChooseVirtualMethod();
 
-            Exception exc = null;
-            Value retVal = null;
-
-            if (holder.ContainsMethodBody(paramVals.Method))
-                retVal = InterpretMethod(holder,holder[paramVals.Method],paramVals,out exc,indent+"    ");
-            else
-                retVal = paramVals.Invoke(out exc);
+            Exception exc;
+            Value retVal = CallMethod(paramVals,out exc);
 
             if (exc == null)
             {
@@ -205,12 +211,8 @@ namespace CILPE.Interpreter
             ParameterValues paramVals =
                 state.Stack.Perform_CreateObject(node.Constructor);
 
-            Exception exc = null;
-
-            if (holder.ContainsMethodBody(paramVals.Method))
-                InterpretMethod(holder,holder[paramVals.Method],paramVals,out exc,indent+"    ");
-            else
-                paramVals.Invoke(out exc);
+            Exception exc;
+            CallMethod(paramVals,out exc);
 
             if (exc == null)
                 AddTask(node.Next);
@@ -224,7 +226,7 @@ namespace CILPE.Interpreter
         {
             exc = null;
 
-            GraphProcessor graphProcessor = new GraphProcessor();
+            GraphProcessor graphProcessor = CompiledMode ? null : new GraphProcessor();
             IntVisitor visitor = new IntVisitor(graphProcessor,holder,indent);
             visitor.state = new State(body.Variables.Count);
 
@@ -232,8 +234,13 @@ namespace CILPE.Interpreter
             foreach (Variable var in body.Variables.ParameterMapper)
                 visitor.state.Pool[var] = paramVals[paramCount++];
             
-            visitor.AddTask(body);
-            graphProcessor.Process();
+            if (CompiledMode)
+                CompiledMethod.GetCompiledMethod(body).Run(visitor);
+            else
+            {
+                visitor.AddTask(body);
+                graphProcessor.Process();
+            }
 
             Value result = null;
             if (visitor.unhandledException != null)
@@ -88,7 +88,12 @@ namespace CILPE
             "Options:\n"+
             "    /TARGET=<target file>      Put residual assembly to specified file\n"+
             "    /NOPOSTPROC                Disable postprocessing\n"+
+            "    /VALNUM                    Reuse repeated computations while postprocessing\n"+
+            "    /DEVIRT=<number>           Call methods directly for up to <number> receiver types\n"+
+            "    /INLINE=<number>           Inline residual methods of up to <number> nodes\n"+
             "    /CLOCK                     Measure and report partial evaluation times\n"+
+            "    /MULTITHREAD               Annotate and specialize in parallel threads\n"+
+            "    /ANNCACHE=<file>           Reuse annotations kept in the file by previous runs\n"+
             "    /SRCCFG                    Show source CFG\n"+
             "    /BTACFG                    Show annotated CFG\n"+
             "    /RESCFG                    Show residual CFG\n"+
@@ -113,12 +118,60 @@ namespace CILPE
         static bool showProgress = true;
         static bool showUsage = false;
 
+		/* Number of annotated nodes with most residual copies reported by /CLOCK */
+		const int MEMO_STATISTICS_SHOWN = 10;
+
 		static TimeSpan btaTime, specTime, pprocTime;
 		static DateTime markedTime;
 
 		static void markTime() { markedTime = DateTime.Now; }
 		static TimeSpan getSpan() { return DateTime.Now - markedTime; }
 
+        static int processorsNumber()
+        {
+            try
+            {
+                return Math.Max(Int32.Parse(Environment.GetEnvironmentVariable("NUMBER_OF_PROCESSORS")), 1);
+            }
+            catch (ArgumentNullException)
+            {
+                return 2;
+            }
+            catch (FormatException)
+            {
+                return 2;
+            }
+            catch (OverflowException)
+            {
+                return 2;
+            }
+            catch (System.Security.SecurityException)
+            {
+                return 2;
+            }
+        }
+
+        /* Parses the number in the option of form /OPTION=<number> */
+        static int parseNumber(string arg)
+        {
+            string[] s = arg.Split('=');
+            if (s.Length != 2)
+                throw new ArgSyntaxErrorException(arg);
+
+            try
+            {
+                return Int32.Parse(s[1]);
+            }
+            catch (FormatException)
+            {
+                throw new ArgSyntaxErrorException(arg);
+            }
+            catch (OverflowException)
+            {
+                throw new ArgSyntaxErrorException(arg);
+            }
+        }
+
         static void parseArgs(string[] args)
         {
             if (args.Length == 0)
@@ -178,6 +231,31 @@ namespace CILPE
                             enableClock = true;
                             break;
 
+                        case 'D':
+                            ResidualAssemblyHolder.DevirtualizationLimit = parseNumber(args[i]);
+                            break;
+
+                        case 'I':
+                            ResidualAssemblyHolder.InliningLimit = parseNumber(args[i]);
+                            break;
+
+                        case 'V':
+                            BasicBlocksGraph.ValueNumbering = true;
+                            break;
+
+                        case 'M':
+                            AnnotatedAssemblyHolder.ConcurrentAnnotation = true;
+                            ResidualAssemblyHolder.SpecializationThreads = processorsNumber();
+                            break;
+
+                        case 'A':
+                            string[] cacheArg = args[i].Split('=');
+                            if (cacheArg.Length != 2 || cacheArg[1] == "")
+                                throw new ArgSyntaxErrorException(args[i]);
+
+                            AnnotatedAssemblyHolder.AnnotationCacheFile = cacheArg[1];
+                            break;
+
                         case 'S':
                             showSourceCFG = true;
                             break;
@@ -209,6 +287,12 @@ namespace CILPE
 
                 if (showPostprocessedCFG && ! enablePostprocessing)
                     throw new OptionsConflictException("/NOPOSTPROC","/POSTCFG");
+
+                if (BasicBlocksGraph.ValueNumbering && ! enablePostprocessing)
+                    throw new OptionsConflictException("/NOPOSTPROC","/VALNUM");
+
+                if (ResidualAssemblyHolder.InliningLimit > 0 && ! enablePostprocessing)
+                    throw new OptionsConflictException("/NOPOSTPROC","/INLINE");
             }
         }
 
@@ -282,11 +366,33 @@ namespace CILPE
 			if (enableClock)
 			{
 				Console.WriteLine("Timings:");
-				Console.WriteLine("    BTA             - " + btaTime);
+				Console.WriteLine("    BTA             - " + btaTime +
+					" (" + btaHolder.AnnotationsNumber + " annotations, " + btaHolder.LiftsNumber + " lifts, " +
+					btaHolder.ReusedMethodsNumber + " methods reused)");
 				Console.WriteLine("    Specializer     - " + specTime);
 
 				if (enablePostprocessing)
-					Console.WriteLine("    Postprocessing  - " + pprocTime);
+					Console.WriteLine("    Postprocessing  - " + pprocTime +
+						" (" + resHolder.TailCallsNumber + " tail calls looped, " +
+						resHolder.InlinedCallsNumber + " calls inlined, " +
+						resHolder.FoldedMethodsNumber + " methods folded, " +
+						resHolder.ReplacedObjectsNumber + " objects replaced, " +
+						resHolder.SplitVariablesNumber + " structs split)");
+
+				MemoStatistics[] memoStats = resHolder.GetMemoStatistics();
+				int hits = 0, misses = 0, copies = 0;
+				foreach (MemoStatistics stat in memoStats)
+				{
+					hits += stat.Hits;
+					misses += stat.Misses;
+					copies += stat.ResidualCopies;
+				}
+
+				Console.WriteLine("Memoization:");
+				Console.WriteLine("    " + hits + " hits, " + misses + " misses, " + copies + " residual copies");
+				for (int i = 0; i < memoStats.Length && i < MEMO_STATISTICS_SHOWN; i++)
+					Console.WriteLine("    " + memoStats[i] + " " +
+						memoStats[i].Method.DeclaringType + "." + memoStats[i].Method.Name + ": " + memoStats[i].Node);
 			}
         }
 
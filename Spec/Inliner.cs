@@ -0,0 +1,337 @@
+// =============================================================================
+// CILPE - Partial Evaluator for Common Intermediate Language
+// =============================================================================
+// File:
+//     Inliner.cs
+//
+// Description:
+//     Inlining of small residual methods
+//
+// Author:
+//     Yuri Klimov (yuri.klimov@cilpe.net)
+// =============================================================================
+
+using System;
+
+namespace CILPE.Spec
+{
+    using System.Collections;
+    using CILPE.CFG;
+
+
+    /* Calls of residual methods are replaced by copies of their bodies if
+     * the callee is not a constructor, has no exception handling blocks and
+     * is not larger than the size limit. Callees with a single call site may
+     * be several times larger, because their bodies are removed afterwards.
+     * Inlining is performed in a limited number of rounds, each round inlines
+     * only the calls that existed before it, so recursive methods are
+     * unfolded a bounded number of times.
+     */
+    internal class ResidualInliner
+    {
+        #region Private static members
+
+        private const int ROUNDS = 3;
+
+        private const int SINGLE_CALL_FACTOR = 4;
+
+        private const int CALLER_SIZE_LIMIT = 5000;
+
+        /* Returns nodes of the body in order of reaching them,
+         * null if the body contains blocks
+         */
+        private static ArrayList getNodes (MethodBodyBlock mbb)
+        {
+            ArrayList nodes = new ArrayList();
+            Hashtable visited = new Hashtable();
+            Queue queue = new Queue();
+
+            visited[mbb] = true;
+            queue.Enqueue(mbb);
+            while (queue.Count > 0)
+            {
+                Node node = queue.Dequeue() as Node;
+                if (node is Block && node != mbb)
+                    return null;
+                if (node != mbb)
+                    nodes.Add(node);
+
+                for (int i = 0; i < node.NextArray.Count; i++)
+                {
+                    Node next = node.NextArray[i];
+                    if (next != null && ! visited.ContainsKey(next))
+                    {
+                        visited[next] = true;
+                        queue.Enqueue(next);
+                    }
+                }
+            }
+
+            return nodes;
+        }
+
+        /* Returns residual calls of the body and the number of its nodes */
+        private static ArrayList getCalls (MethodBodyBlock mbb, out int size)
+        {
+            Collector collector = new Collector();
+            ForEachVisitor.ForEach(mbb, new ForEachCallback(collector.Callback));
+            size = collector.Size;
+
+            return collector.Calls;
+        }
+
+        private static Node cloneNode (Node node, Hashtable vars)
+        {
+            Node clone;
+            if (node is LoadVar)
+                clone = new LoadVar(vars[(node as LoadVar).Var] as Variable);
+            else if (node is LoadVarAddr)
+                clone = new LoadVarAddr(vars[(node as LoadVarAddr).Var] as Variable);
+            else if (node is StoreVar)
+                clone = new StoreVar(vars[(node as StoreVar).Var] as Variable);
+            else
+            {
+                clone = node.Clone();
+                if (clone is CallMethod)
+                    (clone as CallMethod).IsTailCall = false;
+            }
+
+            ResidualMethod method = Specialization.GetResidualMethod(node);
+            if (method != null)
+                Specialization.SetResidualMethod(clone, method);
+
+            return clone;
+        }
+
+        /* Replaces the call by the copy of the callee body */
+        private static void inline (MethodBodyBlock mbb, CallMethod call, MethodBodyBlock callee, ArrayList nodes)
+        {
+            Hashtable vars = new Hashtable();
+            foreach (Variable var in callee.Variables)
+                vars[var] = mbb.Variables.CreateVar(var.Type, VariableKind.Local);
+
+            /* Arguments are popped to parameter copies, local copies
+             * are initialized like locals on method entry
+             */
+            ArrayList chain = new ArrayList();
+            ParameterMapper parameters = callee.Variables.ParameterMapper;
+            for (int i = parameters.Count - 1; i >= 0; i--)
+                chain.Add(new StoreVar(vars[parameters[i]] as Variable));
+            foreach (Variable var in callee.Variables)
+                if (var.Kind == VariableKind.Local)
+                    ResidualInliner.AddInitialization(chain, vars[var] as Variable);
+
+            Hashtable clones = new Hashtable();
+            foreach (Node node in nodes)
+                if (! (node is Leave))
+                    clones[node] = ResidualInliner.cloneNode(node, vars);
+
+            Node continuation = call.Next;
+            Node entry = callee.Next is Leave ? continuation : clones[callee.Next] as Node;
+            chain.Add(entry);
+
+            call.ReplaceByNode(chain[0] as Node);
+            for (int i = 1; i < chain.Count; i++)
+                (chain[i-1] as Node).Next = chain[i] as Node;
+            call.RemoveFromGraph();
+
+            foreach (Node node in nodes)
+                if (! (node is Leave))
+                {
+                    Node clone = clones[node] as Node;
+                    for (int i = 0; i < node.NextArray.Count; i++)
+                    {
+                        Node next = node.NextArray[i];
+                        if (next is Leave)
+                            clone.NextArray[i] = continuation;
+                        else if (next != null)
+                            clone.NextArray[i] = clones[next] as Node;
+                    }
+                }
+        }
+
+        #endregion
+
+        #region Private members
+
+        private readonly ResidualAssemblyHolder holder;
+
+        private readonly int sizeLimit;
+
+        /* Residual method -> nodes of its body, null if it can not be inlined */
+        private readonly Hashtable bodies;
+
+        /* Residual method -> number of its call sites */
+        private readonly Hashtable sites;
+
+        private readonly Hashtable callers;
+
+        private readonly Hashtable callees;
+
+        private int count;
+
+        private ArrayList getBody (ResidualMethod method)
+        {
+            if (! this.bodies.ContainsKey(method))
+            {
+                ArrayList nodes = null;
+                if (! method.IsConstructor && this.holder.ContainsMethodBody(method))
+                {
+                    MethodBodyBlock mbb = this.holder[method];
+                    nodes = ResidualInliner.getNodes(mbb);
+                    foreach (Variable var in mbb.Variables)
+                        if (var.Kind == VariableKind.ArgList)
+                            nodes = null;
+                }
+                this.bodies[method] = nodes;
+            }
+
+            return this.bodies[method] as ArrayList;
+        }
+
+        private bool isWorthInlining (ResidualMethod method, ArrayList nodes)
+        {
+            object sites = this.sites[method];
+            if (sites != null && (int) sites == 1)
+                return nodes.Count <= this.sizeLimit * ResidualInliner.SINGLE_CALL_FACTOR;
+            else
+                return nodes.Count <= this.sizeLimit;
+        }
+
+        private void performRound ()
+        {
+            this.bodies.Clear();
+            this.sites.Clear();
+
+            Hashtable calls = new Hashtable();
+            Hashtable sizes = new Hashtable();
+            foreach (ResidualMethod method in this.holder.getMethods())
+            {
+                int size;
+                ArrayList methodCalls = ResidualInliner.getCalls(this.holder[method], out size);
+                calls[method] = methodCalls;
+                sizes[method] = size;
+                foreach (Node call in methodCalls)
+                {
+                    ResidualMethod callee = Specialization.GetResidualMethod(call);
+                    object sites = this.sites[callee];
+                    this.sites[callee] = sites == null ? 1 : (int) sites + 1;
+                }
+            }
+
+            foreach (ResidualMethod method in calls.Keys)
+            {
+                MethodBodyBlock mbb = this.holder[method];
+                int size = (int) sizes[method];
+
+                foreach (CallMethod call in calls[method] as ArrayList)
+                {
+                    ResidualMethod callee = Specialization.GetResidualMethod(call);
+                    if (callee == method)
+                        continue;
+
+                    ArrayList body = this.getBody(callee);
+                    if (body == null || ! this.isWorthInlining(callee, body) || size + body.Count > ResidualInliner.CALLER_SIZE_LIMIT)
+                        continue;
+
+                    ResidualInliner.inline(mbb, call, this.holder[callee], body);
+                    this.bodies.Remove(method);
+                    size += body.Count;
+                    this.callers[mbb] = true;
+                    this.callees[callee] = true;
+                    this.count++;
+                }
+            }
+        }
+
+        #endregion
+
+        #region Internal static members
+
+        /* Adds nodes that reset the variable to its value on method entry */
+        internal static void AddInitialization (ArrayList chain, Variable var)
+        {
+            Type type = var.Type;
+            if (type.IsValueType && (! type.IsPrimitive || type == typeof(IntPtr) || type == typeof(UIntPtr)))
+            {
+                chain.Add(new LoadVarAddr(var));
+                chain.Add(new InitValue(type));
+            }
+            else
+            {
+                chain.Add(new LoadConst(ScalarReplacement.DefaultValue(type)));
+                chain.Add(new StoreVar(var));
+            }
+        }
+
+        #endregion
+
+        internal ResidualInliner (ResidualAssemblyHolder holder, int sizeLimit)
+        {
+            this.holder = holder;
+            this.sizeLimit = sizeLimit;
+            this.bodies = new Hashtable();
+            this.sites = new Hashtable();
+            this.callers = new Hashtable();
+            this.callees = new Hashtable();
+            this.count = 0;
+        }
+
+        internal void Perform ()
+        {
+            for (int i = 0; i < ResidualInliner.ROUNDS; i++)
+            {
+                int count = this.count;
+                this.performRound();
+                if (this.count == count)
+                    break;
+            }
+        }
+
+        /* Method bodies that calls were inlined into */
+        internal ICollection Callers
+        {
+            get
+            {
+                return this.callers.Keys;
+            }
+        }
+
+        /* Residual methods that were inlined at least once */
+        internal ICollection Callees
+        {
+            get
+            {
+                return this.callees.Keys;
+            }
+        }
+
+        /* Number of inlined calls */
+        internal int Count
+        {
+            get
+            {
+                return this.count;
+            }
+        }
+
+        #region Private classes
+
+        private class Collector
+        {
+            internal readonly ArrayList Calls = new ArrayList();
+
+            internal int Size = 0;
+
+            internal void Callback (Node node)
+            {
+                this.Size++;
+                if (node is CallMethod && ! (node as CallMethod).IsVirtCall && Specialization.GetResidualMethod(node) != null)
+                    this.Calls.Add(node);
+            }
+        }
+
+
+        #endregion
+    }
+}
@@ -0,0 +1,235 @@
+// =============================================================================
+// CILPE - Partial Evaluator for Common Intermediate Language
+// =============================================================================
+// File:
+//     MemoTable.cs
+//
+// Description:
+//     Memoization of specialization states at annotated nodes
+//
+// Author:
+//     Yuri Klimov (yuri.klimov@cilpe.net)
+// =============================================================================
+
+using System;
+
+namespace CILPE.Spec
+{
+    using System.Collections;
+    using System.Reflection;
+    using System.Threading;
+    using CILPE.CFG;
+    using CILPE.DataModel;
+
+
+    /* Memoization counters of an annotated node. Counters are shared by all
+     * residual methods specialized from the same annotated method body.
+     */
+    public class MemoStatistics
+    {
+        #region Private members
+
+        private readonly Node downNode;
+
+        private readonly MethodBase method;
+
+        private int hits;
+
+        private int misses;
+
+        private int copies;
+
+        #endregion
+
+        #region Internal members
+
+        internal MemoStatistics (Node downNode, MethodBase method)
+        {
+            this.downNode = downNode;
+            this.method = method;
+            this.hits = 0;
+            this.misses = 0;
+            this.copies = 0;
+        }
+
+        internal void AddHit ()
+        {
+            Interlocked.Increment(ref this.hits);
+        }
+
+        internal void AddMiss ()
+        {
+            Interlocked.Increment(ref this.misses);
+        }
+
+        internal void AddCopy ()
+        {
+            Interlocked.Increment(ref this.copies);
+        }
+
+        #endregion
+
+        public Node Node
+        {
+            get
+            {
+                return this.downNode;
+            }
+        }
+
+        public MethodBase Method
+        {
+            get
+            {
+                return this.method;
+            }
+        }
+
+        /* Number of states found in the memo table */
+        public int Hits
+        {
+            get
+            {
+                return this.hits;
+            }
+        }
+
+        /* Number of states not found in the memo table */
+        public int Misses
+        {
+            get
+            {
+                return this.misses;
+            }
+        }
+
+        /* Number of residual nodes generated for the annotated node */
+        public int ResidualCopies
+        {
+            get
+            {
+                return this.copies;
+            }
+        }
+
+        public override string ToString ()
+        {
+            return this.hits + "/" + this.misses + "/" + this.copies;
+        }
+    }
+
+
+    /* Residual nodes generated for annotated nodes of one residual method,
+     * indexed by annotated node and hash code of memorized state. States
+     * are compared only with the states in the bucket of their hash code.
+     */
+    internal class MemoTable
+    {
+        #region Private classes
+
+        private class Entry
+        {
+            internal readonly MemoState MemoState;
+
+            internal Node UpNode;
+
+            internal Variable[] Variables;
+
+            internal readonly Entry Next;
+
+            internal Entry (MemoState memo, Node upNode, Variable[] vars, Entry next)
+            {
+                this.MemoState = memo;
+                this.UpNode = upNode;
+                this.Variables = vars;
+                this.Next = next;
+            }
+        }
+
+
+        #endregion
+
+        #region Private members
+
+        private readonly ResidualAssemblyHolder holder;
+
+        private readonly MethodBase method;
+
+        /* Annotated node -> (hash code -> chain of entries) */
+        private readonly Hashtable nodes;
+
+        private Hashtable getBuckets (Node downNode)
+        {
+            Hashtable buckets = this.nodes[downNode] as Hashtable;
+            if (buckets == null)
+                this.nodes[downNode] = buckets = new Hashtable();
+
+            return buckets;
+        }
+
+        private static Entry find (Entry entry, MemoState memo)
+        {
+            for (; entry != null; entry = entry.Next)
+                if (entry.MemoState.Equals(memo))
+                    return entry;
+
+            return null;
+        }
+
+        #endregion
+
+        internal MemoTable (ResidualAssemblyHolder holder, MethodBase method)
+        {
+            this.holder = holder;
+            this.method = method;
+            this.nodes = new Hashtable();
+        }
+
+        /* Looks for the residual node generated for the annotated node
+         * in the same state, counts a hit or a miss of the node
+         */
+        internal bool Lookup (Node downNode, MemoSpecState memo, out Node upNode, out Variable[] vars)
+        {
+            object hash = memo.MemoState.GetHashCode();
+            Entry entry = MemoTable.find(this.getBuckets(downNode)[hash] as Entry, memo.MemoState);
+
+            MemoStatistics stat = this.holder.GetMemoStatistics(downNode, this.method);
+            if (entry == null)
+            {
+                stat.AddMiss();
+                upNode = null;
+                vars = null;
+                return false;
+            }
+            else
+            {
+                stat.AddHit();
+                upNode = entry.UpNode;
+                vars = entry.Variables;
+                return true;
+            }
+        }
+
+        /* Remembers the residual node for the annotated node in the state,
+         * counts a residual copy of the node if the state is new
+         */
+        internal void Add (Node downNode, MemoSpecState memo, Node upNode)
+        {
+            Hashtable buckets = this.getBuckets(downNode);
+            object hash = memo.MemoState.GetHashCode();
+            Entry chain = buckets[hash] as Entry;
+            Entry entry = MemoTable.find(chain, memo.MemoState);
+
+            if (entry == null)
+            {
+                buckets[hash] = new Entry(memo.MemoState, upNode, memo.Variables, chain);
+                this.holder.GetMemoStatistics(downNode, this.method).AddCopy();
+            }
+            else
+            {
+                entry.UpNode = upNode;
+                entry.Variables = memo.Variables;
+            }
+        }
+    }
+}
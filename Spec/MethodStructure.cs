@@ -0,0 +1,212 @@
+// =============================================================================
+// CILPE - Partial Evaluator for Common Intermediate Language
+// =============================================================================
+// File:
+//     MethodStructure.cs
+//
+// Description:
+//     Canonical structure of residual method bodies
+//
+// Author:
+//     Yuri Klimov (yuri.klimov@cilpe.net)
+// =============================================================================
+
+using System;
+
+namespace CILPE.Spec
+{
+    using System.Collections;
+    using CILPE.CFG;
+
+
+    /* Canonical form of a residual method body: a list of tokens that
+     * describes its signature, its nodes in order of reaching them, their
+     * operands and successors. Variables are numbered in order of their
+     * first use, residual callees are replaced by the methods they are
+     * folded into. Bodies with equal structures are interchangeable.
+     */
+    internal class MethodStructure
+    {
+        #region Private static members
+
+        private static readonly object NULL = new object();
+
+        private static object constantToken (object constant)
+        {
+            /* Equals does not distinguish 0.0 and -0.0 */
+            if (constant is double)
+                return BitConverter.DoubleToInt64Bits((double) constant);
+            else if (constant is float)
+                return BitConverter.DoubleToInt64Bits((float) constant);
+            else
+                return constant == null ? MethodStructure.NULL : constant;
+        }
+
+        #endregion
+
+        #region Private members
+
+        private readonly ArrayList tokens;
+
+        private readonly Hashtable nodes;
+
+        private readonly Hashtable vars;
+
+        private readonly int hashCode;
+
+        private int getNode (Node node, ArrayList order)
+        {
+            if (node == null)
+                return -1;
+
+            object index = this.nodes[node];
+            if (index == null)
+            {
+                this.nodes[node] = index = order.Count;
+                order.Add(node);
+            }
+
+            return (int) index;
+        }
+
+        private void addVar (Variable var)
+        {
+            object index = this.vars[var];
+            if (index == null)
+            {
+                this.vars[var] = index = this.vars.Count;
+                this.tokens.Add(var.Type);
+                this.tokens.Add(var.Kind);
+            }
+
+            this.tokens.Add(index);
+        }
+
+        private void addCallee (Node node, Hashtable folded)
+        {
+            ResidualMethod method = Specialization.GetResidualMethod(node);
+            while (method != null && folded.ContainsKey(method))
+                method = folded[method] as ResidualMethod;
+
+            this.tokens.Add(method == null ? MethodStructure.NULL : method);
+        }
+
+        private bool addNode (Node node, Hashtable folded)
+        {
+            this.tokens.Add(node.GetType());
+
+            if (node is Block && ! (node is MethodBodyBlock))
+                return false;
+            else if (node is ITypedNode)
+                this.tokens.Add((node as ITypedNode).Type);
+
+            if (node is LoadConst)
+            {
+                object constant = (node as LoadConst).Constant;
+                this.tokens.Add(constant == null ? MethodStructure.NULL : constant.GetType());
+                this.tokens.Add(MethodStructure.constantToken(constant));
+            }
+            else if (node is UnaryOp)
+                this.tokens.Add((node as UnaryOp).Op);
+            else if (node is BinaryOp)
+            {
+                BinaryOp binaryOp = node as BinaryOp;
+                this.tokens.Add(binaryOp.Op);
+                this.tokens.Add(binaryOp.Overflow);
+                this.tokens.Add(binaryOp.Unsigned);
+            }
+            else if (node is ConvertValue)
+            {
+                ConvertValue convertValue = node as ConvertValue;
+                this.tokens.Add(convertValue.Overflow);
+                this.tokens.Add(convertValue.Unsigned);
+            }
+            else if (node is CastClass)
+                this.tokens.Add((node as CastClass).ThrowException);
+            else if (node is ManageVar)
+                this.addVar((node as ManageVar).Var);
+            else if (node is ManageField)
+                this.tokens.Add((node as ManageField).Field);
+            else if (node is CallMethod)
+            {
+                CallMethod callMethod = node as CallMethod;
+                this.tokens.Add(callMethod.Method);
+                this.tokens.Add(callMethod.IsVirtCall);
+                this.tokens.Add(callMethod.IsTailCall);
+                Type[] parameters = callMethod.MethodWithParams.Params;
+                this.tokens.Add(parameters.Length);
+                this.tokens.AddRange(parameters);
+                this.addCallee(node, folded);
+            }
+            else if (node is NewObject)
+            {
+                this.tokens.Add((node as NewObject).Constructor);
+                this.addCallee(node, folded);
+            }
+            else if (node is CreateDelegate)
+            {
+                CreateDelegate createDelegate = node as CreateDelegate;
+                this.tokens.Add(createDelegate.DelegateCtor);
+                this.tokens.Add(createDelegate.Method);
+                this.tokens.Add(createDelegate.IsVirtual);
+            }
+
+            return true;
+        }
+
+        #endregion
+
+        /* Builds the structure of the body, IsFoldable is false
+         * if the body contains exception handling blocks
+         */
+        internal MethodStructure (ResidualMethod method, MethodBodyBlock mbb, Hashtable folded)
+        {
+            this.tokens = new ArrayList();
+            this.nodes = new Hashtable();
+            this.vars = new Hashtable();
+            this.IsFoldable = true;
+
+            this.tokens.Add(method.IsConstructor);
+            this.tokens.Add(mbb.ReturnType == null ? MethodStructure.NULL : mbb.ReturnType);
+            foreach (Variable var in mbb.Variables.ParameterMapper)
+                this.addVar(var);
+
+            ArrayList order = new ArrayList();
+            this.getNode(mbb, order);
+            for (int i = 0; i < order.Count && this.IsFoldable; i++)
+            {
+                Node node = order[i] as Node;
+                this.IsFoldable = this.addNode(node, folded);
+
+                this.tokens.Add(node.NextArray.Count);
+                for (int j = 0; j < node.NextArray.Count; j++)
+                    this.tokens.Add(this.getNode(node.NextArray[j], order));
+            }
+
+            int hash = 0;
+            foreach (object token in this.tokens)
+                hash = (hash << 5) - hash + token.GetHashCode();
+            this.hashCode = hash;
+        }
+
+        internal readonly bool IsFoldable;
+
+        public override bool Equals (object obj)
+        {
+            MethodStructure structure = obj as MethodStructure;
+            if (structure == null || structure.hashCode != this.hashCode || structure.tokens.Count != this.tokens.Count)
+                return false;
+
+            for (int i = 0; i < this.tokens.Count; i++)
+                if (! Equals(this.tokens[i], structure.tokens[i]))
+                    return false;
+
+            return true;
+        }
+
+        public override int GetHashCode ()
+        {
+            return this.hashCode;
+        }
+    }
+}
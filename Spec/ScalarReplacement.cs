@@ -0,0 +1,447 @@
+// =============================================================================
+// CILPE - Partial Evaluator for Common Intermediate Language
+// =============================================================================
+// File:
+//     ScalarReplacement.cs
+//
+// Description:
+//     Replacement of non-escaping residual objects and struct variables
+//     by local variables for their fields
+//
+// Author:
+//     Yuri Klimov (yuri.klimov@cilpe.net)
+// =============================================================================
+
+using System;
+
+namespace CILPE.Spec
+{
+    using System.Collections;
+    using System.Reflection;
+    using CILPE.CFG;
+
+
+    /* Objects created in residual method bodies are replaced by local
+     * variables for their fields if:
+     *  - the class derives from object directly, has no finalizer and no
+     *    static constructor and its fields are primitive or references;
+     *  - the residual constructor only stores its parameters and constants
+     *    to fields and calls the constructor of object;
+     *  - the object is stored to a local variable right after creation,
+     *    the variable is assigned only there and is used only to load
+     *    fields and to store variables or constants to fields.
+     * Struct variables are split to local variables for their fields if
+     * their address is used only to access or initialize the fields.
+     */
+    internal class ScalarReplacement
+    {
+        #region Private static members
+
+        private static readonly BindingFlags fieldFlags = BindingFlags.Instance | BindingFlags.Public | BindingFlags.NonPublic;
+
+        private static bool hasScalarFields (Type type)
+        {
+            foreach (FieldInfo field in type.GetFields(ScalarReplacement.fieldFlags))
+            {
+                Type fieldType = field.FieldType;
+                if (fieldType.IsValueType && (! fieldType.IsPrimitive || fieldType == typeof(IntPtr) || fieldType == typeof(UIntPtr)))
+                    return false;
+            }
+
+            return true;
+        }
+
+        private static bool isReplaceable (Type type)
+        {
+            if (type.IsValueType || type.IsExplicitLayout || type.BaseType != typeof(object))
+                return false;
+
+            if (type.GetMethod("Finalize", BindingFlags.Instance | BindingFlags.NonPublic | BindingFlags.DeclaredOnly) != null)
+                return false;
+
+            /* Creation of the object runs the static constructor, removing
+             * it would skip or move side effects of the constructor
+             */
+            if (type.TypeInitializer != null)
+                return false;
+
+            return ScalarReplacement.hasScalarFields(type);
+        }
+
+        private static bool isSplittable (Type type)
+        {
+            if (! type.IsValueType || type.IsPrimitive || type.IsEnum || type.IsExplicitLayout)
+                return false;
+
+            return type.GetFields(ScalarReplacement.fieldFlags).Length > 0 && ScalarReplacement.hasScalarFields(type);
+        }
+
+        private static int parameterIndex (ParameterMapper parameters, Variable var)
+        {
+            for (int i = 1; i < parameters.Count; i++)
+                if (parameters[i] == var)
+                    return i;
+
+            return -1;
+        }
+
+        /* Field -> index of constructor parameter or LoadConst node,
+         * null if the constructor does something else
+         */
+        private static Hashtable getFieldSources (MethodBodyBlock ctor, Type type)
+        {
+            ParameterMapper parameters = ctor.Variables.ParameterMapper;
+            if (parameters.Count == 0)
+                return null;
+            Variable thisVar = parameters[0];
+
+            Hashtable sources = new Hashtable();
+            Node node = ctor.Next;
+            while (node != null && ! (node is Leave))
+            {
+                if (! (node is LoadVar) || (node as LoadVar).Var != thisVar)
+                    return null;
+
+                Node value = node.Next;
+                if (value is CallMethod)
+                {
+                    MethodBase method = (value as CallMethod).Method;
+                    if (! method.IsConstructor || method.DeclaringType != typeof(object))
+                        return null;
+
+                    node = value.Next;
+                }
+                else
+                {
+                    StoreField store = (value == null ? null : value.Next) as StoreField;
+                    if (store == null || store.Field.DeclaringType != type)
+                        return null;
+
+                    if (value is LoadConst)
+                        sources[store.Field] = value;
+                    else if (value is LoadVar && ScalarReplacement.parameterIndex(parameters, (value as LoadVar).Var) > 0)
+                        sources[store.Field] = ScalarReplacement.parameterIndex(parameters, (value as LoadVar).Var);
+                    else
+                        return null;
+
+                    node = store.Next;
+                }
+            }
+
+            return node == null ? null : sources;
+        }
+
+        private static bool hasSinglePrev (Node node)
+        {
+            return node != null && node.PrevArray.Count == 1;
+        }
+
+        /* Checks that the reference or address loaded by the user of
+         * the variable is used only to access a field of the type
+         */
+        private static bool isFieldAccess (Node user, Variable var, Type type)
+        {
+            if (! ScalarReplacement.hasSinglePrev(user.Next))
+                return false;
+
+            Node next = user.Next;
+            if (next is LoadField)
+                return (next as LoadField).Field.DeclaringType == type;
+            else if (next is LoadConst || next is LoadVar && (next as LoadVar).Var != var)
+                return next.Next is StoreField && ScalarReplacement.hasSinglePrev(next.Next) &&
+                    (next.Next as StoreField).Field.DeclaringType == type;
+            else
+                return false;
+        }
+
+        private static Node linkChain (Node node, ArrayList chain, Node next)
+        {
+            if (chain.Count == 0)
+            {
+                node.ReplaceByNode(next);
+                return next;
+            }
+
+            node.ReplaceByNode(chain[0] as Node);
+            for (int i = 1; i < chain.Count; i++)
+                (chain[i-1] as Node).Next = chain[i] as Node;
+            (chain[chain.Count-1] as Node).Next = next;
+
+            return chain[0] as Node;
+        }
+
+        /* Replaces field access through the reference or address loaded by
+         * the node with access to the local variable of the field
+         */
+        private static void replaceFieldAccess (Node node, Hashtable locals)
+        {
+            Node next = node.Next;
+            if (next is LoadField)
+            {
+                ArrayList load = new ArrayList();
+                load.Add(new LoadVar(locals[(next as LoadField).Field] as Variable));
+                ScalarReplacement.linkChain(node, load, next.Next);
+                node.RemoveFromGraph();
+                next.RemoveFromGraph();
+            }
+            else
+            {
+                StoreField storeField = next.Next as StoreField;
+                Node after = storeField.Next;
+                next.Next = new StoreVar(locals[storeField.Field] as Variable);
+                next.Next.Next = after;
+                node.ReplaceByNode(next);
+                node.RemoveFromGraph();
+                storeField.RemoveFromGraph();
+            }
+        }
+
+        private static bool replace (ResidualAssemblyHolder holder, MethodBodyBlock mbb, NewObject newObj)
+        {
+            ResidualMethod ctor = Specialization.GetResidualMethod(newObj);
+            if (ctor == null || ! holder.ContainsMethodBody(ctor))
+                return false;
+
+            Type type = newObj.Constructor.DeclaringType;
+            if (! ScalarReplacement.isReplaceable(type))
+                return false;
+
+            MethodBodyBlock mbbCtor = holder[ctor];
+            Hashtable sources = ScalarReplacement.getFieldSources(mbbCtor, type);
+            if (sources == null)
+                return false;
+
+            StoreVar store = newObj.Next as StoreVar;
+            if (store == null || ! ScalarReplacement.hasSinglePrev(store) || store.Var.Kind != VariableKind.Local)
+                return false;
+
+            Variable var = store.Var;
+            ArrayList users = new ArrayList();
+            foreach (Node user in var.UsersArray)
+                if (user != store)
+                {
+                    if (! (user is LoadVar) || ! ScalarReplacement.isFieldAccess(user, var, type))
+                        return false;
+                    users.Add(user);
+                }
+
+            Hashtable locals = new Hashtable();
+            FieldInfo[] fields = type.GetFields(ScalarReplacement.fieldFlags);
+            foreach (FieldInfo field in fields)
+                locals[field] = mbb.Variables.CreateVar(field.FieldType, VariableKind.Local);
+
+            /* Constructor arguments are popped to new variables and copied to fields */
+            ParameterMapper parameters = mbbCtor.Variables.ParameterMapper;
+            Variable[] args = new Variable[parameters.Count];
+            ArrayList chain = new ArrayList();
+            for (int i = parameters.Count - 1; i > 0; i--)
+            {
+                args[i] = mbb.Variables.CreateVar(parameters[i].Type, VariableKind.Local);
+                chain.Add(new StoreVar(args[i]));
+            }
+            foreach (FieldInfo field in fields)
+            {
+                object source = sources[field];
+                if (source is int)
+                    chain.Add(new LoadVar(args[(int) source]));
+                else if (source is LoadConst)
+                    chain.Add((source as Node).Clone());
+                else
+                    chain.Add(new LoadConst(ScalarReplacement.DefaultValue(field.FieldType)));
+                chain.Add(new StoreVar(locals[field] as Variable));
+            }
+
+            ScalarReplacement.linkChain(newObj, chain, store.Next);
+            newObj.RemoveFromGraph();
+            store.RemoveFromGraph();
+
+            foreach (LoadVar user in users)
+                ScalarReplacement.replaceFieldAccess(user, locals);
+
+            return true;
+        }
+
+        /* Checks that the address of the struct variable is used only to
+         * access its fields or to initialize it
+         */
+        private static bool canSplit (Variable var)
+        {
+            Type type = var.Type;
+            if (var.Kind == VariableKind.ArgList || ! ScalarReplacement.isSplittable(type))
+                return false;
+
+            bool fieldAccess = false;
+            foreach (Node user in var.UsersArray)
+                if (user is LoadVarAddr)
+                {
+                    Node next = user.Next;
+                    if (! (next is InitValue && ScalarReplacement.hasSinglePrev(next) && (next as InitValue).Type == type) &&
+                        ! ScalarReplacement.isFieldAccess(user, var, type))
+                        return false;
+
+                    fieldAccess = true;
+                }
+                else if (! (user is LoadVar || user is StoreVar))
+                    return false;
+
+            return fieldAccess;
+        }
+
+        private static void addFieldLoads (ArrayList chain, Variable var, FieldInfo[] fields, Hashtable locals)
+        {
+            foreach (FieldInfo field in fields)
+            {
+                chain.Add(new LoadVarAddr(var));
+                chain.Add(new LoadField(field));
+                chain.Add(new StoreVar(locals[field] as Variable));
+            }
+        }
+
+        private static void split (MethodBodyBlock mbb, Variable var)
+        {
+            Type type = var.Type;
+            FieldInfo[] fields = type.GetFields(ScalarReplacement.fieldFlags);
+            Hashtable locals = new Hashtable();
+            foreach (FieldInfo field in fields)
+                locals[field] = mbb.Variables.CreateVar(field.FieldType, VariableKind.Local);
+
+            ArrayList users = new ArrayList();
+            foreach (Node user in var.UsersArray)
+                users.Add(user);
+
+            Variable temp = null;
+            foreach (Node user in users)
+            {
+                ArrayList chain = new ArrayList();
+                if (user is LoadVarAddr && user.Next is InitValue)
+                {
+                    foreach (FieldInfo field in fields)
+                    {
+                        chain.Add(new LoadConst(ScalarReplacement.DefaultValue(field.FieldType)));
+                        chain.Add(new StoreVar(locals[field] as Variable));
+                    }
+
+                    Node init = user.Next;
+                    ScalarReplacement.linkChain(user, chain, init.Next);
+                    user.RemoveFromGraph();
+                    init.RemoveFromGraph();
+                }
+                else if (user is LoadVarAddr)
+                    ScalarReplacement.replaceFieldAccess(user, locals);
+                else
+                {
+                    /* The whole value is assembled from fields or split
+                     * to fields in a temporary variable
+                     */
+                    if (temp == null)
+                        temp = mbb.Variables.CreateVar(type, VariableKind.Local);
+
+                    if (user is LoadVar)
+                    {
+                        foreach (FieldInfo field in fields)
+                        {
+                            chain.Add(new LoadVarAddr(temp));
+                            chain.Add(new LoadVar(locals[field] as Variable));
+                            chain.Add(new StoreField(field));
+                        }
+                        chain.Add(new LoadVar(temp));
+                    }
+                    else
+                    {
+                        chain.Add(new StoreVar(temp));
+                        ScalarReplacement.addFieldLoads(chain, temp, fields, locals);
+                    }
+
+                    ScalarReplacement.linkChain(user, chain, user.Next);
+                    user.RemoveFromGraph();
+                }
+            }
+
+            /* Parameters are split at the method entry */
+            if (var.Kind == VariableKind.Parameter)
+            {
+                ArrayList chain = new ArrayList();
+                ScalarReplacement.addFieldLoads(chain, var, fields, locals);
+
+                Node first = mbb.Next;
+                mbb.Next = chain[0] as Node;
+                for (int i = 1; i < chain.Count; i++)
+                    (chain[i-1] as Node).Next = chain[i] as Node;
+                (chain[chain.Count-1] as Node).Next = first;
+            }
+        }
+
+        #endregion
+
+        #region Internal static members
+
+        /* Constant that stores the zero value of the type to a variable */
+        internal static object DefaultValue (Type type)
+        {
+            if (! type.IsValueType)
+                return null;
+            else if (type == typeof(long) || type == typeof(ulong))
+                return (long) 0;
+            else if (type == typeof(double) || type == typeof(float))
+                return (double) 0;
+            else
+                return 0;
+        }
+
+        #endregion
+
+        /* Replaces non-escaping objects of the residual method body,
+         * returns the number of replaced creations
+         */
+        internal static int Perform (ResidualAssemblyHolder holder, MethodBodyBlock mbb)
+        {
+            ArrayList creations = new ArrayList();
+            ForEachVisitor.ForEach(mbb, new ForEachCallback(new Collector(creations).Callback));
+
+            int count = 0;
+            foreach (NewObject newObj in creations)
+                if (ScalarReplacement.replace(holder, mbb, newObj))
+                    count++;
+
+            return count;
+        }
+
+        /* Splits struct variables of the residual method body whose address
+         * does not escape to one local variable per field, returns the number
+         * of split variables
+         */
+        internal static int SplitStructs (MethodBodyBlock mbb)
+        {
+            ArrayList vars = new ArrayList();
+            foreach (Variable var in mbb.Variables)
+                if (ScalarReplacement.canSplit(var))
+                    vars.Add(var);
+
+            foreach (Variable var in vars)
+                ScalarReplacement.split(mbb, var);
+
+            return vars.Count;
+        }
+
+        #region Private classes
+
+        private class Collector
+        {
+            private readonly ArrayList creations;
+
+            internal Collector (ArrayList creations)
+            {
+                this.creations = creations;
+            }
+
+            internal void Callback (Node node)
+            {
+                if (node is NewObject)
+                    this.creations.Add(node);
+            }
+        }
+
+
+        #endregion
+    }
+}
@@ -116,7 +116,7 @@ namespace CILPE.Spec
                 {
                     PointerValue ptr1 = o1 as PointerValue;
                     PointerValue ptr2 = o2 as PointerValue;
-                    int res = (int) this.objHash[ptr1.GetHeapObject()] - (int) this.objHash[ptr2.GetHeapObject()];
+                    int res = this.objHash[ptr1.GetHeapObject()] - this.objHash[ptr2.GetHeapObject()];
                     if (res == 0)
                         res = ptr1.GetQuasiOffset() - ptr2.GetQuasiOffset();
                     return res;
@@ -163,7 +163,7 @@ namespace CILPE.Spec
         {
             ArrayList ptrs = new ArrayList();
             foreach (PointerValue ptr in this.hash.Keys)
-                if (objHash.ContainsKey(ptr.GetHeapObject()))
+                if (objHash.Contains(ptr.GetHeapObject()))
                     ptrs.Add(ptr);
             ptrs.Sort(new PtrComparer(objHash));
 
@@ -268,20 +268,6 @@ namespace CILPE.Spec
     {
         #region Private classes
 
-        private class NodeAndVariables
-        {
-            internal readonly Node Node;
-
-            internal readonly Variable[] Variables;
-
-            internal NodeAndVariables (Node upNode, Variable[] vars)
-            {
-                this.Node = upNode;
-                this.Variables = vars;
-            }
-        }
-
-
         private class Data
         {
             internal readonly MemoSpecState MemoSpecState;
@@ -299,6 +285,15 @@ namespace CILPE.Spec
         }
 
 
+        private class TypeNameComparer : IComparer
+        {
+            public int Compare (object x, object y)
+            {
+                return String.CompareOrdinal((x as Type).FullName, (y as Type).FullName);
+            }
+        }
+
+
         #endregion
 
         #region Private static members
@@ -406,6 +401,48 @@ namespace CILPE.Spec
             ptrUpNode.Node = upNode;
         }
 
+        private static bool isAccessible (Type type)
+        {
+            if (type.IsNested)
+                return (type.IsNestedPublic || type.IsNestedAssembly || type.IsNestedFamORAssem) &&
+                    SpecializingVisitor.isAccessible(type.DeclaringType);
+            else
+                return true;
+        }
+
+        /* Returns the method called by the virtual call for the exact type
+         * of the receiver if the residual code can call it directly
+         */
+        private static MethodInfo chooseVirtualMethod (MethodInfo method, Type type)
+        {
+            if (type.IsAbstract || type.IsValueType || ! SpecializingVisitor.isAccessible(type))
+                return null;
+
+            MethodInfo target = null;
+            if (method.DeclaringType.IsInterface)
+            {
+                InterfaceMapping map = type.GetInterfaceMap(method.DeclaringType);
+                for (int i = 0; i < map.InterfaceMethods.Length; i++)
+                    if (map.InterfaceMethods[i].MethodHandle.Equals(method.MethodHandle))
+                        target = map.TargetMethods[i];
+            }
+            else
+            {
+                RuntimeMethodHandle baseMethod = method.GetBaseDefinition().MethodHandle;
+                BindingFlags flags = BindingFlags.DeclaredOnly | BindingFlags.Instance | BindingFlags.Public | BindingFlags.NonPublic;
+                for (; target == null && type != null; type = type.BaseType)
+                    foreach (MethodInfo m in type.GetMethods(flags))
+                        if (m.IsVirtual && m.GetBaseDefinition().MethodHandle.Equals(baseMethod))
+                            target = m;
+            }
+
+            if (target == null || target.IsAbstract || ! SpecializingVisitor.isAccessible(target.DeclaringType) ||
+                ! (target.IsPublic || target.IsAssembly || target.IsFamilyOrAssembly))
+                return null;
+
+            return MethodBase.GetMethodFromHandle(target.MethodHandle) as MethodInfo;
+        }
+
         #endregion
 
         #region Private members
@@ -418,41 +455,10 @@ namespace CILPE.Spec
 
         private readonly VariablesHashtable varsHash;
 
-        private readonly Hashtable upDownNodes;
+        private readonly MemoTable memoTable;
 
         private readonly ArrayList exitData;
 
-        private Hashtable getUpNodes (Node downNode)
-        {
-            Hashtable upNodes = this.upDownNodes[downNode] as Hashtable;
-            if (upNodes == null)
-                this.upDownNodes[downNode] = upNodes = new Hashtable();
-
-            return upNodes;
-        }
-
-        private void setUpAndDownNode (Node downNode, MemoSpecState memo, Node upNode)
-        {
-            this.getUpNodes(downNode)[memo.MemoState] = new NodeAndVariables(upNode, memo.Variables);
-        }
-
-        private void getUpNode (Node downNode, MemoSpecState memo, out Variable[] vars1, out Node upNode, out Variable[] vars2)
-        {
-            NodeAndVariables nodeVars = this.getUpNodes(downNode)[memo.MemoState] as NodeAndVariables;
-            if (nodeVars == null)
-            {
-                vars1 = null;
-                upNode = null;
-                vars2 = null;
-            }
-            else
-            {
-                vars1 = memo.Variables;
-                upNode = nodeVars.Node;
-                vars2 = nodeVars.Variables;
-            }
-        }
-
         private void loadVar (Node downNode, PointerValue ptr, object o)
         {
             PointerToNode ptrUpNode = (o as Data).PointerToNode;
@@ -510,7 +516,7 @@ namespace CILPE.Spec
                 int depth = state.Stack.Count + 1;
 
                 GraphProcessor graphProc = new GraphProcessor();
-                SpecializingVisitor visitor = new SpecializingVisitor(graphProc, this.holder, this.mbbUp, state, this.varsHash);
+                SpecializingVisitor visitor = new SpecializingVisitor(graphProc, this.holder, method.SourceMethod, this.mbbUp, state, this.varsHash);
                 visitor.AddTask(mbbDown.Next, ptrUpNode);
                 graphProc.Process();
 
@@ -540,6 +546,93 @@ namespace CILPE.Spec
             }
         }
 
+        /* Replaces the virtual call that is not specialized by tests of the
+         * exact receiver types found by BTA and direct calls of the methods
+         * chosen for them. The virtual call is kept for other receivers.
+         */
+        private bool devirtualize (Node downNode, PointerToNode ptrUpNode)
+        {
+            CallMethod call = downNode as CallMethod;
+            int limit = ResidualAssemblyHolder.DevirtualizationLimit;
+            if (limit <= 0 || call == null || ! call.IsVirtCall || ! call.Method.IsVirtual || call.IsTailCall)
+                return false;
+
+            MethodInfo method = call.Method as MethodInfo;
+            ParameterInfo[] parms = method.GetParameters();
+            if ((method.CallingConvention & CallingConventions.VarArgs) != 0)
+                return false;
+            foreach (ParameterInfo parm in parms)
+                if (parm.ParameterType.IsByRef)
+                    return false;
+
+            Type[] types = Annotation.GetReceiverTypes(downNode);
+            if (types == null || types.Length == 0 || types.Length > limit)
+                return false;
+            Array.Sort(types, new TypeNameComparer());
+
+            ArrayList targetTypes = new ArrayList();
+            ArrayList targets = new ArrayList();
+            foreach (Type type in types)
+            {
+                MethodInfo target = SpecializingVisitor.chooseVirtualMethod(method, type);
+                if (target != null && this.holder.SourceHolder.ContainsMethodBody(target))
+                {
+                    targetTypes.Add(type);
+                    targets.Add(target);
+                }
+            }
+            if (targets.Count == 0)
+                return false;
+
+            Variable[] vars = new Variable[parms.Length + 1];
+            for (int i = parms.Length; i >= 0; i--)
+            {
+                vars[i] = this.mbbUp.Variables.CreateVar(i == 0 ? method.DeclaringType : parms[i-1].ParameterType, VariableKind.Local);
+                ptrUpNode = new PointerToNode(ptrUpNode.Node = new StoreVar(vars[i]));
+            }
+
+            MethodInfo getType = typeof(object).GetMethod("GetType", Type.EmptyTypes);
+            MethodInfo getTypeFromHandle = typeof(Type).GetMethod("GetTypeFromHandle");
+            for (int i = 0; i <= targets.Count; i++)
+            {
+                if (i < targets.Count)
+                {
+                    Type type = targetTypes[i] as Type;
+                    ptrUpNode = new PointerToNode(ptrUpNode.Node = new LoadVar(vars[0]));
+                    if (type.IsSealed)
+                        ptrUpNode = new PointerToNode(ptrUpNode.Node = new CastClass(type, false));
+                    else
+                    {
+                        ptrUpNode = new PointerToNode(ptrUpNode.Node = new CallMethod(getType, true, false));
+                        ptrUpNode = new PointerToNode(ptrUpNode.Node = new LoadConst(type.TypeHandle));
+                        ptrUpNode = new PointerToNode(ptrUpNode.Node = new CallMethod(getTypeFromHandle, false, false));
+                        ptrUpNode = new PointerToNode(ptrUpNode.Node = new BinaryOp(BinaryOp.ArithOp.CEQ, false, false));
+                    }
+
+                    Node branch = ptrUpNode.Node = new Branch();
+                    ptrUpNode = new PointerToNode(branch, 0);
+
+                    /* The receiver is cast to the exact type to keep the direct call verifiable */
+                    PointerToNode ptrCall = new PointerToNode(branch, 1);
+                    ptrCall = new PointerToNode(ptrCall.Node = new LoadVar(vars[0]));
+                    ptrCall = new PointerToNode(ptrCall.Node = new CastClass(type, true));
+                    for (int j = 1; j < vars.Length; j++)
+                        ptrCall = new PointerToNode(ptrCall.Node = new LoadVar(vars[j]));
+                    ptrCall.Node = new CallMethod(targets[i] as MethodInfo, false, false);
+                    this.AddTask(downNode.Next, new PointerToNode(ptrCall.Node));
+                }
+                else
+                {
+                    for (int j = 0; j < vars.Length; j++)
+                        ptrUpNode = new PointerToNode(ptrUpNode.Node = new LoadVar(vars[j]));
+                    ptrUpNode.Node = new CallMethod(method, true, false);
+                    this.AddTask(downNode.Next, new PointerToNode(ptrUpNode.Node));
+                }
+            }
+
+            return true;
+        }
+
         #endregion
 
         #region Protected members
@@ -559,15 +652,13 @@ namespace CILPE.Spec
             }
             else
             {
-                Variable[] vars1;
                 Node upNode;
-                Variable[] vars2;
-                this.getUpNode(downNode, memo, out vars1, out upNode, out vars2);
-                if (upNode != null)
-                    SpecializingVisitor.createSubstitution(vars2, vars1, ptrUpNode, upNode);
+                Variable[] vars;
+                if (this.memoTable.Lookup(downNode, memo, out upNode, out vars))
+                    SpecializingVisitor.createSubstitution(vars, memo.Variables, ptrUpNode, upNode);
                 else if (btType == BTType.eXclusive)
                     this.CallVisitorMethod(downNode, data);
-                else
+                else if (! this.devirtualize(downNode, ptrUpNode))
                 {
                     upNode = ptrUpNode.Node = downNode.Clone();
                     for (int i = 0; i < downNode.NextArray.Count; i++)
@@ -576,7 +667,7 @@ namespace CILPE.Spec
             }
 
             if (ptrUpNode.Node != null)
-                this.setUpAndDownNode(downNode, memo, ptrUpNode.Node);
+                this.memoTable.Add(downNode, memo, ptrUpNode.Node);
         }
 
         protected override void VisitLeave (Leave downNode, object o)
@@ -742,13 +833,13 @@ namespace CILPE.Spec
 
         #endregion
 
-        internal SpecializingVisitor (GraphProcessor graphProcessor, ResidualAssemblyHolder holder, MethodBodyBlock mbbUp, SpecState state, VariablesHashtable varsHash) : base(graphProcessor)
+        internal SpecializingVisitor (GraphProcessor graphProcessor, ResidualAssemblyHolder holder, MethodBase method, MethodBodyBlock mbbUp, SpecState state, VariablesHashtable varsHash) : base(graphProcessor)
         {
             this.holder = holder;
             this.mbbUp = mbbUp;
             this.state = state;
             this.varsHash = varsHash;
-            this.upDownNodes = new Hashtable();
+            this.memoTable = new MemoTable(holder, method);
             this.exitData = new ArrayList();
         }
 
@@ -852,7 +943,7 @@ namespace CILPE.Spec
             dummyUp.RemoveFromGraph();
 
             GraphProcessor graphProc = new GraphProcessor();
-            SpecializingVisitor visitor = new SpecializingVisitor(graphProc, holder, mbbUp, state, varsHash);
+            SpecializingVisitor visitor = new SpecializingVisitor(graphProc, holder, method.SourceMethod, mbbUp, state, varsHash);
             visitor.AddTask(mbbDown.Next, ptrUpNode);
             graphProc.Process();
             visitor.SetLastNode(upNode);
@@ -17,6 +17,8 @@ using System;
 namespace CILPE.Spec
 {
     using System.Reflection;
+    using System.Collections;
+    using System.Threading;
     using CILPE.Exceptions;
     using CILPE.ReflectionEx;
     using CILPE.CFG;
@@ -97,30 +99,386 @@ namespace CILPE.Spec
 
     public class ResidualAssemblyHolder : ModifiedAssemblyHolder
     {
+        #region Private members
+
+        /* Residual methods that are specialized or waiting for specialization */
+        private readonly Hashtable claimed;
+
+        private readonly Queue pending;
+
+        private int busy;
+
+        private Exception error;
+
+        /* Memoization counters of annotated nodes in order of creation */
+        private readonly ArrayList memoStatistics;
+
+        private class ResidualCopiesComparer : IComparer
+        {
+            public int Compare (object x, object y)
+            {
+                return (y as MemoStatistics).ResidualCopies - (x as MemoStatistics).ResidualCopies;
+            }
+        }
+
+        private int foldedCount;
+
+        private int replacedCount;
+
+        private int splitCount;
+
+        private int inlinedCount;
+
+        private int tailCallsCount;
+
+        /* Redirects calls of folded residual methods to the methods they are folded into */
+        private class CallRedirector
+        {
+            private readonly Hashtable folded;
+
+            internal CallRedirector (Hashtable folded)
+            {
+                this.folded = folded;
+            }
+
+            internal void Callback (Node node)
+            {
+                ResidualMethod method = Specialization.GetResidualMethod(node);
+                if (method != null && this.folded.ContainsKey(method))
+                {
+                    while (this.folded.ContainsKey(method))
+                        method = this.folded[method] as ResidualMethod;
+                    Specialization.SetResidualMethod(node, method);
+                }
+            }
+        }
+
+        /* Collects residual methods called from residual method bodies */
+        private class CallCollector
+        {
+            internal readonly Hashtable Called = new Hashtable();
+
+            internal void Callback (Node node)
+            {
+                ResidualMethod method = Specialization.GetResidualMethod(node);
+                if (method != null)
+                    this.Called[method] = true;
+            }
+        }
+
+        private Hashtable getEntryMethods ()
+        {
+            Hashtable entries = new Hashtable();
+            foreach (MethodBase method in this.SourceHolder.getMethods())
+                if (method.IsDefined(typeof(SpecializeAttribute), false))
+                    entries[this.GetResidualMethod(method)] = true;
+
+            return entries;
+        }
+
+        /* Inlines small residual methods, removes inlined methods that are
+         * not called any more and returns the bodies calls were inlined into
+         */
+        private Hashtable inlineMethods ()
+        {
+            ResidualInliner inliner = new ResidualInliner(this, ResidualAssemblyHolder.InliningLimit);
+            inliner.Perform();
+            this.inlinedCount = inliner.Count;
+
+            Hashtable entries = this.getEntryMethods();
+            CallCollector collector = new CallCollector();
+            foreach (MethodBodyBlock mbb in this)
+                ForEachVisitor.ForEach(mbb, new ForEachCallback(collector.Callback));
+            foreach (ResidualMethod method in inliner.Callees)
+                if (! entries.ContainsKey(method) && ! collector.Called.ContainsKey(method))
+                    this.removeMethodBody(method);
+
+            Hashtable callers = new Hashtable();
+            foreach (MethodBodyBlock mbb in inliner.Callers)
+                callers[mbb] = true;
+
+            return callers;
+        }
+
+        /* Folds residual methods with equal structures into one of them.
+         * Folding is repeated because calls of folded methods may make
+         * more bodies equal. Residual entry points are never folded.
+         */
+        private void foldEqualMethods ()
+        {
+            Hashtable entries = this.getEntryMethods();
+
+            Hashtable folded = new Hashtable();
+            bool changed = true;
+            while (changed)
+            {
+                changed = false;
+                Hashtable survivors = new Hashtable();
+                foreach (ResidualMethod method in new ArrayList(this.getMethods()))
+                {
+                    if (entries.ContainsKey(method))
+                        continue;
+
+                    MethodStructure structure = new MethodStructure(method, this[method], folded);
+                    if (! structure.IsFoldable)
+                        continue;
+
+                    ResidualMethod survivor = survivors[structure] as ResidualMethod;
+                    if (survivor == null)
+                        survivors[structure] = method;
+                    else
+                    {
+                        folded[method] = survivor;
+                        this.removeMethodBody(method);
+                        this.foldedCount++;
+                        changed = true;
+                    }
+                }
+            }
+
+            CallRedirector redirector = new CallRedirector(folded);
+            foreach (MethodBodyBlock mbb in this)
+                ForEachVisitor.ForEach(mbb, new ForEachCallback(redirector.Callback));
+        }
+
+        /* Takes residual methods from the queue and specializes them
+         * until the queue is empty and no other worker can fill it
+         */
+        private void work ()
+        {
+            while (true)
+            {
+                ResidualMethod method;
+                lock (this.pending)
+                {
+                    while (this.pending.Count == 0 && this.busy > 0 && this.error == null)
+                        Monitor.Wait(this.pending);
+
+                    if (this.pending.Count == 0 || this.error != null)
+                    {
+                        Monitor.PulseAll(this.pending);
+                        return;
+                    }
+
+                    method = this.pending.Dequeue() as ResidualMethod;
+                    this.busy++;
+                }
+
+                try
+                {
+                    Specialization.SpecializeMethod(this, method);
+                }
+                catch (Exception e)
+                {
+                    lock (this.pending)
+                        if (this.error == null)
+                            this.error = e;
+                }
+                finally
+                {
+                    lock (this.pending)
+                    {
+                        this.busy--;
+                        Monitor.PulseAll(this.pending);
+                    }
+                }
+            }
+        }
+
+        #endregion
+
         #region Internal members
 
         internal readonly AnnotatedAssemblyHolder AnnotatedHolder;
 
         internal void AddMethod (ResidualMethod method, MethodBodyBlock mbbUp)
         {
-            this.addMethodBody(method, mbbUp);
+            lock (this.pending)
+                this.addMethodBody(method, mbbUp);
         }
 
+        /* Queues the residual method for specialization
+         * if it has not been queued before
+         */
         internal void SpecializeMethod (ResidualMethod method)
         {
-            if (! this.ContainsMethodBody(method))
-                Specialization.SpecializeMethod(this, method);
+            lock (this.pending)
+                if (! this.claimed.ContainsKey(method))
+                {
+                    this.claimed[method] = true;
+                    this.pending.Enqueue(method);
+                    Monitor.PulseAll(this.pending);
+                }
+        }
+
+        internal MemoStatistics GetMemoStatistics (Node downNode, MethodBase method)
+        {
+            lock (downNode.Options)
+            {
+                MemoStatistics stat = downNode.Options[ResidualAssemblyHolder.MemoStatisticsOption] as MemoStatistics;
+                if (stat == null)
+                {
+                    downNode.Options[ResidualAssemblyHolder.MemoStatisticsOption] = stat = new MemoStatistics(downNode, method);
+                    lock (this.memoStatistics)
+                        this.memoStatistics.Add(stat);
+                }
+
+                return stat;
+            }
         }
 
         #endregion
 
+        /* Number of threads that specialize residual methods */
+        public static int SpecializationThreads = 1;
+
+        /* Maximal number of receiver types of a virtual call that is not
+         * specialized to replace it by direct calls, 0 disables replacement
+         */
+        public static int DevirtualizationLimit = 0;
+
+        /* Maximal number of nodes of a residual method inlined by Optimize,
+         * 0 disables inlining
+         */
+        public static int InliningLimit = 0;
+
         public ResidualAssemblyHolder (AnnotatedAssemblyHolder annotatedHolder) : base(annotatedHolder.SourceHolder)
         {
             this.AnnotatedHolder = annotatedHolder;
+            this.claimed = new Hashtable();
+            this.pending = new Queue();
+            this.busy = 0;
+            this.error = null;
+            this.memoStatistics = new ArrayList();
+            this.foldedCount = 0;
+            this.replacedCount = 0;
+            this.splitCount = 0;
+            this.inlinedCount = 0;
+            this.tailCallsCount = 0;
 
             foreach (MethodBase method in this.SourceHolder.getMethods())
                 if (method.IsDefined(typeof(SpecializeAttribute), false))
                     this.SpecializeMethod(this.GetResidualMethod(method));
+
+            Thread[] threads = new Thread[Math.Max(ResidualAssemblyHolder.SpecializationThreads, 1) - 1];
+            for (int i = 0; i < threads.Length; i++)
+            {
+                threads[i] = new Thread(new ThreadStart(this.work));
+                threads[i].Start();
+            }
+
+            this.work();
+            foreach (Thread thread in threads)
+                thread.Join();
+
+            if (this.error != null)
+                throw this.error;
+        }
+
+        /* Optimizes residual method bodies, replaces self tail calls by
+         * loops, inlines small residual methods, replaces non-escaping
+         * objects and struct variables by local variables and folds
+         * the equal bodies
+         */
+        public override void Optimize ()
+        {
+            base.Optimize();
+
+            Hashtable changed = new Hashtable();
+            foreach (ResidualMethod method in this.getMethods())
+            {
+                int tailCalls = TailRecursion.Perform(method, this[method]);
+                if (tailCalls > 0)
+                {
+                    changed[this[method]] = true;
+                    this.tailCallsCount += tailCalls;
+                }
+            }
+
+            if (ResidualAssemblyHolder.InliningLimit > 0)
+                foreach (MethodBodyBlock mbb in this.inlineMethods().Keys)
+                    changed[mbb] = true;
+
+            foreach (MethodBodyBlock mbb in this)
+            {
+                int replaced = ScalarReplacement.Perform(this, mbb);
+                int split = ScalarReplacement.SplitStructs(mbb);
+                if (replaced + split > 0 || changed.ContainsKey(mbb))
+                {
+                    new BasicBlocksGraph(mbb).Optimize();
+                    this.replacedCount += replaced;
+                    this.splitCount += split;
+                }
+            }
+
+            this.foldEqualMethods();
+        }
+
+        /* Number of object creations replaced by local variables by Optimize */
+        public int ReplacedObjectsNumber
+        {
+            get
+            {
+                return this.replacedCount;
+            }
+        }
+
+        /* Number of self tail calls replaced by loops by Optimize */
+        public int TailCallsNumber
+        {
+            get
+            {
+                return this.tailCallsCount;
+            }
+        }
+
+        /* Number of residual calls inlined by Optimize */
+        public int InlinedCallsNumber
+        {
+            get
+            {
+                return this.inlinedCount;
+            }
+        }
+
+        /* Number of struct variables split to local variables by Optimize */
+        public int SplitVariablesNumber
+        {
+            get
+            {
+                return this.splitCount;
+            }
+        }
+
+        /* Number of residual methods folded into equal ones by Optimize */
+        public int FoldedMethodsNumber
+        {
+            get
+            {
+                return this.foldedCount;
+            }
+        }
+
+        /* Name of the annotated node option that keeps its memoization counters */
+        public static string MemoStatisticsOption
+        {
+            get
+            {
+                return "MemoStatistics";
+            }
+        }
+
+        /* Memoization counters of annotated nodes,
+         * nodes with more residual copies go first
+         */
+        public MemoStatistics[] GetMemoStatistics ()
+        {
+            ArrayList stats;
+            lock (this.memoStatistics)
+                stats = this.memoStatistics.Clone() as ArrayList;
+
+            stats.Sort(new ResidualCopiesComparer());
+            return stats.ToArray(typeof(MemoStatistics)) as MemoStatistics[];
         }
 
         public ResidualMethod GetResidualMethod (MethodBase method)
@@ -0,0 +1,182 @@
+// =============================================================================
+// CILPE - Partial Evaluator for Common Intermediate Language
+// =============================================================================
+// File:
+//     TailRecursion.cs
+//
+// Description:
+//     Replacement of self tail calls of residual methods by loops
+//
+// Author:
+//     Yuri Klimov (yuri.klimov@cilpe.net)
+// =============================================================================
+
+using System;
+
+namespace CILPE.Spec
+{
+    using System.Collections;
+    using CILPE.CFG;
+
+
+    /* A call of the residual method from its own body that is followed by
+     * return is replaced by stores of the arguments to the parameters and a
+     * jump to the method entry. Arguments are evaluated to the stack before
+     * the call, so popping them to the parameters in reverse order needs no
+     * temporary variables. Locals that may be loaded before they are stored
+     * are reset, because a method entry finds them zero-initialized.
+     * Methods with byref, pointer or native int parameters are left as they
+     * are, since an argument may be the address of a local of the current
+     * frame that is overwritten by the jump.
+     */
+    internal class TailRecursion
+    {
+        #region Private static members
+
+        /* Checks that the method has a parameter that may hold
+         * the address of a local or a parameter of the caller
+         */
+        private static bool hasAddressParameters (MethodBodyBlock mbb)
+        {
+            foreach (Variable var in mbb.Variables.ParameterMapper)
+                if (var.Type.IsByRef || var.Type.IsPointer || var.Type == typeof(IntPtr) || var.Type == typeof(UIntPtr))
+                    return true;
+
+            return false;
+        }
+
+        private static bool isTailCall (ResidualMethod method, MethodBodyBlock mbb, Node node)
+        {
+            CallMethod call = node as CallMethod;
+            return call != null && call != mbb.Next && ! call.IsVirtCall && call.Parent == mbb &&
+                Specialization.GetResidualMethod(call) == method && ! TailRecursion.hasAddressParameters(mbb) &&
+                call.Next is Leave && call.Next.Parent == mbb;
+        }
+
+        /* Checks that the variable may be loaded or its address may be taken
+         * before it is stored on some path from the method entry
+         */
+        private static bool isLiveAtEntry (MethodBodyBlock mbb, Variable var)
+        {
+            Hashtable visited = new Hashtable();
+            Stack nodes = new Stack();
+            nodes.Push(mbb.Next);
+            while (nodes.Count > 0)
+            {
+                Node node = nodes.Pop() as Node;
+                if (node == null || visited.ContainsKey(node))
+                    continue;
+                visited[node] = true;
+
+                if (node is ManageVar && (node as ManageVar).Var == var)
+                {
+                    if (node is StoreVar)
+                        continue;
+                    return true;
+                }
+
+                for (int i = 0; i < node.NextArray.Count; i++)
+                    nodes.Push(node.NextArray[i]);
+            }
+
+            return false;
+        }
+
+        private static bool hasBlocks (MethodBodyBlock mbb)
+        {
+            BlockFinder finder = new BlockFinder(mbb);
+            ForEachVisitor.ForEach(mbb, new ForEachCallback(finder.Callback));
+            return finder.Found;
+        }
+
+        #endregion
+
+        /* Replaces self tail calls of the residual method by jumps to the
+         * method entry, returns the number of replaced calls
+         */
+        internal static int Perform (ResidualMethod method, MethodBodyBlock mbb)
+        {
+            if (method.IsConstructor)
+                return 0;
+
+            CallFinder finder = new CallFinder(method, mbb);
+            ForEachVisitor.ForEach(mbb, new ForEachCallback(finder.Callback));
+            if (finder.Calls.Count == 0)
+                return 0;
+
+            /* Liveness is not tracked through exception handling blocks */
+            bool hasBlocks = TailRecursion.hasBlocks(mbb);
+            ArrayList locals = new ArrayList();
+            foreach (Variable var in mbb.Variables)
+                if (var.Kind == VariableKind.Local && (hasBlocks || TailRecursion.isLiveAtEntry(mbb, var)))
+                    locals.Add(var);
+
+            Node entry = mbb.Next;
+            ParameterMapper parameters = mbb.Variables.ParameterMapper;
+            foreach (CallMethod call in finder.Calls)
+            {
+                ArrayList chain = new ArrayList();
+                for (int i = parameters.Count - 1; i >= 0; i--)
+                    chain.Add(new StoreVar(parameters[i]));
+                foreach (Variable var in locals)
+                    ResidualInliner.AddInitialization(chain, var);
+                chain.Add(entry);
+
+                Node leave = call.Next;
+                call.ReplaceByNode(chain[0] as Node);
+                for (int i = 1; i < chain.Count; i++)
+                    (chain[i-1] as Node).Next = chain[i] as Node;
+                call.RemoveFromGraph();
+                if (leave.PrevArray.Count == 0)
+                    leave.RemoveFromGraph();
+            }
+
+            return finder.Calls.Count;
+        }
+
+        #region Private classes
+
+        private class CallFinder
+        {
+            private readonly ResidualMethod method;
+
+            private readonly MethodBodyBlock mbb;
+
+            internal readonly ArrayList Calls = new ArrayList();
+
+            internal CallFinder (ResidualMethod method, MethodBodyBlock mbb)
+            {
+                this.method = method;
+                this.mbb = mbb;
+            }
+
+            internal void Callback (Node node)
+            {
+                if (TailRecursion.isTailCall(this.method, this.mbb, node))
+                    this.Calls.Add(node);
+            }
+        }
+
+
+        private class BlockFinder
+        {
+            private readonly MethodBodyBlock mbb;
+
+            internal bool Found = false;
+
+            internal BlockFinder (MethodBodyBlock mbb)
+            {
+                this.mbb = mbb;
+            }
+
+            internal void Callback (Node node)
+            {
+                if (node is Block && node != this.mbb)
+                    this.Found = true;
+            }
+        }
+
+
+        #endregion
+    }
+}